@@ -7,6 +7,7 @@ static i2c_master_handle_t i2c_handle;
 static uint32_t mma8652_cfg;
 
 static volatile status_t i2c_res;
+static volatile mma8652_cb_t i2c_user_cb=NULL;
 
 #define MMA8652_ADDR				0x1D
 
@@ -36,6 +37,37 @@ static void i2c_callback(I2C_Type *base, i2c_master_handle_t *handle, status_t s
 {
     /* Signal transfer success when received success status. */
    i2c_res = status;
+   /* asynchronous read: notify the requester */
+   if (i2c_user_cb) {
+	   mma8652_cb_t cb=i2c_user_cb;
+	   i2c_user_cb=NULL;
+	   cb(status);
+   }
+}
+
+/* mma8652_write_reg
+ *   write a single register (blocking)
+ */
+static status_t mma8652_write_reg(uint8_t reg, uint8_t val)
+{
+	uint8_t buf[1];
+    i2c_master_transfer_t xfer = {
+    	.slaveAddress 	= MMA8652_ADDR,
+        .direction 		= kI2C_Write,
+        .subaddress 	= reg,
+        .subaddressSize = 1,
+        .data 			= buf,
+        .dataSize 		= 1,
+        .flags 			= kI2C_TransferDefaultFlag
+    };
+    buf[0]=val;
+	i2c_res=kStatus_I2C_Busy;
+    if (I2C_MasterTransferNonBlocking(i2c, &i2c_handle, &xfer)!=kStatus_Success) return kStatus_Fail;
+
+    while (i2c_res==kStatus_I2C_Busy) {
+    }
+
+    return i2c_res;
 }
 
 /* mma8652_init
@@ -163,39 +195,65 @@ status_t mma8652_status(uint8_t *st)
     return i2c_res;
 }
 
-/* mma8652_read_xyz
- *   returns the XYZ values
+/* mma8652_set_rate
+ *   change the output data rate (MMA8652_RATE_xxx). The sensor is put in
+ *   standby mode while CTRL_REG1 is updated.
  */
-status_t mma8652_read_xyz(int32_t* data)
+status_t mma8652_set_rate(uint32_t rate)
 {
-	uint32_t scale = (mma8652_cfg>>16) & 3; // full scale 2G, 3G, 8G
-	uint8_t buf[6]; //holds the values for Hi and Lo for each axis
-	int16_t raw[3]; //signed integer array to hold the treated data from the sensor's registers
+	mma8652_cfg = (mma8652_cfg & ~(7<<3)) | (rate & (7<<3));
+	if (mma8652_write_reg(MMA8652_CTRL_REG1, mma8652_cfg & 0xFE)!=kStatus_Success) return kStatus_Fail;
+	return mma8652_write_reg(MMA8652_CTRL_REG1, (mma8652_cfg & 0xFF) | 1);
+}
+
+/* mma8652_read_async
+ *   start a non-blocking read of the STATUS and OUT_X/Y/Z registers into
+ *   buf (7 bytes, 4 in 8 bit mode). cb is called from the I2C interrupt
+ *   with the transfer status when it is done.
+ */
+status_t mma8652_read_async(uint8_t *buf, mma8652_cb_t cb)
+{
+	status_t res;
     i2c_master_transfer_t xfer = {
     	.slaveAddress 	= MMA8652_ADDR,
         .direction 		= kI2C_Read,
-        .subaddress 	= MMA8652_OUT_X_MSB,
+        .subaddress 	= MMA8652_STATUS,
         .subaddressSize = 1,
         .data 			= buf,
-        .dataSize 		= 6,
+        .dataSize 		= 7,
         .flags 			= kI2C_TransferDefaultFlag
 	};
 
-	if (mma8652_cfg & MMA8652_RES_8) xfer.dataSize = 3;
+	if (mma8652_cfg & MMA8652_RES_8) xfer.dataSize = 4;
 
+	i2c_user_cb=cb;
 	i2c_res=kStatus_I2C_Busy;
-    I2C_MasterTransferNonBlocking(i2c, &i2c_handle, &xfer);
-
-    while (i2c_res==kStatus_I2C_Busy) {
-    }
+	res=I2C_MasterTransferNonBlocking(i2c, &i2c_handle, &xfer);
+	if (res!=kStatus_Success) i2c_user_cb=NULL;
+	return res;
+}
 
-    if (i2c_res!=kStatus_Success) return kStatus_Fail;
+/* mma8652_raw
+ *   extract the raw 12 bit XYZ values from a buffer filled by
+ *   mma8652_read_async
+ */
+void mma8652_raw(const uint8_t *buf, int16_t *raw)
+{
+	for (int i=0; i<3; i++) {
+		if (mma8652_cfg & MMA8652_RES_8) {
+			raw[i] = (int16_t)(buf[1+i] << 8) >> 4;
+		} else {
+			raw[i] = (int16_t)((buf[1+2*i] << 8) | buf[2+2*i]) >> 4;
+		}
+	}
+}
 
-    /* NXP AN4083, table 15, p17 */
-    for(int8_t i = 0; i < 3; i++){
-    	raw[i] = (int16_t)((buf[2*i] << 8) | buf[2*i+1]); //combine msb and lsb for each axis into 1 int16_t
-    	raw[i] = raw[i] >> 4;
-    }
+/* mma8652_to_mg
+ *   convert raw values to mg according to the full scale
+ */
+void mma8652_to_mg(const int16_t *raw, int32_t *data)
+{
+	uint32_t scale = (mma8652_cfg>>16) & 3; // full scale 2G, 3G, 8G
 
     for(int8_t i = 0; i < 3; i++){
     	switch(scale){
@@ -216,6 +274,42 @@ status_t mma8652_read_xyz(int32_t* data)
     		}
 		}
     }
+}
+
+/* mma8652_read_xyz
+ *   returns the XYZ values
+ */
+status_t mma8652_read_xyz(int32_t* data)
+{
+	uint8_t buf[6]; //holds the values for Hi and Lo for each axis
+	int16_t raw[3]; //signed integer array to hold the treated data from the sensor's registers
+    i2c_master_transfer_t xfer = {
+    	.slaveAddress 	= MMA8652_ADDR,
+        .direction 		= kI2C_Read,
+        .subaddress 	= MMA8652_OUT_X_MSB,
+        .subaddressSize = 1,
+        .data 			= buf,
+        .dataSize 		= 6,
+        .flags 			= kI2C_TransferDefaultFlag
+	};
+
+	if (mma8652_cfg & MMA8652_RES_8) xfer.dataSize = 3;
+
+	i2c_res=kStatus_I2C_Busy;
+    I2C_MasterTransferNonBlocking(i2c, &i2c_handle, &xfer);
+
+    while (i2c_res==kStatus_I2C_Busy) {
+    }
+
+    if (i2c_res!=kStatus_Success) return kStatus_Fail;
+
+    /* NXP AN4083, table 15, p17 */
+    for(int8_t i = 0; i < 3; i++){
+    	raw[i] = (int16_t)((buf[2*i] << 8) | buf[2*i+1]); //combine msb and lsb for each axis into 1 int16_t
+    	raw[i] = raw[i] >> 4;
+    }
+
+    mma8652_to_mg(raw, data);
 
     return i2c_res;
 }
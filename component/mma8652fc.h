@@ -31,9 +31,15 @@ typedef struct _mma8652fc_t {
 
 #define MMA8652_DATA_READY			(8)
 
+typedef void (*mma8652_cb_t)(status_t status);
+
 status_t mma8652_init(I2C_Type *i2c, uint32_t cfg);
+status_t mma8652_set_rate(uint32_t rate);
 status_t mma8652_id(uint32_t *id);
 status_t mma8652_status(uint8_t *st);
 status_t mma8652_read_xyz(int32_t* data);
+status_t mma8652_read_async(uint8_t *buf, mma8652_cb_t cb);
+void mma8652_raw(const uint8_t *buf, int16_t *raw);
+void mma8652_to_mg(const int16_t *raw, int32_t *data);
 
 #endif
@@ -94,48 +94,304 @@ static const char *eng_prefix[] = {
 #define PREFIX_END (PREFIX_START+\
 (int)((sizeof(eng_prefix)/sizeof(char *)-1)*3))
 
-static void eng_out(Calc *cc, real value, int digits, int numeric, int hold)
+/***************************************************************************
+ * number formatting
+ *   fixed digit formatter replacing the printf %E, %F and %G conversions
+ *   for the display modes. The value is scaled by a power of 10 in double
+ *   and rounded once to an integer holding the requested digits. The
+ *   product is only accurate to FMT_EXACT_DIGITS digits, so values close
+ *   to a rounding tie, more digits and out of range values fall back to
+ *   snprintf.
+ ***************************************************************************/
+#define FMT_FAST_DIGITS		15		/* size of the digit buffers */
+#ifdef FLOAT32
+#define FMT_EXACT_DIGITS	9		/* digits a float*10^k double product decides */
+#else
+#define FMT_EXACT_DIGITS	15
+#endif
+#define FMT_LINE_SIZE		512
+
+static const double fmt_p10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double fmt_pow10 (int n)
+{	double p=1.0;
+	while (n>22) { p*=1e22; n-=22; }
+	return p*fmt_p10[n];
+}
+
+static int fmt_near_tie (double m)
+/* m>=0 is within the scaling error of a half integer. The test is kept
+   in double: under FLOAT32, floor and fabs are the float functions */
+{	double d=m-__builtin_floor(m)-0.5;
+	return __builtin_fabs(d)<m*1e-13;
+}
+
+static int fmt_sig (double x, int prec, unsigned long long *n)
+/***** fmt_sig
+	round x>0 to prec significant digits: x ~ n*10^(e-prec+1), with
+	10^(prec-1)<=n<10^prec. returns the decimal exponent e, or INT_MIN
+	if the rounding can't be decided.
+*****/
+{	int b, e, k, it;
+	double m;
+	
+	frexp(x,&b);
+	/* floor((b-1)*log10(2)), may be one off */
+	e=(b-1)*78913;
+	e = e>=0 ? e>>18 : -((-e+(1<<18)-1)>>18);
+	for (it=0; it<3; it++) {
+		k=prec-1-e;
+		m = k>=0 ? x*fmt_pow10(k) : x/fmt_pow10(-k);
+		if (m>=fmt_p10[prec]) e++;
+		else if (m<fmt_p10[prec-1]) e--;
+		else break;
+	}
+	/* the scaling is not exact, leave near ties to printf */
+	if (fmt_near_tie(m)) return INT_MIN;
+	m=rint(m);
+	if (m>=fmt_p10[prec]) {
+		m=fmt_p10[prec-1]; e++;
+	}
+	*n=(unsigned long long)m;
+	return e;
+}
+
+static int fmt_utoa (char *s, unsigned long long n, int len)
+/***** fmt_utoa
+	write exactly len decimal digits of n (zero padded).
+*****/
+{	int i;
+	for (i=len-1; i>=0; i--) {
+		s[i]='0'+(char)(n%10);
+		n/=10;
+	}
+	return len;
+}
+
+static int fmt_exp (char *s, int e, char conv)
+/***** fmt_exp
+	write the exponent part (E+dd).
+*****/
+{	int i=0;
+	s[i++]=conv;
+	if (e<0) { s[i++]='-'; e=-e; } else s[i++]='+';
+	if (e>=100) s[i++]='0'+e/100;
+	s[i++]='0'+(e/10)%10;
+	s[i++]='0'+e%10;
+	return i;
+}
+
+static int fmt_mant (char *s, char *dg, int nd, int e, int sci)
+/***** fmt_mant
+	write the nd digits dg with exponent e as d.ddd (sci) or as a
+	plain decimal number.
+*****/
+{	int i=0, j;
+	if (sci || e==0) {
+		s[i++]=dg[0];
+		if (nd>1) {
+			s[i++]='.';
+			for (j=1; j<nd; j++) s[i++]=dg[j];
+		}
+	} else if (e>0) {
+		for (j=0; j<=e; j++) s[i++] = j<nd ? dg[j] : '0';
+		if (nd>e+1) {
+			s[i++]='.';
+			for (j=e+1; j<nd; j++) s[i++]=dg[j];
+		}
+	} else {
+		s[i++]='0'; s[i++]='.';
+		for (j=e+1; j<0; j++) s[i++]='0';
+		for (j=0; j<nd; j++) s[i++]=dg[j];
+	}
+	return i;
+}
+
+int fmt_num (char *s, real x, int prec, char conv)
+/***** fmt_num
+	format x as printf would do with "%.<prec><conv>", conv is one of
+	e, E, f, F, g, G. s must hold FMT_BUF_SIZE chars.
+	return the length of the string.
+*****/
+{	char fmt[8], dg[FMT_FAST_DIGITS+1];
+	unsigned long long n;
+	double v=x;
+	int i=0, e, nd, upper=(conv=='E' || conv=='F' || conv=='G');
+	
+	if (signbit(v)) { s[i++]='-'; v=-v; }
+	if (isnan(v) || isinf(v)) {
+		strcpy(s+i, isnan(v) ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf"));
+		return i+3;
+	}
+	switch (conv) {
+	case 'e': case 'E':
+		nd=prec+1;
+		if (nd>FMT_EXACT_DIGITS || (v!=0.0 && (v<1e-290 || v>1e290))) break;
+		if (v==0.0) {
+			memset(dg,'0',nd); e=0;
+		} else {
+			e=fmt_sig(v,nd,&n);
+			if (e==INT_MIN) break;
+			fmt_utoa(dg,n,nd);
+		}
+		i+=fmt_mant(s+i,dg,nd,e,1);
+		i+=fmt_exp(s+i,e,conv);
+		s[i]=0;
+		return i;
+	case 'f': case 'F':
+		if (prec>FMT_EXACT_DIGITS || v*fmt_p10[prec]>=fmt_p10[FMT_EXACT_DIGITS]) break;
+		if (fmt_near_tie(v*fmt_p10[prec])) break;
+		n=(unsigned long long)rint(v*fmt_p10[prec]);
+		nd=1;
+		while (nd<=FMT_FAST_DIGITS && n>=(unsigned long long)fmt_p10[nd]) nd++;
+		if (nd<prec+1) nd=prec+1;
+		fmt_utoa(dg,n,nd);
+		for (e=0; e<nd-prec; e++) s[i++]=dg[e];
+		if (prec) {
+			s[i++]='.';
+			for (; e<nd; e++) s[i++]=dg[e];
+		}
+		s[i]=0;
+		return i;
+	case 'g': case 'G':
+		nd = prec ? prec : 1;
+		if (nd>FMT_EXACT_DIGITS || (v!=0.0 && (v<1e-290 || v>1e290))) break;
+		if (v==0.0) {
+			s[i++]='0'; s[i]=0;
+			return i;
+		}
+		e=fmt_sig(v,nd,&n);
+		if (e==INT_MIN) break;
+		fmt_utoa(dg,n,nd);
+		while (nd>1 && dg[nd-1]=='0') nd--;
+		if (e<-4 || e>=(prec ? prec : 1)) {
+			i+=fmt_mant(s+i,dg,nd,e,1);
+			i+=fmt_exp(s+i,e,conv=='g' ? 'e' : 'E');
+		} else {
+			i+=fmt_mant(s+i,dg,nd,e,0);
+		}
+		s[i]=0;
+		return i;
+	default:
+		break;
+	}
+	/* slow path, the length of what was actually written */
+	snprintf(fmt,8,"%%.%d%c",prec,conv);
+	e=snprintf(s+i,FMT_BUF_SIZE-i,fmt,v);
+	if (e<0) e=0;
+	return i+MIN(e,FMT_BUF_SIZE-i-1);
+}
+
+static char fmt_spec (char *fmt, int *prec)
+/***** fmt_spec
+	decode the "%0.<prec><conv>" display formats.
+*****/
 {
-	int expof10;
-	int is_signed = signbit(value);
-	char* sign = is_signed ? "-" : "";
+	while (*fmt && *fmt!='.') fmt++;
+	if (*fmt) fmt++;
+	*prec=0;
+	while (isdigit(*fmt)) *prec = *prec*10+(*fmt++ -'0');
+	return *fmt;
+}
 
-	if (is_signed) value = -value;
+static int fmt_eng (char *s, real value, int digits, int numeric)
+/***** fmt_eng
+	engineering format: mantissa in [1,1000[ with an exponent multiple
+	of 3, written as E+xx (numeric) or as a SI prefix.
+*****/
+{	char dg[FMT_FAST_DIGITS+1];
+	unsigned long long n;
+	double v=value;
+	int i=0, e, ee, nd;
 	
-	switch(fpclassify(value)) {
+	if (digits>FMT_FAST_DIGITS) digits=FMT_FAST_DIGITS;
+	if (digits<1) digits=1;
+	if (signbit(v)) { s[i++]='-'; v=-v; }
+	switch (fpclassify(value)) {
 	case FP_NORMAL:
-		expof10 = (int) log10(value);
-		if(expof10 > 0)
-			expof10 = (expof10/3)*3;
-		else
-			expof10 = (-expof10+3)/3*(-3); 
-	 
-		value *= pow(10,-expof10);
-	
-		if (value >= 1000.) { value /= 1000.0; expof10 += 3; }
-	
-		if(numeric || (expof10 < PREFIX_START) || (expof10 > PREFIX_END))
-			outputfhold(cc, hold, "%s%.*GE%+.2d", sign, digits, value, expof10); 
-		else
-			outputfhold(cc, hold, "%s%.*G%s", sign, digits, value, 
-	          eng_prefix[(expof10-PREFIX_START)/3]);
+		nd=digits;
+		e = nd>FMT_EXACT_DIGITS ? INT_MIN : fmt_sig(v,nd,&n);
+		if (e==INT_MIN) {
+			/* undecided rounding: get the digits from printf */
+			char t[FMT_BUF_SIZE];
+			snprintf(t,FMT_BUF_SIZE,"%.*E",nd-1,v);
+			dg[0]=t[0];
+			memcpy(dg+1,t+2,nd-1);
+			e=atoi(t+(nd>1 ? nd+2 : 2));
+		} else fmt_utoa(dg,n,nd);
+		while (nd>1 && dg[nd-1]=='0') nd--;
+		ee = e>=0 ? (e/3)*3 : -((-e+2)/3)*3;
+		i+=fmt_mant(s+i,dg,nd,e-ee,0);
+		if (numeric || (ee < PREFIX_START) || (ee > PREFIX_END)) {
+			i+=fmt_exp(s+i,ee,'E');
+		} else {
+			strcpy(s+i,eng_prefix[(ee-PREFIX_START)/3]);
+			i+=strlen(s+i);
+		}
 		break;
 	case FP_INFINITE:
-		outputfhold(cc, hold, "%sINF", sign);
+		strcpy(s+i,"INF"); i+=3;
 		break;
 	case FP_NAN:
-		outputfhold(cc, hold, "%sNAN", sign);
+		strcpy(s+i,"NAN"); i+=3;
 		break;
 	case FP_SUBNORMAL:
 	case FP_ZERO:
 	default:
-		if(numeric) {
-			outputfhold(cc, hold, "%s%.*GE+00", sign, digits, 0.0);
-		} else {
-			outputfhold(cc, hold, "%s%.*G", sign, digits, 0.0);
+		s[i++]='0';
+		if (numeric) {
+			strcpy(s+i,"E+00"); i+=4;
 		}
 		break;
 	}
+	s[i]=0;
+	return i;
+}
+
+static int fmt_real (Calc *cc, char *s, real x)
+/***** fmt_real
+	format a real number according to the display mode.
+*****/
+{	int prec;
+	char conv;
+	
+	switch (cc->disp_mode) {
+	case 0:		/* smart STD */
+		if ((fabs(x)>cc->maxexpo || fabs(x)<cc->minexpo) && x!=0.0) 
+			conv=fmt_spec(cc->expoformat,&prec);
+		else conv=fmt_spec(cc->fixedformat,&prec);
+		return fmt_num(s,x,prec,conv);
+	case 1:		/* ENG1 */
+	case 2:		/* ENG2 */
+		return fmt_eng(s,x,cc->disp_digits,!cc->disp_eng_sym);
+	case 3:		/* SCI */
+		conv=fmt_spec(cc->expoformat,&prec);
+		return fmt_num(s,x,prec,conv);
+	case 4:		/* FIXED */
+		conv=fmt_spec(cc->fixedformat,&prec);
+		return fmt_num(s,x,prec,conv);
+	case 5:		/* FRAC */
+	default:	/* never used */
+		break;
+	}
+	s[0]=0;
+	return 0;
+}
+
+static int fmt_field (char *s, int len, int w)
+/***** fmt_field
+	right justify the len chars of s in a field of width w.
+*****/
+{
+	if (len<w) {
+		memmove(s+(w-len),s,len+1);
+		memset(s,' ',w-len);
+		return w;
+	}
+	return len;
 }
 
 /* now part of the global structure
@@ -149,42 +405,31 @@ char expoformat[16]="%0.4E";
 char fixedformat[16]="%0.5G";
 */
 
+static int fmt_rfield (Calc *cc, char *s, real x)
+/***** fmt_rfield
+	format a real number in a field of width disp_fieldw.
+*****/
+{
+	if (fabs(x)<cc->epsilon) x=0.0;
+	return fmt_field(s,fmt_real(cc,s,x),cc->disp_fieldw);
+}
+
 void real_out (Calc *cc, real x)
 /***** real_out
 	print a real number.
 *****/
-{
-	if (fabs(x)<cc->epsilon) x=0.0;
-	switch (cc->disp_mode) {
-	case 0:		/* smart STD */
-		if ((fabs(x)>cc->maxexpo || fabs(x)<cc->minexpo) && x!=0.0) 
-			outputfhold(cc,0,cc->expoformat,x);
-		else outputfhold(cc,0,cc->fixedformat,x);
-		break;
-	case 1:		/* ENG1 */
-	case 2:		/* ENG2 */
-		eng_out(cc,x,cc->disp_digits,!cc->disp_eng_sym,0);
-		break;
-	case 3:		/* SCI */
-		outputfhold(cc,0,cc->expoformat,x);
-		break;
-	case 4:		/* FIXED */
-		outputfhold(cc,0,cc->fixedformat,x);
-		break;
-	case 5:		/* FRAC */
-		break;
-	default:	/* never used */
-		break;
-	}
-	outputfhold(cc,cc->disp_fieldw,"");
+{	char s[FMT_BUF_SIZE];
+	fmt_rfield(cc,s,x);
+	output(cc,s);
 }
 
 void out_matrix (Calc *cc, header *hd)
 /***** out_matrix
    print a matrix.
 *****/
-{	int c,r,i,j,c0,cend;
+{	int c,r,i,j,c0,cend,len;
 	real *m,*x;
+	char line[FMT_LINE_SIZE];
 	
 	int linew=cc->termwidth/cc->disp_fieldw;
 
@@ -195,71 +440,56 @@ void out_matrix (Calc *cc, header *hd)
 		if (c>linew) outputf(cc,"Column %d to %d:\n",c0+1,cend+1);
 		for (i=0; i<r; i++) {
 			x=mat(m,c,i,c0);
-			for (j=c0; j<=cend; j++) real_out(cc,*x++);
-			output(cc,"\n");
+			for (j=c0, len=0; j<=cend; j++) {
+				len+=fmt_rfield(cc,line+len,*x++);
+				if (len>FMT_LINE_SIZE-FMT_BUF_SIZE-2) {
+					output(cc,line); len=0;
+				}
+			}
+			line[len++]='\n'; line[len]=0;
+			output(cc,line);
 			if (sys_test_key()==escape) return;
 		}
 	}
 }
 
-void complex_out (Calc *cc, real x, real y)
-/***** complex_out
-	print a complex number.
+static int fmt_cfield (Calc *cc, char *s, real x, real y)
+/***** fmt_cfield
+	format a complex number x+iy in a field of width 2*disp_fieldw.
 *****/
-{
+{	int len;
 //	real m=sqrt(x*x+y*y);
 //	x=fabs(x)/m>cc->epsilon ? x : 0.0;
 //	y=fabs(y)/m>cc->epsilon ? y : 0.0;
 	x=fabs(x)>cc->epsilon ? x : 0.0;
 	y=fabs(y)>cc->epsilon ? y : 0.0;
-	switch (cc->disp_mode) {
-	case 0:		/* smart STD */
-		if ((fabs(x)>cc->maxexpo || fabs(x)<cc->minexpo) && x!=0.0) 
-			outputfhold(cc,0,cc->expoformat,x);
-		else outputfhold(cc,0,cc->fixedformat,x);
-		if (y>=0) outputfhold(cc,-1,"+");
-		else outputfhold(cc,-1,"-");
-		y=fabs(y);
-		if ((y>cc->maxexpo || y<cc->minexpo) && y!=0.0)
-			outputfhold(cc,-1,cc->expoformat,y);
-		else outputfhold(cc,-1,cc->fixedformat,y);
-		break;
-	case 1:		/* ENG1 */
-	case 2:		/* ENG2 */
-		eng_out(cc,x,cc->disp_digits,!cc->disp_eng_sym,0);
-		if (y>=0) outputfhold(cc,-1,"+");
-		else outputfhold(cc,-1,"-");
-		y=fabs(y);
-		eng_out(cc,y,cc->disp_digits,!cc->disp_eng_sym,-1);
-		break;
-	case 3:		/* SCI */
-		outputfhold(cc,0,cc->expoformat,x);
-		if (y>=0) outputfhold(cc,-1,"+");
-		else outputfhold(cc,-1,"-");
-		y=fabs(y);
-		outputfhold(cc,-1,cc->expoformat,y);
-		break;
-	case 4:		/* FIXED */
-		outputfhold(cc,0,cc->fixedformat,x);
-		if (y>=0) outputfhold(cc,-1,"+");
-		else outputfhold(cc,-1,"-");
-		y=fabs(y);
-		outputfhold(cc,-1,cc->fixedformat,y);
-		break;
-	case 5:		/* FRAC */
-		break;
-	default:	/* never used */
-		break;
+	if (cc->disp_mode==5) {		/* FRAC */
+		len=0;
+	} else {
+		len=fmt_real(cc,s,x);
+		s[len++] = y>=0 ? '+' : '-';
+		len+=fmt_real(cc,s+len,fabs(y));
 	}
-	outputfhold(cc,2*cc->disp_fieldw,"i");
+	s[len++]='i'; s[len]=0;
+	return fmt_field(s,len,2*cc->disp_fieldw);
+}
+
+void complex_out (Calc *cc, real x, real y)
+/***** complex_out
+	print a complex number.
+*****/
+{	char s[2*FMT_BUF_SIZE+8];
+	fmt_cfield(cc,s,x,y);
+	output(cc,s);
 }
 
 void out_cmatrix (Calc *cc, header *hd)
 /***** out_matrix
    print a complex matrix.
 *****/
-{	int c,r,i,j,c0,cend;
+{	int c,r,i,j,c0,cend,len;
 	real *m,*x;
+	char line[FMT_LINE_SIZE];
 
 	int linew=cc->termwidth/(2*cc->disp_fieldw);
 
@@ -270,11 +500,47 @@ void out_cmatrix (Calc *cc, header *hd)
 		if (c>linew) outputf(cc,"Column %d to %d:\n",c0+1,cend+1);
 		for (i=0; i<r; i++) {
 			x=cmat(m,c,i,c0);
-			for (j=c0; j<=cend; j++) {
-				complex_out(cc,*x,*(x+1)); 
+			for (j=c0, len=0; j<=cend; j++) {
+				len+=fmt_cfield(cc,line+len,*x,*(x+1));
 				x+=2;
+				if (len>FMT_LINE_SIZE-2*FMT_BUF_SIZE-8) {
+					output(cc,line); len=0;
+				}
 			}
-			output(cc,"\n");
+			line[len++]='\n'; line[len]=0;
+			output(cc,line);
+			if (sys_test_key()==escape) return;
+		}
+	}
+}
+
+void out_qmatrix (Calc *cc, header *hd)
+/***** out_qmatrix
+   print a fixed point matrix with its real values.
+*****/
+{	int c,r,q,i,j,c0,cend,len;
+	real s;
+	char line[FMT_LINE_SIZE];
+	
+	int linew=cc->termwidth/cc->disp_fieldw;
+
+	r=qdimsof(hd)->r; c=qdimsof(hd)->c; q=qdimsof(hd)->q;
+	s=(real)1.0/(real)((int64_t)1<<q);
+	for (c0=0; c0<c; c0+=linew) {
+		cend=c0+linew-1; 
+		if (cend>=c) cend=c-1;
+		if (c>linew) outputf(cc,"Column %d to %d:\n",c0+1,cend+1);
+		for (i=0; i<r; i++) {
+			for (j=c0, len=0; j<=cend; j++) {
+				LONG k=(LONG)c*i+j;
+				real x=(q==15) ? ((int16_t*)qmatrixof(hd))[k]*s : ((int32_t*)qmatrixof(hd))[k]*s;
+				len+=fmt_rfield(cc,line+len,x);
+				if (len>FMT_LINE_SIZE-FMT_BUF_SIZE-2) {
+					output(cc,line); len=0;
+				}
+			}
+			line[len++]='\n'; line[len]=0;
+			output(cc,line);
 			if (sys_test_key()==escape) return;
 		}
 	}
@@ -293,6 +559,7 @@ void give_out (Calc *cc, header *hd)
 			output(cc,"\n"); break;
 		case s_matrix: out_matrix(cc,hd); break;
 		case s_cmatrix: out_cmatrix(cc,hd); break;
+		case s_qmatrix: out_qmatrix(cc,hd); break;
 		case s_string: output(cc,stringof(hd)); output(cc,"\n"); break;
 		case s_funcref: {
 			char* name=hd->name;
@@ -343,6 +610,8 @@ static binfunc_t binfunc_list[] = {
 
 	{"complex",1,mcomplex},
 	{"re",1,mre},
+	{"q15",1,mq15},
+	{"q31",1,mq31},
 	{"im",1,mim},
 	{"abs",1,mabs},
 	{"arg",1,marg},
@@ -388,6 +657,7 @@ static binfunc_t binfunc_list[] = {
 	{"setdiag",3,msetdiag},
 
 	{"bandmult",2,wmultiply},
+	{"baud",1,mbaud},
 	{"symmult",2,smultiply},
 	
 	{"dup",2,mdup},
@@ -405,7 +675,17 @@ static binfunc_t binfunc_list[] = {
 	{"max",2,mmax},
 	{"min",2,mmin},
 	{"sort",1,msort},
+	{"sortrows",1,msortrows1},
+	{"sortrows",2,msortrows},
 	{"count",2,mstatistics},
+	{"mean",1,mmean},
+	{"var",1,mvar},
+	{"std",1,mstd},
+	{"minmax",1,mminmax},
+	{"quantile",2,mquantile},
+	{"quantile",3,mquantile3},
+	{"statacc",1,mstatacc1},
+	{"statacc",2,mstatacc},
 	
 	{"polyval",2,mpolyval},
 	{"polyadd",2,mpolyadd},
@@ -427,14 +707,24 @@ static binfunc_t binfunc_list[] = {
 	{"lusolve",2,mlusolve},
 	
 	{"filter",4,mfilter},
+	{"conv",2,mconv},
+	{"sosfilt",2,msosfilt2},
+	{"sosfilt",3,msosfilt},
 	{"fft",1,mfft},
 	{"ifft",1,mifft},
+	{"rfft",1,mrfft},
+	{"irfft",1,mirfft},
+	{"irfft",2,mirfft2},
+	{"psd",2,mpsd},
+	{"psd",3,mpsd3},
+	{"spectrogram",3,mspectrogram},
 	
 	{"seed",1,mseed},
 	{"random",1,mrandom},
 	{"shuffle",1,mshuffle},
 	{"normal",1,mnormal},
 	{"find",2,mfind},
+	{"histc",2,mhistc},
 	
 	{"subplot",1,msubplot},
 	{"setplot",0,msetplot0},
@@ -452,6 +742,9 @@ static binfunc_t binfunc_list[] = {
 	
 	{"mread",1,mreadmatrix},
 	{"mwrite",3,mwritematrix},
+	{"msend",1,msendmatrix},
+	{"store",1,mstore},
+	{"restore",1,mrestore},
 	
 	{"rmfir",6,mrmfir},
 	
@@ -460,8 +753,15 @@ static binfunc_t binfunc_list[] = {
 	{"pcmfreq",1,mpcmfreq},
 	{"pcmplay",1,mpcmplay},
 	{"pcmrec",1,mpcmrec},
+	{"pcmrec",2,mpcmrec2},
 	{"pcmloop",0,mpcmloop},
+	{"pcmloop",1,mpcmloop1},
 	{"pcmbiquad",2,mpcmbiquad},
+	{"pcmbiquad",3,mpcmbiquad3},
+
+	{"accel",0,maccel},
+	{"accelstart",2,maccelstart},
+	{"accelread",0,maccelread},
 
 	{"pqcos",1,mpqcos},
 	{"pqfft",1,mpqfft},
@@ -471,6 +771,8 @@ static binfunc_t binfunc_list[] = {
 static const binfunc_t binfunc_list[] = {
 	{"abs",1,mabs},
 	{"accel",0,maccel},
+	{"accelread",0,maccelread},
+	{"accelstart",2,maccelstart},
 	{"acos",1,macos},
 	{"all",1,mall},
 	{"any",1,many},
@@ -481,6 +783,7 @@ static const binfunc_t binfunc_list[] = {
 	{"atan",1,matan},
 	{"band",3,mband},
 	{"bandmult",2,wmultiply},
+	{"baud",1,mbaud},
 	{"bin",2,mbin},
 	{"ceil",1,mceil},
 	{"charpoly",1,mcharpoly},
@@ -488,6 +791,7 @@ static const binfunc_t binfunc_list[] = {
 	{"colsum",1,mcolsum},
 	{"complex",1,mcomplex},
 	{"conj",1,mconj},
+	{"conv",2,mconv},
 	{"cos",1,mcos},
 	{"count",2,mstatistics},
 	{"cumprod",1,mcumprod},
@@ -511,12 +815,15 @@ static const binfunc_t binfunc_list[] = {
 	{"floor",1,mfloor},
 	{"format",2,mformat},
 	{"hb",1,mtridiag},
+	{"histc",2,mhistc},
 	{"ifft",1,mifft},
 	{"im",1,mim},
 	{"index",0,mindex},
 	{"input",1,minput},
 	{"interp",2,dd},
 	{"interpval",3,ddval},
+	{"irfft",1,mirfft},
+	{"irfft",2,mirfft2},
 	{"iscomplex",1,miscomplex},
 	{"isfinite",1,misfinite},
 	{"isfunction",1,misfunction},
@@ -534,21 +841,27 @@ static const binfunc_t binfunc_list[] = {
 	{"matrix",2,mmatrix},
 	{"max",1,mmax1},
 	{"max",2,mmax},
+	{"mean",1,mmean},
 	{"min",1,mmin1},
 	{"min",2,mmin},
+	{"minmax",1,mminmax},
 	{"mod",2,mmod},
 	{"mread",1,mreadmatrix},
+	{"msend",1,msendmatrix},
 	{"mwrite",3,mwritematrix},
 	{"name",1,mname},
 	{"nonzeros",1,mnonzeros},
 	{"normal",1,mnormal},
 	{"ones",1,mones},
 	{"pcmbiquad",2,mpcmbiquad},
+	{"pcmbiquad",3,mpcmbiquad3},
 	{"pcmfreq",0,mpcmfreq0},
 	{"pcmfreq",1,mpcmfreq},
 	{"pcmloop",0,mpcmloop},
+	{"pcmloop",1,mpcmloop1},
 	{"pcmplay",1,mpcmplay},
 	{"pcmrec",1,mpcmrec},
+	{"pcmrec",2,mpcmrec2},
 	{"pcmvol",1,mpcmvol},
 	{"plot",2,mplot1},
 	{"plot",3,mplot},
@@ -568,9 +881,17 @@ static const binfunc_t binfunc_list[] = {
 	{"pqifft",1,mpqifft},
 	{"printf",2,mprintf},
 	{"prod",1,mprod},
+	{"psd",2,mpsd},
+	{"psd",3,mpsd3},
+	{"q15",1,mq15},
+	{"q31",1,mq31},
+	{"quantile",2,mquantile},
+	{"quantile",3,mquantile3},
 	{"random",1,mrandom},
 	{"re",1,mre},
 	{"redim",2,mredim},
+	{"restore",1,mrestore},
+	{"rfft",1,mrfft},
 	{"round",2,mround},
 	{"rows",1,mrows},
 	{"setdiag",3,msetdiag},
@@ -581,7 +902,16 @@ static const binfunc_t binfunc_list[] = {
 	{"sin",1,msin},
 	{"size",-1,msize},
 	{"sort",1,msort},
+	{"sortrows",1,msortrows1},
+	{"sortrows",2,msortrows},
+	{"sosfilt",2,msosfilt2},
+	{"sosfilt",3,msosfilt},
+	{"spectrogram",3,mspectrogram},
 	{"sqrt",1,msqrt},
+	{"statacc",1,mstatacc1},
+	{"statacc",2,mstatacc},
+	{"std",1,mstd},
+	{"store",1,mstore},
 	{"subplot",1,msubplot},
 	{"sum",1,msum},
 	{"symmult",2,smultiply},
@@ -589,6 +919,7 @@ static const binfunc_t binfunc_list[] = {
 	{"text",5,mtext},
 	{"time",0,mtime},
 	{"title",1,mtitle},
+	{"var",1,mvar},
 	{"wait",1,mwait},
 	{"xargs",0,mxargs},
 	{"xgrid",5,mxgrid},
@@ -651,9 +982,6 @@ static const binfunc_t binfunc_list[] = {
 	{"huegrid",1,mdgrid},
 	{"solidhue",4,msolidh},
 	
-	{"store",1,mstore},
-	{"restore",1,mrestore},
-	
 	{"errorlevel",1,merrlevel},
 	{"setepsilon",1,msetepsilon}, /* redefined to epsilon(val) */
 #endif
@@ -743,6 +1071,7 @@ static cmdtyp do_return (Calc *cc);
 static cmdtyp do_endfunction (Calc *cc);
 static cmdtyp do_show (Calc *cc);
 static cmdtyp do_trace(Calc *cc);
+static cmdtyp do_profile (Calc *cc);
 static cmdtyp do_repeat (Calc *cc);
 static cmdtyp do_loop (Calc *cc);
 static cmdtyp do_for (Calc *cc);
@@ -824,6 +1153,7 @@ static cmd_t cmd_list[] = {
 	
 	{"show",	c_cmd,		do_show},
 	{"trace",	c_cmd,		do_trace},
+	{"profile",	c_cmd,		do_profile},
 };
 #else
 	/* sorted according to alphabet order, can be sent to FLASH memory on
@@ -856,6 +1186,7 @@ static const cmd_t cmd_list[] = {
 	{"ls",		c_cmd,		do_ls},
 	{"memdump",	c_cmd,		do_mdump},
 	{"mkdir",	c_cmd,		do_mkdir},
+	{"profile",	c_cmd,		do_profile},
 	{"quit",	c_quit,		do_quit},
 	{"repeat",	c_repeat,	do_repeat},
 	{"return",	c_return,	do_return},
@@ -934,6 +1265,9 @@ static int cmd_find (Calc *cc, int *l)
 }
 
 static int compile(Calc *cc, char *dest, int root_cmd_idx);
+static char* fold_body (Calc *cc, char *start, char *end, header *udf, char *name);
+static int udf_folded (char *p, char *end);
+static void skip_blank (Calc *cc);
 
 static cmdtyp cmd_parse_and_exec (Calc *cc)
 /***** command_run
@@ -956,9 +1290,7 @@ static cmdtyp cmd_parse_and_exec (Calc *cc)
 		case c_for:
 		case c_while:
 		case c_if: {
-			jmp_buf *oldenv, env;
-			unsigned int oldflags;
-			char *oldline, *oldnext;
+			unwind_t uw;
 			int sz;
 			header *hd=new_command(cc,cmd_idx);
 			char *dest=(char*)(hd+1);		// get the address after the header
@@ -969,43 +1301,24 @@ static cmdtyp cmd_parse_and_exec (Calc *cc)
 			hd->size=sizeof(header)+sz;cc->newram=(char*)nextof(hd);
 			CC_UNSET(cc,CC_PARSE_UDF);
 			
+			// save the context, the chunk is unwound on error
+			uw.line=cc->line;
+			uw.next=cc->next;
+			uw.flags=cc->flags;
+			uw.udfstart=cc->udfstart;
+			UNWIND_PUSH(cc,&uw,UW_CHUNK);
 			// move the chunk code to the udf region
 			cc->udfstart-=hd->size;
 			memmove(cc->udfstart,hd,hd->size);
 			cc->newram=(char*)hd;
-			// execute the code
-			oldline=cc->line;
-			oldnext=cc->next;
-			oldenv=cc->env;
-			oldflags=cc->flags;
-			// setup the new scope
-			cc->env=&env;
+			// setup the new scope and execute the code
 			CC_SET(cc,CC_EXEC_UDF);
-			cc->env=&env;
 			cc->line=cc->next=cc->udfstart+sizeof(header);
-
-			switch (setjmp(env)) {
-			case 0:
-				break;
-			default:
-				cc->next=oldnext;
-				cc->line=oldline;
-				cc->flags=oldflags;
-				cc->env=oldenv;
-				cc->udfstart+=((header*)cc->udfstart)->size;
-				output(cc,"error in chunk\n");
-				longjmp(*cc->env,2);	/* back to enclosing error handler */
-			}
 			
 			cmd=cmd_parse_and_exec(cc);
 			
-			// restore context
-			cc->next=oldnext;
-			cc->line=oldline;
-			cc->flags=oldflags;
-			cc->env=oldenv;
-			// restore the udf region
-			cc->udfstart+=((header*)cc->udfstart)->size;
+			// restore context and the udf region
+			cc_leave(cc,&uw);
 			return cmd;
 		}
 		case c_elseif:
@@ -1092,7 +1405,8 @@ static cmdtyp do_list (Calc *cc)
 
 static const char * sname[] = {
 	"real", "complex", "real matrix", "complex matrix", "string", "user function",
-	"reference", "real submatrix reference", "complex submatrix reference", "function reference", "command"
+	"reference", "real submatrix reference", "complex submatrix reference", "function reference", "command",
+	"fixed point matrix"
 };
 
 static cmdtyp do_listvar (Calc *cc)
@@ -1110,6 +1424,10 @@ static cmdtyp do_listvar (Calc *cc)
 			outputf(cc,"%-" STR(LABEL_LEN_MAX) "s : %s (%dx%d)",hd->name,
 				sname[hd->type],dimsof(hd)->r,dimsof(hd)->c);
 			break;
+		case s_qmatrix:
+			outputf(cc,"%-" STR(LABEL_LEN_MAX) "s : %s Q%d (%dx%d)",hd->name,
+				sname[hd->type],qdimsof(hd)->q,qdimsof(hd)->r,qdimsof(hd)->c);
+			break;
 		case s_reference:
 			outputf(cc,"%-" STR(LABEL_LEN_MAX) "s : %s",hd->name,sname[hd->type]);
 			break;
@@ -1210,6 +1528,10 @@ static cmdtyp do_help (Calc *cc)
 			outputf(cc,"%s is a %s (%dx%d) variable\n",hd->name,
 				sname[hd->type],dimsof(hd)->r,dimsof(hd)->c);
 			break;
+		case s_qmatrix:
+			outputf(cc,"%s is a %s Q%d (%dx%d) variable\n",hd->name,
+				sname[hd->type],qdimsof(hd)->q,qdimsof(hd)->r,qdimsof(hd)->c);
+			break;
 		case s_reference:
 			outputf(cc,"%s is a %s variable\n",hd->name,sname[hd->type]);
 			break;
@@ -1256,12 +1578,19 @@ done:
 
 static cmdtyp do_mdump (Calc *cc)
 {	header *hd;
+	char *base;
+	unsigned long size,used,hwm;
+	int i;
 	sys_out_mode(CC_OUTPUT);
 	output(cc,"ramstart   : 0x00000000\n");
 	outputf(cc,"startlocal : 0x%08X\n",cc->startlocal-cc->ramstart);
 	outputf(cc,"endlocal   : 0x%08X\n",cc->endlocal-cc->ramstart);
-	outputf(cc,"newram     : 0x%08X\n",cc->newram-cc->ramstart);
-	outputf(cc,"ramend     : 0x%08X\n\n",cc->ramend-cc->ramstart);
+	outputf(cc,"newram     : 0x%08X (max 0x%08X)\n",cc->newram-cc->ramstart,cc->newrammax-cc->ramstart);
+	outputf(cc,"udfstart   : 0x%08X (min 0x%08X)\n",cc->udfstart-cc->ramstart,cc->udfstartmin-cc->ramstart);
+	outputf(cc,"ramend     : 0x%08X\n",cc->ramend-cc->ramstart);
+	for (i=0; pool_info(i,&base,&size,&used,&hwm); i++)
+		outputf(cc,"scratch %d  : 0x%08lX, size %6lu, used %6lu, max %6lu\n",i,(ULONG)base,size,used,hwm);
+	output(cc,"\n");
 	hd=(header *)cc->ramstart;
 	while ((char *)hd<cc->newram) {
 		outputf(cc,"0x%08X : %-" STR(LABEL_LEN_MAX) "s, ",(char *)hd-cc->ramstart,hd->name);
@@ -1469,13 +1798,149 @@ static cmdtyp do_dump (Calc *cc)
 }
 
 /******************************* module loading *****************************/
+/* compiled module cache
+   a file only made of function definitions (and comments) is saved after
+   its first successful load to <file>c (lib.e -> lib.ec), as the block of
+   udf objects it created. udf objects only hold offsets, so the block is
+   relocatable: later loads copy it straight below udfstart instead of
+   parsing and compiling the file again. The image is used only if the
+   source hash, the build signature (real and header formats, command
+   table the precompiled bodies refer to) and the folding environment
+   match. Folding depends on the builtin functions that a udf or a
+   variable hides when the file is compiled (fold_name_free), the
+   builtin constants it folds can't change.
+ */
+typedef struct {
+	char		magic[4];		/* "CCUI" */
+	uint32_t	sign;			/* build signature */
+	uint32_t	env;			/* folding environment */
+	uint32_t	hash;			/* source file hash */
+	uint32_t	srcsize;		/* source file size */
+	uint32_t	size;			/* size of the udf block */
+} udf_image_t;
+
+#define CODE_VERSION	2		/* compiled code format, 2: folded constants */
+
+static uint32_t fnv1a (uint32_t h, const void *buf, size_t n)
+{	const unsigned char *p=(const unsigned char *)buf;
+	while (n--) { h^=*p++; h*=16777619U; }
+	return h;
+}
+
+static uint32_t load_sign (void)
+{	uint32_t h=2166136261U;
+	int k, sz[5]={sizeof(real),sizeof(header),ALIGNMENT,CODE_VERSION,sizeof(udf_image_t)};
+	h=fnv1a(h,sz,sizeof(sz));
+	for (k=0; k<CMDS; k++) h=fnv1a(h,cmd_list[k].name,strlen(cmd_list[k].name)+1);
+	return h;
+}
+
+static uint32_t load_env (Calc *cc)
+/* the foldable builtin functions hidden by a udf or a variable */
+{	uint32_t h=2166136261U;
+	char *name;
+	int i;
+	for (i=0; (name=luf_func_name(i))!=NULL; i++)
+		if (searchudf(cc,name)) h=fnv1a(h,name,strlen(name)+1);
+	return h;
+}
+
+static uint32_t load_hash (FILE *f, uint32_t *size)
+/* hash the source file and rewind it */
+{	char buf[256];
+	size_t n;
+	uint32_t h=2166136261U;
+	*size=0;
+	while ((n=fread(buf,1,sizeof(buf),f))>0) {
+		h=fnv1a(h,buf,n); *size+=n;
+	}
+	rewind(f);
+	return h;
+}
+
+static int load_image (Calc *cc, char *name, uint32_t env, uint32_t hash, uint32_t srcsize)
+/* put the udf block of a valid image below udfstart, 0 if not possible */
+{	udf_image_t im;
+	FILE *f=fopen(name,"rb");
+	char *dest;
+	header *hd;
+	int ok=0;
+	if (!f) return 0;
+	if (fread(&im,sizeof(im),1,f)!=1 || memcmp(im.magic,"CCUI",4) || im.sign!=load_sign()
+		|| im.env!=env || im.hash!=hash || im.srcsize!=srcsize || im.size==0) goto end;
+	dest=cc->udfstart-im.size;
+	if (im.size>(uint32_t)(cc->udfstart-cc->newram) || dest-80<cc->newram) goto end;
+	if (fread(dest,1,im.size,f)!=im.size) goto end;
+	/* check the block is a list of udfs */
+	for (hd=(header *)dest; (char *)hd<dest+im.size; hd=nextof(hd))
+		if (hd->type!=s_udf || hd->size<(int)sizeof(header) || (char *)nextof(hd)>dest+im.size) goto end;
+	/* replace the functions with the same names, then link the block */
+	for (hd=(header *)dest; (char *)hd<dest+im.size; hd=nextof(hd))
+		kill_udf(cc,hd->name);
+	if (dest+im.size!=cc->udfstart) memmove(cc->udfstart-im.size,dest,im.size);
+	cc->udfstart-=im.size;
+	ok=1;
+end:
+	fclose(f);
+	return ok;
+}
+
+static void save_image (Calc *cc, char *name, uint32_t env, uint32_t hash, uint32_t srcsize, int nfunc)
+/* save the nfunc udfs last defined, if they can be relocated */
+{	udf_image_t im;
+	header *hd=(header *)cc->udfstart;
+	char *p;
+	int i,k,nargs;
+	unsigned int defmap;
+	FILE *f;
+	for (i=0; i<nfunc; i++, hd=nextof(hd)) {
+		if ((char *)hd>=cc->udfend || hd->type!=s_udf) return;
+		/* default values must not point to other objects */
+		p=udfargsof(hd); nargs=*(int *)p; p+=sizeof(int);
+		defmap=*(unsigned int *)p; p+=sizeof(unsigned int);
+		for (k=0; k<nargs; k++) {
+			if (defmap & (1<<k)) {
+				stacktyp t=((header *)p)->type;
+				if (t!=s_real && t!=s_complex && t!=s_matrix && t!=s_cmatrix
+					&& t!=s_qmatrix && t!=s_string) return;
+			}
+			p=udfnextarg(p, defmap & (1<<k));
+		}
+	}
+	memcpy(im.magic,"CCUI",4);
+	im.sign=load_sign(); im.env=env; im.hash=hash; im.srcsize=srcsize;
+	im.size=(char *)hd-cc->udfstart;
+	f=fopen(name,"wb");
+	if (!f) return;
+	if (fwrite(&im,sizeof(im),1,f)!=1 || fwrite(cc->udfstart,1,im.size,f)!=im.size) {
+		fclose(f); remove(name);
+		return;
+	}
+	fclose(f);
+}
+
+static int load_peek (Calc *cc)
+/* skip blanks and comments up to the next statement. return 1 if it
+   defines a new function, 0 else */
+{	char name[LABEL_LEN_MAX+1], *p;
+	int n=0;
+	skip_blank(cc);
+	p=cc->next;
+	if (strncmp(p,"function",8) || ISALPHA(p[8]) || ISDIGIT(p[8]) || p[8]=='_') return 0;
+	p+=8;
+	while (*p==' ' || *p=='\t') p++;
+	while ((ISALPHA(*p) || ISDIGIT(*p) || *p=='_' || *p=='$') && n<LABEL_LEN_MAX) name[n++]=*p++;
+	name[n]=0;
+	return n && !searchudf(cc,name);
+}
+
 /***** load_file
 	interpret a file.
 *****/
 static cmdtyp do_load (Calc *cc)
 {
 	/* saved context */
-	jmp_buf *oldenv;
+	unwind_t uw;
 	char *oldline,*oldnext;
 	FILE *oldinfile;
 	int oldlinenb, oldtrace;
@@ -1484,6 +1949,9 @@ static cmdtyp do_load (Calc *cc)
 	char *filename;
 	char input[LINEMAX]="";
 	char file[LINEMAX];
+	char image[LINEMAX]="";
+	uint32_t hash=0, srcsize=0, foldenv=0;
+	volatile int nfunc=0, pure=1;
 	
 	if (CC_ISSET(cc,CC_EXEC_UDF)) cc_error(cc,"Cannot load a file in a function!");
 	
@@ -1498,6 +1966,7 @@ static cmdtyp do_load (Calc *cc)
 	oldinfile=cc->infile;
 	if (filename[0]==PATH_DELIM_CHAR) {	/* an absolute path, use it */
 		cc->infile=fopen(filename,"r");
+		if (cc->infile) strncpy(image,filename,LINEMAX-2);
 	} else {							/* use standard path */
 		for (int k=0; k<npath; k++) {
 			char fn[strlen(path[k])+strlen(filename)+strlen(EXTENSION)+strlen(PATH_DELIM_STR)+1];
@@ -1507,24 +1976,40 @@ static cmdtyp do_load (Calc *cc)
 			if (!cc->infile) {
 				strcat(fn,EXTENSION);
 				cc->infile=fopen(fn,"r");
-				if (cc->infile) break;
-			} else break;
+				if (cc->infile) { strncpy(image,fn,LINEMAX-2); break; }
+			} else { strncpy(image,fn,LINEMAX-2); break; }
 		}
 	}
 	
+	/* name of the compiled image: lib.e -> lib.ec */
+	image[LINEMAX-2]=0;
+	if (strlen(image)>strlen(EXTENSION) && !strcmp(image+strlen(image)-strlen(EXTENSION),EXTENSION))
+		strcat(image,"c");
+	else image[0]=0;
+	
 	/* interpret the file if it exists */
+	if (cc->infile && image[0]) {
+		hash=load_hash(cc->infile,&srcsize);
+		foldenv=load_env(cc);
+		if (load_image(cc,image,foldenv,hash,srcsize)) {
+			fclose(cc->infile);
+			cc->infile=oldinfile;
+			return c_quit;
+		}
+	}
 	if (cc->infile) {
 		/* set synchronisation point for error handling.
 		   save the context, setup the new one before call setjmp to help
 		   compiler optimization
 		 */
-		oldenv=cc->env;
 		oldnext=cc->next;
 		oldline=cc->line;
 		oldlinenb=cc->linenb;
 		oldtrace=cc->trace;
 		cc->trace=0;
 		cc->linenb=0;
+		uw.env=cc->env;
+		UNWIND_PUSH(cc,&uw,UW_CATCH);
 		cc->env=&env;
 		
 		switch (setjmp(env)) {
@@ -1536,9 +2021,10 @@ static cmdtyp do_load (Calc *cc)
 			cc->next=oldnext;
 			cc->line=oldline;
 			cc->linenb=oldlinenb;
-			cc->env=oldenv;
+			cc_leave(cc,&uw);
 			fclose(cc->infile);
 			cc->infile=oldinfile;
+			if (image[0] && pure && nfunc) save_image(cc,image,foldenv,hash,srcsize,nfunc);
 			return c_quit;
 		default:
 			/* error in a statement in the package or in a child package */
@@ -1546,10 +2032,10 @@ static cmdtyp do_load (Calc *cc)
 			cc->trace=oldtrace;
 			cc->next=oldnext;
 			cc->line=oldline;
-			cc->env=oldenv;
+			cc_leave(cc,&uw);
 			fclose(cc->infile);
 			cc->infile=oldinfile;
-			longjmp(*cc->env,2);	/* back to enclosing error handler */
+			cc_rethrow(cc);			/* back to enclosing error handler */
 			break;
 		}
 
@@ -1559,6 +2045,11 @@ static cmdtyp do_load (Calc *cc)
 	    	   lower level context (global scope) */
 		    CC_UNSET(cc,CC_NOSUBMREF|CC_PARSE_INDEX|CC_PARSE_PARAM_LIST|CC_PARSE_UDF);
 			cc->globalend=cc->endlocal;
+			/* only files defining new functions get a compiled image */
+			if (pure) {
+				if (load_peek(cc)) nfunc++;
+				else pure=0;
+			}
 			parse(cc);
 		}
 		/* we should never be here! */
@@ -1566,7 +2057,7 @@ static cmdtyp do_load (Calc *cc)
 		cc->next=oldnext;
 		cc->line=oldline;
 		cc->linenb=oldlinenb;
-		cc->env=oldenv;
+		cc_leave(cc,&uw);
 		fclose(cc->infile);
 		cc->infile=oldinfile;
 	} else {
@@ -1577,6 +2068,184 @@ static cmdtyp do_load (Calc *cc)
 	return c_cmd;
 }
 
+/***************************** workspace snapshot ***************************/
+/* store("file") saves the global variables and the user defined functions
+   as they lie in memory, restore("file") puts them back. Funcrefs are the
+   only objects holding pointers: they are saved as an offset in the udf
+   block, or as an index in binfunc_list for builtins, so the image can be
+   read back straight at ramstart and below ramend.
+ */
+typedef struct {
+	char		magic[4];		/* "CCWS" */
+	uint32_t	sign;			/* build signature */
+	uint32_t	varsize;		/* size of the global variables */
+	uint32_t	udfsize;		/* size of the udf block */
+} ws_image_t;
+
+#define WS_CHECK	0			/* check the funcrefs can be relocated */
+#define WS_SAVE		1			/* pointers -> offsets/indexes */
+#define WS_LOAD		2			/* offsets/indexes -> pointers */
+
+static uint32_t ws_sign (void)
+/* the load signature, plus the builtin table funcrefs index */
+{	uint32_t h=load_sign();
+	int k;
+	for (k=0; k<BINFUNCS; k++) {
+		h=fnv1a(h,binfunc_list[k].name,strlen(binfunc_list[k].name)+1);
+		h=fnv1a(h,&binfunc_list[k].nargs,sizeof(int));
+	}
+	return h;
+}
+
+static int ws_reloc1 (Calc *cc, header *hd, int mode)
+/* relocate a single funcref, 0 if not possible */
+{	ULONG off;
+	if (hd->type!=s_funcref) return 1;
+	if (hd->flags & FLAG_BINFUNC) {
+		if (mode==WS_LOAD) {
+			off=(ULONG)binfuncof(hd);
+			if (off>=(ULONG)BINFUNCS) return 0;
+			binfuncof(hd)=(binfunc_t *)&binfunc_list[off];
+		} else if (mode==WS_SAVE) {
+			binfuncof(hd)=(binfunc_t *)(ULONG)(binfuncof(hd)-(binfunc_t *)binfunc_list);
+		}
+	} else {
+		if (mode==WS_LOAD) {
+			off=(ULONG)referenceof(hd);
+			if (off>=(ULONG)(cc->udfend-cc->udfstart)) return 0;
+			referenceof(hd)=(header *)(cc->udfstart+off);
+			if (referenceof(hd)->type!=s_udf) return 0;
+		} else if ((char *)referenceof(hd)<cc->udfstart || (char *)referenceof(hd)>=cc->udfend) {
+			return 0;
+		} else if (mode==WS_SAVE) {
+			referenceof(hd)=(header *)(ULONG)((char *)referenceof(hd)-cc->udfstart);
+		}
+	}
+	return 1;
+}
+
+static int ws_reloc (Calc *cc, char *start, char *end, int mode)
+/* relocate the funcrefs found in [start,end), udf default values
+   included. returns 0 if an object can't be saved */
+{	header *hd;
+	char *p;
+	int k,nargs;
+	unsigned int defmap;
+	for (hd=(header *)start; (char *)hd<end; hd=nextof(hd)) {
+		if (hd->size<(int)sizeof(header) || (char *)nextof(hd)>end) return 0;
+		switch (hd->type) {
+		case s_reference:
+		case s_submatrixref:
+		case s_csubmatrixref:
+		case s_command:
+		case s_range:
+			return 0;
+		case s_funcref:
+			if (!ws_reloc1(cc,hd,mode)) return 0;
+			break;
+		case s_udf:
+			p=udfargsof(hd); nargs=*(int *)p; p+=sizeof(int);
+			defmap=*(unsigned int *)p; p+=sizeof(unsigned int);
+			for (k=0; k<nargs; k++) {
+				if ((defmap & (1<<k)) && !ws_reloc1(cc,(header *)p,mode)) return 0;
+				p=udfnextarg(p, defmap & (1<<k));
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+
+header* mstore (Calc *cc, header *hd)
+/***** mstore
+	store("file") saves the global variables and the user defined
+	functions to file. returns the size of the image.
+*****/
+{	ws_image_t im;
+	FILE *f;
+	int ok;
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_string) cc_error(cc,"store(\"file\")");
+	if (CC_ISSET(cc,CC_EXEC_UDF)) cc_error(cc,"Cannot store the workspace in a function!");
+	if (!ws_reloc(cc,cc->globalstart,cc->globalend,WS_CHECK)
+		|| !ws_reloc(cc,cc->udfstart,cc->udfend,WS_CHECK))
+		cc_error(cc,"The workspace holds objects that can't be stored!");
+	memcpy(im.magic,"CCWS",4);
+	im.sign=ws_sign();
+	im.varsize=cc->globalend-cc->globalstart;
+	im.udfsize=cc->udfend-cc->udfstart;
+	f=fopen(stringof(hd),"w");
+	if (!f) cc_error(cc,"Could not open %s!",stringof(hd));
+	ws_reloc(cc,cc->globalstart,cc->globalend,WS_SAVE);
+	ws_reloc(cc,cc->udfstart,cc->udfend,WS_SAVE);
+	ok=fwrite(&im,sizeof(im),1,f)==1
+		&& fwrite(cc->globalstart,1,im.varsize,f)==im.varsize
+		&& fwrite(cc->udfstart,1,im.udfsize,f)==im.udfsize;
+	ws_reloc(cc,cc->globalstart,cc->globalend,WS_LOAD);
+	ws_reloc(cc,cc->udfstart,cc->udfend,WS_LOAD);
+	if (fclose(f) || !ok) {
+		remove(stringof(hd));
+		cc_error(cc,"Error writing %s!",stringof(hd));
+	}
+	return pushresults(cc,new_real(cc,(real)(sizeof(im)+im.varsize+im.udfsize),""));
+}
+
+header* mrestore (Calc *cc, header *hd)
+/***** mrestore
+	restore("file") replaces the global variables and the user
+	defined functions with the ones saved by store. It is only
+	allowed as a statement of the global context. returns the size
+	of the image.
+*****/
+{	header *st=hd;
+	ws_image_t im;
+	char name[LINEMAX];
+	unwind_t *uw;
+	FILE *f;
+	long len;
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_string) cc_error(cc,"restore(\"file\")");
+	/* the whole memory is replaced: nothing may refer to it when we return */
+	for (uw=cc->unwind; uw && uw->kind==UW_CATCH; uw=uw->prev) ;
+	if (CC_ISSET(cc,CC_EXEC_UDF) || uw || (char *)st!=cc->endlocal || cc->endlocal!=cc->globalend)
+		cc_error(cc,"restore is only allowed as a global statement!");
+	strncpy(name,stringof(hd),LINEMAX-1); name[LINEMAX-1]=0;
+	f=fopen(name,"r");
+	if (!f) cc_error(cc,"Could not open %s!",name);
+	if (fread(&im,sizeof(im),1,f)!=1 || memcmp(im.magic,"CCWS",4)) {
+		fclose(f); cc_error(cc,"%s is not a workspace image!",name);
+	}
+	if (im.sign!=ws_sign()) {
+		fclose(f); cc_error(cc,"%s was stored by another version!",name);
+	}
+	fseek(f,0,SEEK_END); len=ftell(f); fseek(f,sizeof(im),SEEK_SET);
+	if (len!=(long)(sizeof(im)+im.varsize+im.udfsize)) {
+		fclose(f); cc_error(cc,"%s is truncated!",name);
+	}
+	if ((ULONG)im.varsize+im.udfsize+sizeof(header)+256>(ULONG)(cc->ramend-cc->ramstart)) {
+		fclose(f); cc_error(cc,"Memory overflow!");
+	}
+	/* from now on, the current workspace is lost */
+	cc->globalstart=cc->startlocal=cc->ramstart;
+	cc->globalend=cc->endlocal=cc->newram=cc->ramstart+im.varsize;
+	cc->udfend=cc->ramend;
+	cc->udfstart=cc->ramend-im.udfsize;
+	if (fread(cc->globalstart,1,im.varsize,f)!=im.varsize
+		|| fread(cc->udfstart,1,im.udfsize,f)!=im.udfsize
+		|| !ws_reloc(cc,cc->udfstart,cc->udfend,WS_LOAD)
+		|| !ws_reloc(cc,cc->globalstart,cc->globalend,WS_LOAD)) {
+		fclose(f);
+		cc->globalend=cc->endlocal=cc->newram=cc->ramstart;
+		cc->udfstart=cc->ramend;
+		cc_error(cc,"Error reading %s, workspace cleared!",name);
+	}
+	fclose(f);
+	cc->stack=(header *)cc->newram;
+	return pushresults(cc,new_real(cc,(real)len,""));
+}
+
 /*********************** programming language structure **********************/
 char *type_udfline (Calc *cc, char *start)
 {	char outline[LINEMAX],*p=start,*q;
@@ -1590,6 +2259,27 @@ char *type_udfline (Calc *cc, char *start)
 			p+=sizeof(real);
 			sprintf(q,"%g",x);
 			q+=strlen(q);
+		} else if (*p==5) {
+			/* a folded constant */
+			memmove((char *)(&x),p+3,sizeof(real));
+			p+=(unsigned char)p[1];
+			sprintf(q,"%g",x);
+			q+=strlen(q);
+		} else if (*p==4) {
+			/* a folded matrix */
+			uint32_t off;
+			dims d;
+			int i;
+			memmove(&off,p+3,sizeof(uint32_t));
+			memmove(&d,p+off+sizeof(header),sizeof(dims));
+			*q++='[';
+			for (i=0; i<d.r*d.c && q<outline+LINEMAX-32; i++) {
+				memmove((char *)(&x),p+off+sizeof(header)+sizeof(dims)+i*sizeof(real),sizeof(real));
+				sprintf(q,"%s%g",i==0 ? "" : (i%d.c ? "," : ";"),x);
+				q+=strlen(q);
+			}
+			*q++=']';
+			p+=(unsigned char)p[1];
 		} else if (*p==3) {
 			/* a command/statement */
 			p++; cmd_idx=*p++;
@@ -1707,6 +2397,272 @@ static cmdtyp do_trace(Calc *cc)
 	return c_cmd;
 }
 
+/*********************** statement level profiler ***********************/
+#define PROF_UDF_MAX	32		/* max number of profiled UDFs */
+#define PROF_LINE_MAX	256		/* max number of profiled UDF lines */
+#define PROF_DEPTH		(UDF_LEVEL_MAX+1)
+
+typedef struct {
+	char				name[LABEL_LEN_MAX+1];
+	unsigned long		calls;		/* number of calls */
+	unsigned long long	incl;		/* cycles spent in the UDF and its callees */
+	unsigned long long	excl;		/* cycles spent in the UDF only */
+	unsigned long		bytes;		/* calc stack bytes allocated */
+} prof_udf_t;
+
+typedef struct {
+	int					udf;		/* index in prof_udf */
+	int					offset;		/* line offset in the UDF body */
+	int					lineno;		/* line number in the UDF body */
+	unsigned long		count;		/* number of executions */
+	unsigned long long	incl;
+	unsigned long long	excl;
+	unsigned long		bytes;
+} prof_line_t;
+
+typedef struct {
+	header *			udf;		/* running UDF */
+	int					idx;		/* its prof_udf index */
+	int					line;		/* prof_line index of the current line */
+	int					outer;		/* outermost activation of the UDF */
+	unsigned long long	t_enter;	/* cycle count at UDF entry */
+	unsigned long long	t_line;		/* cycle count at line start */
+	unsigned long long	child;		/* cycles spent in callees for the call */
+	unsigned long long	lchild;		/* cycles spent in callees for the line */
+} prof_frame_t;
+
+static prof_udf_t	prof_udf[PROF_UDF_MAX];
+static prof_line_t	prof_lines[PROF_LINE_MAX];
+static prof_frame_t	prof_stack[PROF_DEPTH];
+static int prof_nudf=0, prof_nlines=0, prof_depth=0;
+static unsigned long prof_lost=0;		/* lines or UDFs not recorded (tables full) */
+
+static int udf_lineno (char *p, char *end)
+/* number of the line at 'end' in the compiled UDF body starting at 'p' */
+{	int n=1;
+	while (p<end) {
+		if (*p==2) {
+			p+=1+sizeof(real);
+		} else if (*p==4 || *p==5) {
+			p+=(unsigned char)p[1];
+		} else if (*p==3) {
+			int cmd_idx=*(p+1);
+			p+=2;
+			switch (cmd_list[cmd_idx].type) {
+			case c_do:
+			case c_repeat:
+			case c_if:
+			case c_elseif:
+			case c_else:
+				p+=sizeof(unsigned short);
+				break;
+			default:
+				break;
+			}
+		} else if (*p==0) {
+			while (p<end && *p==0) p++;
+			n++;
+		} else p++;
+	}
+	return n;
+}
+
+static int prof_find_udf (header *udf)
+{	int i;
+	for (i=0; i<prof_nudf; i++) {
+		if (!strcmp(prof_udf[i].name,udf->name)) return i;
+	}
+	if (prof_nudf==PROF_UDF_MAX) { prof_lost++; return -1; }
+	memset(&prof_udf[i],0,sizeof(prof_udf_t));
+	strcpy(prof_udf[i].name,udf->name);
+	prof_nudf++;
+	return i;
+}
+
+static int prof_find_line (prof_frame_t *f, char *line)
+{	int i, offset=(int)(line-udfof(f->udf));
+	if (f->idx<0) return -1;
+	for (i=0; i<prof_nlines; i++) {
+		if (prof_lines[i].udf==f->idx && prof_lines[i].offset==offset) return i;
+	}
+	if (prof_nlines==PROF_LINE_MAX) { prof_lost++; return -1; }
+	memset(&prof_lines[i],0,sizeof(prof_line_t));
+	prof_lines[i].udf=f->idx;
+	prof_lines[i].offset=offset;
+	prof_lines[i].lineno=udf_lineno(udfof(f->udf),line);
+	prof_nlines++;
+	return i;
+}
+
+static void prof_close_line (prof_frame_t *f, unsigned long long now)
+{	unsigned long long dt=now-f->t_line;
+	if (f->line>=0) {
+		prof_line_t *l=prof_lines+f->line;
+		l->count++;
+		l->incl+=dt;
+		l->excl+=dt-f->lchild;
+	}
+	f->lchild=0;
+}
+
+int prof_enter (Calc *cc, header *udf)
+/***** prof_enter
+	called by interpret_udf when a profiled UDF starts. returns 1 if
+	a frame was pushed, that prof_leave has to pop.
+*****/
+{	prof_frame_t *f;
+	int i;
+	if (prof_depth>=PROF_DEPTH) return 0;
+	f=prof_stack+prof_depth++;
+	f->udf=udf;
+	f->idx=prof_find_udf(udf);
+	if (f->idx>=0) prof_udf[f->idx].calls++;
+	/* a recursive call is already in the inclusive time of the outer one */
+	f->outer=1;
+	for (i=0; i<prof_depth-1; i++)
+		if (prof_stack[i].idx==f->idx) f->outer=0;
+	f->child=f->lchild=0;
+	f->line=prof_find_line(f,udfof(udf));
+	f->t_enter=f->t_line=sys_cycles();
+	return 1;
+}
+
+void prof_leave (Calc *cc)
+/***** prof_leave
+	called by interpret_udf when a profiled UDF returns or fails.
+*****/
+{	prof_frame_t *f;
+	unsigned long long now=sys_cycles(), dt;
+	if (!prof_depth) return;
+	f=prof_stack+(--prof_depth);
+	prof_close_line(f,now);
+	dt=now-f->t_enter;
+	if (f->idx>=0) {
+		if (f->outer) prof_udf[f->idx].incl+=dt;
+		prof_udf[f->idx].excl+=dt-f->child;
+	}
+	if (prof_depth) {
+		prof_stack[prof_depth-1].child+=dt;
+		prof_stack[prof_depth-1].lchild+=dt;
+	}
+}
+
+void prof_line (Calc *cc)
+/***** prof_line
+	called by next_line when a new line of a UDF is started.
+*****/
+{	prof_frame_t *f;
+	unsigned long long now=sys_cycles();
+	if (!prof_depth || prof_stack[prof_depth-1].udf!=cc->running) return;
+	f=prof_stack+prof_depth-1;
+	prof_close_line(f,now);
+	f->line=prof_find_line(f,cc->line);
+	f->t_line=sys_cycles();
+}
+
+void prof_alloc (Calc *cc, int size)
+/***** prof_alloc
+	account size bytes allocated on the calc stack to the running line.
+*****/
+{	prof_frame_t *f;
+	if (!prof_depth) return;
+	f=prof_stack+prof_depth-1;
+	if (f->idx>=0) prof_udf[f->idx].bytes+=size;
+	if (f->line>=0) prof_lines[f->line].bytes+=size;
+}
+
+static void prof_report (Calc *cc)
+{	int i,k,order[PROF_UDF_MAX];
+	short lorder[PROF_LINE_MAX];
+	header *hd;
+	real us=1.0e6/(real)sys_cycles_freq();
+	/* sort indexes only: records are referred to by index from the running
+	   frames and the line records. UDFs by decreasing inclusive time */
+	for (i=0; i<prof_nudf; i++) {
+		for (k=i; k>0 && prof_udf[order[k-1]].incl<prof_udf[i].incl; k--)
+			order[k]=order[k-1];
+		order[k]=i;
+	}
+	/* lines by decreasing exclusive time */
+	for (i=0; i<prof_nlines; i++) {
+		for (k=i; k>0 && prof_lines[lorder[k-1]].excl<prof_lines[i].excl; k--)
+			lorder[k]=lorder[k-1];
+		lorder[k]=i;
+	}
+	sys_out_mode(CC_OUTPUT);
+	outputf(cc,"%-" STR(LABEL_LEN_MAX) "s %10s %14s %14s %10s\n",
+		"function","calls","incl [us]","excl [us]","bytes");
+	for (i=0; i<prof_nudf; i++) {
+		prof_udf_t *u=prof_udf+order[i];
+		outputf(cc,"%-" STR(LABEL_LEN_MAX) "s %10lu %14.1f %14.1f %10lu\n",
+			u->name,u->calls,(double)(u->incl*us),(double)(u->excl*us),u->bytes);
+	}
+	outputf(cc,"\n%-" STR(LABEL_LEN_MAX) "s %5s %10s %14s %14s %10s\n",
+		"function","line","count","incl [us]","excl [us]","bytes");
+	for (i=0; i<prof_nlines; i++) {
+		prof_line_t *l=prof_lines+lorder[i];
+		outputf(cc,"%-" STR(LABEL_LEN_MAX) "s %5d %10lu %14.1f %14.1f %10lu  ",
+			prof_udf[l->udf].name,l->lineno,l->count,
+			(double)(l->incl*us),(double)(l->excl*us),l->bytes);
+		hd=searchudf(cc,prof_udf[l->udf].name);
+		if (hd && hd->type==s_udf && udfof(hd)+l->offset<(char*)nextof(hd))
+			type_udfline(cc,udfof(hd)+l->offset);
+		else output(cc,"\n");
+		if (sys_test_key()==escape) break;
+	}
+	if (prof_lost) outputf(cc,"\n%lu records lost (profiler tables full)\n",prof_lost);
+}
+
+static cmdtyp do_profile (Calc *cc)
+/**** do_profile
+	profile on|off|report ["file"]
+	statement level profiler for UDFs: per UDF and per line execution
+	counts, inclusive/exclusive time and calc stack bytes allocated.
+	'on' clears the previous records, it is refused while profiled UDFs
+	are running.
+****/
+{	char c;
+	while ((c=*cc->next)=='\t' || c==' ') cc->next++;
+	if (!strncmp(cc->next,"off",3)) {
+		cc->next+=3;
+		cc->profile=0;
+	} else if (!strncmp(cc->next,"on",2)) {
+		cc->next+=2;
+		if (prof_depth) cc_error(cc,"profile on is not allowed in a profiled function");
+		prof_nudf=prof_nlines=prof_depth=0;
+		prof_lost=0;
+		sys_cycles_init();
+		cc->profile=1;
+	} else if (!strncmp(cc->next,"report",6)) {
+		FILE *oldoutfile=cc->outfile;
+		unsigned int oldflags=cc->flags;
+		cc->next+=6;
+		while ((c=*cc->next)=='\t' || c==' ') cc->next++;
+		if (*cc->next=='"') {
+			scan_path(cc);
+			if (!(cc->result && strlen(stringof(cc->result))!=0))
+				cc_error(cc,"profile report \"filename\"");
+			cc->outfile=fopen(stringof(cc->result),"w");
+			if (!cc->outfile) {
+				cc->outfile=oldoutfile;
+				cc_error(cc,"Could not open %s.",stringof(cc->result));
+			}
+			CC_UNSET(cc,CC_OUTPUTING);
+			prof_report(cc);
+			fclose(cc->outfile);
+			cc->outfile=oldoutfile;
+			cc->flags=oldflags;
+		} else {
+			prof_report(cc);
+		}
+	} else {
+		cc_error(cc,"profile on|off|report [\"filename\"]");
+	}
+	while ((c=*cc->next)=='\t' || c==' ') cc->next++;
+	if (*cc->next==';' || *cc->next==',') cc->next++;
+	return c_cmd;
+}
+
 static cmdtyp do_show (Calc *cc)
 {
 	header *hd;
@@ -1745,8 +2701,10 @@ static cmdtyp do_show (Calc *cc)
 			p=udfnextarg(p, defaults & 1<<i);
 		}
 		p=udfof(hd);
+		count=udf_folded(p,(char *)nextof(hd));
 		while (p && p<(char *)nextof(hd))
 			p=type_udfline(cc,p);
+		if (count) outputf(cc,"## %d constant operations folded\n",count);
 	} else {
 		cc_error(cc,"No such UDF function!");
 	}
@@ -1909,7 +2867,7 @@ static int compile(Calc *cc, char *dest, int root_cmd_idx)
 					jmp_instr_idx--;
 					if (jmp_instr_idx==-1) {
 						*p++=0;
-						return ALIGN(p-dest);
+						return ALIGN(fold_body(cc,dest,p,NULL,NULL)-dest);
 					}
 					break;
 				case c_until:
@@ -1936,7 +2894,7 @@ static int compile(Calc *cc, char *dest, int root_cmd_idx)
 					scan_until_end=0;
 					if (jmp_instr_idx==-1) {
 						*(p-1)=0;
-						return ALIGN(p-dest);
+						return ALIGN(fold_body(cc,dest,p,NULL,NULL)-dest);
 					}
 				}
 				if (c==0) break;
@@ -1945,7 +2903,7 @@ static int compile(Calc *cc, char *dest, int root_cmd_idx)
 		next_line(cc); firstchar=cc->next;
 		if (p>=cc->udfstart-80) cc_error(cc,"Memory overflow!");
 	}
-	return ALIGN(p-dest);
+	return ALIGN(fold_body(cc,dest,p,NULL,NULL)-dest);
 }
 
 static cmdtyp do_parse_udf (Calc *cc)
@@ -2234,6 +3192,7 @@ static cmdtyp do_parse_udf (Calc *cc)
 			if (p>=cc->udfstart-80) cc_error(cc,"Memory overflow!");
 		}
 postlude:
+		p=fold_body(cc,startp,p,result,var->name);
 		CC_UNSET(cc,CC_PARSE_UDF);
 		result->size=ALIGN(p-(char *)result);
 		cc->newram=(char *)result+result->size;
@@ -2452,7 +3411,7 @@ static cmdtyp do_for (Calc *cc)
 *****/
 {
 	token_t tok;
-	jmp_buf *oldenv, env;
+	unwind_t uw;
 	unsigned short jump_val;
 	cmdtyp cmd=c_none;
 	char name[LABEL_LEN_MAX+1],*jump;
@@ -2508,6 +3467,10 @@ static cmdtyp do_for (Calc *cc)
 		cc->next+=sizeof(unsigned short);
 		// get the start of loop address
 		jump=cc->next;
+		
+		/* the loop is unwound on error */
+		uw.name=name; uw.var=&rv.hd;
+		UNWIND_PUSH(cc,&uw,UW_FOR);
 	
 		signum=(vstep>0);
 		if ((signum && rv.value>vend) || (!signum && rv.value<vend)) {
@@ -2521,18 +3484,6 @@ static cmdtyp do_for (Calc *cc)
 		new_reference(cc,&rv.hd,name);
 		cc->endlocal=cc->newram;
 		
-		oldenv=cc->env;
-		cc->env=&env;
-		switch (setjmp(env)) {
-		case 0:
-			break;
-		default:
-			kill_local(cc,name);
-			cc->env=oldenv;
-			outputf(cc,"error in for..to loop at index %s=%g\n",name,rv.value);
-			longjmp(*cc->env,2);	/* back to enclosing error handler */
-		}
-		
 		vend=vend+cc->epsilon*vstep;
 		while (1) {
 			cmd=parse(cc);
@@ -2550,28 +3501,28 @@ static cmdtyp do_for (Calc *cc)
 			}
 		}
 end:
-		kill_local(cc,name);
-		cc->env=oldenv;
+		cc_leave(cc,&uw);
 		return (cmd==c_return)? cmd : c_for;
 	} else if (tok==T_IN) {
 		header *hd1, *hd2;
 		int r, c, isreal=1, i=0;
-		real *m;
-		/* parse vector */
+		real *m=NULL;
+		range_t *rg=NULL;
+		/* parse vector, a:b:c is kept as a range and walked in place */
+		CC_SET(cc,CC_PARSE_RANGE);
 		tok=parse_expr(cc);
 		if (tok!=T_DO) goto err1;
 		if (!cc->result) goto err1;
 		hd1=cc->result;
-		hd2=getvalue(cc,cc->result);
-		if (hd2->type==s_real || hd2->type==s_matrix) isreal=1;
+		hd2=(hd1->type==s_range) ? hd1 : getvalue(cc,cc->result);
+		if (hd2->type==s_real || hd2->type==s_matrix || hd2->type==s_range) isreal=1;
 		else if (hd2->type!=s_complex || hd2->type==s_cmatrix) isreal=0;
 		else goto err1;
 		// protect the vector by making a copy placed under the code
-		if ((cc->udfstart-hd2->size)>cc->newram) {
-			// enough space to copy the vector
-			cc->udfstart-=hd2->size;
-			memmove(cc->udfstart,hd2,hd2->size);
-		}
+		if ((cc->udfstart-hd2->size)<=cc->newram) cc_error(cc,"Memory overflow!");
+		uw.udfstart=cc->udfstart;
+		cc->udfstart-=hd2->size;
+		memmove(cc->udfstart,hd2,hd2->size);
 		if (hd2->name[0]==0 && cc->newram==(char*)nextof(hd2)) {
 			// the vector was just generated as a temporary value for the for loop, get rid of it
 			cc->newram=(char*)hd2;
@@ -2589,7 +3540,13 @@ end:
 		// get the start of loop address
 		jump=cc->next;
 		
-		getmatrix(hd2,&r,&c,&m);
+		/* the loop is unwound on error */
+		uw.name=name; uw.var=isreal ? &rv.hd : &cv.hd;
+		UNWIND_PUSH(cc,&uw,UW_FORIN);
+		
+		if (hd2->type==s_range) {
+			rg=rangeof(hd2); r=1; c=rg->n;
+		} else getmatrix(hd2,&r,&c,&m);
 
 		if (r*c==0) {
 			cc->next=jump+jump_val; goto end1;
@@ -2598,7 +3555,10 @@ end:
 		/* create the loop variable */
 		kill_local(cc,name);
 		
-		if (isreal) {
+		if (rg) {
+			rv.value=rg->start;
+			new_reference(cc,&rv.hd,name);
+		} else if (isreal) {
 			rv.value=*m++;
 			new_reference(cc,&rv.hd,name);
 		} else {
@@ -2607,26 +3567,6 @@ end:
 		}
 		cc->endlocal=cc->newram;
 		
-		oldenv=cc->env;
-		cc->env=&env;
-		switch (setjmp(env)) {
-		case 0:
-			break;
-		default:
-			kill_local(cc,name);
-			cc->udfstart+=hd2->size;
-			cc->env=oldenv;
-			if (isreal) {
-				outputf(cc,"error in for..in at loop var %s=\n",name);
-				real_out(cc,rv.value);
-			} else {
-				outputf(cc,"error in for..in at loop var %s=\n",name);
-				complex_out(cc,cv.value[0],cv.value[1]);
-			}
-			output(cc,"\n");
-			longjmp(*cc->env,2);	/* back to enclosing error handler */
-		}
-		
 		while (1) {
 			cmd=parse(cc);
 			if (cmd==c_return) break;
@@ -2635,21 +3575,21 @@ end:
 				break;
 			}
 			if (cmd==c_end) {
-				if (isreal) {
+				i++;
+				if (i>=r*c) break;
+				if (rg) {
+					rv.value=rg->start+(real)i*rg->step;
+				} else if (isreal) {
 					rv.value=*m++;
 				} else {
 					cv.value[0]=*m++; cv.value[1]=*m++;
 				}
-				i++;
-				if (i<r*c) cc->next=jump;
-				else break;
+				cc->next=jump;
 				if (sys_test_key()==escape) cc_error(cc,"for interrupted!");
 			}
 		}
 end1:
-		kill_local(cc,name);
-		cc->udfstart+=hd2->size;
-		cc->env=oldenv;
+		cc_leave(cc,&uw);
 		return (cmd==c_return)? cmd : c_for;
 	} else cc_error(cc,"for: bad syntax");
 	
@@ -3101,14 +4041,18 @@ concatmode:
 
 header* get_mat_elt (Calc *cc, header *var)
 /* get an element of a matrix in the form: var[i,j] */
-{	header *st=(header*)cc->newram,*result,*hd,*hd1;
+{	header *st,*result,*hd,*hd1;
 	token_t tok;
 
 	while (var->type==s_reference) var=referenceof(var);
-	CC_SET(cc,CC_PARSE_INDEX);
+	/* (a:b)[i]: the range operand is the last value on the stack */
+	if (var->type==s_range) range_expand(cc,var);
+	st=(header*)cc->newram;
+	CC_SET(cc,CC_PARSE_INDEX|CC_PARSE_RANGE);
 	tok=parse_expr(cc);
 	hd=cc->result;
 	if (tok==T_COMMA) {	/* two indexes: var[r,c] */
+		CC_SET(cc,CC_PARSE_RANGE);
 		tok=parse_expr(cc);
 		hd1=cc->result;
 	} else {			/* only one index: var[r] or var[c] for row vectors */
@@ -3123,9 +4067,10 @@ header* get_mat_elt (Calc *cc, header *var)
 		cc_error(cc,"Closing ']' missing");
 	}
 	
-	/* else, get an element of a variable */
-	hd=getvalue(cc,hd);
-	hd1=getvalue(cc,hd1);
+	/* else, get an element of a variable, range indexes are walked
+	   by the submatrix builders */
+	if (hd->type!=s_range) hd=getvalue(cc,hd);
+	if (hd1->type!=s_range) hd1=getvalue(cc,hd1);
 	if (var->type==s_matrix || var->type==s_real) {
 		result=new_submatrix(cc,var,hd,hd1,"");
 	} else if (var->type==s_cmatrix || var->type==s_complex) {
@@ -3140,12 +4085,14 @@ header* get_mat_elt (Calc *cc, header *var)
 
 header* get_mat_elt1 (Calc *cc, header *var)
 /* get an element of a matrix in the form: var{i} */
-{	header *st=(header*)cc->newram,*result;
+{	header *st,*result;
 	token_t tok;
 	int n,l;
 	int r,c;
 	real *m;
 	while (var->type==s_reference) var=referenceof(var);
+	if (var->type==s_range) range_expand(cc,var);
+	st=(header*)cc->newram;
 	tok=parse_expr(cc);
 	cc->result=getvalue(cc,cc->result);
 	if (!(cc->result && cc->result->type==s_real)) cc_error(cc,"Index must be a number!");
@@ -3380,6 +4327,9 @@ token_t parse_expr(Calc *cc)
 	int      o_top=0;				/* top of the operand stack */
 	header*  data[DATA_STACK_MAX];	/* data stack */
 	token_t  op[OP_STACK_MAX]={0};	/* operand stack */
+	/* the caller accepts a range result, nested expressions don't */
+	unsigned int keeprange=CC_ISSET(cc,CC_PARSE_RANGE);
+	CC_UNSET(cc,CC_PARSE_RANGE);
 
 	while (1) {
 		/* get an operand */
@@ -3402,6 +4352,20 @@ token_t parse_expr(Calc *cc)
 			}
 			usign=0;
 			break;
+		case T_CONST:
+			if (d_top<DATA_STACK_MAX-1) {
+				/* copy the folded object out of the code, it may be unaligned */
+				header h;
+				char *m;
+				memcpy(&h,cc->cst,sizeof(header));
+				m=(char *)stack_alloc(cc,h.type,h.size-sizeof(header),"");
+				memcpy(m,cc->cst+sizeof(header),h.size-sizeof(header));
+				data[++d_top]=(header *)m-1;
+			} else {
+				cc_error(cc, "Reg file overflow"); goto err;
+			}
+			usign=0;
+			break;
 		case T_LBRACKET:
 			tok=parse_matrix(cc);
 			if (d_top<DATA_STACK_MAX-1) {
@@ -3631,6 +4595,8 @@ expect_operator:
 		} else {
 			/* finished, return the result */
 			cc->result = data[0];
+			if (cc->result->type==s_range && !keeprange)
+				range_expand(cc,cc->result);
 			break;
 		}
 	}
@@ -3639,16 +4605,544 @@ err:
 	return tok;
 }
 
+/***************************************************************************
+ *	light user function compiler
+ *	  translate the string of a light user function to a postfix program,
+ *	  with the operator precedences of parse_expr. Only real arithmetic
+ *	  (+ - * / ^ and unary -), numbers, parameters, global variables and
+ *	  the functions known by luf_func_find are handled: anything else
+ *	  returns 0 and the function is left to the interpreter.
+ ***************************************************************************/
+static int luf_emit (LufProg *p, int op, int arg, int *depth, int *dmax)
+{
+	if (p->n>=LUF_CODE_MAX) return 0;
+	switch (op) {
+	case LOP_CST: case LOP_ARG: case LOP_VAR:
+		(*depth)++;
+		break;
+	case LOP_FN: case LOP_NEG:
+		break;
+	default:
+		(*depth)--;
+		break;
+	}
+	if (*depth>*dmax) *dmax=*depth;
+	p->code[p->n].op=(unsigned char)op;
+	p->code[p->n].arg=(unsigned char)arg;
+	p->n++;
+	return 1;
+}
+
+static int luf_op (token_t tok)
+{
+	switch (tok) {
+	case T_ADD: return LOP_ADD;
+	case T_SUB: return LOP_SUB;
+	case T_MUL: return LOP_MUL;
+	case T_DIV: return LOP_DIV;
+	case T_POW: return LOP_POW;
+	default:    return LOP_NEG;
+	}
+}
+
+int luf_compile (Calc *cc, char *s, int argn, LufProg *p)
+{	unwind_t uw;
+	jmp_buf env;
+	char *oldnext=cc->next, *oldline=cc->line;
+	char args[MAXARGS][LABEL_LEN_MAX+1];
+	token_t tok, op[OP_STACK_MAX];
+	int fn[OP_STACK_MAX];
+	int o_top=0, usign=0, depth=0, dmax=0, i, ok=0;
+	FILE *oldoutfile=cc->outfile;
+	unsigned int oldflags=cc->flags;
+	
+	p->n=0; p->nargs=argn; p->ncst=0; p->nvars=0;
+	if (argn>MAXARGS) return 0;
+	uw.env=cc->env;
+	UNWIND_PUSH(cc,&uw,UW_CATCH);
+	cc->env=&env;
+	cc->line=cc->next=s;
+	/* scanner errors: silently, the interpreter reports them when it
+	   parses the function */
+	cc->outfile=NULL;
+	CC_UNSET(cc,CC_OUTPUTING);
+	if (setjmp(env)) goto end;
+	
+	/* formal parameters, named as in interpret_luf */
+	if (strncmp(s,"@(",2)==0) {
+		cc->next+=2;
+		for (i=0; ; i++) {
+			if (i>=argn || scan(cc)!=T_LABEL) goto end;
+			strcpy(args[i],cc->str);
+			tok=scan(cc);
+			if (tok==T_RPAR) break;
+			if (tok!=T_COMMA) goto end;
+		}
+		if (i+1!=argn) goto end;
+	} else {
+		char c='x';
+		for (i=0; i<argn; i++) {
+			args[i][0]=c; args[i][1]=0;
+			c = (c=='z') ? 'a' : c+1;
+		}
+	}
+	
+	op[0]=T_NONE; fn[0]=-1;
+	while (1) {
+		/* get an operand */
+		tok=scan(cc);
+		switch (tok) {
+		case T_REAL:
+			for (i=0; i<p->ncst && p->cst[i]!=cc->val; i++) ;
+			if (i==LUF_CST_MAX) goto end;
+			if (i==p->ncst) p->cst[p->ncst++]=cc->val;
+			if (!luf_emit(p,LOP_CST,i,&depth,&dmax)) goto end;
+			break;
+		case T_LABEL:
+			for (i=0; i<argn && strcmp(args[i],cc->str)!=0; i++) ;
+			if (i<argn) {
+				if (!luf_emit(p,LOP_ARG,i,&depth,&dmax)) goto end;
+				break;
+			}
+			for (i=0; i<p->nvars && strcmp(p->var[i],cc->str)!=0; i++) ;
+			if (i==LUF_VAR_MAX) goto end;
+			if (i==p->nvars) strcpy(p->var[p->nvars++],cc->str);
+			if (!luf_emit(p,LOP_VAR,i,&depth,&dmax)) goto end;
+			break;
+		case T_FUNCREF:
+			if (o_top>=OP_STACK_MAX-1 || (i=luf_func_find(cc->str))<0 || searchudf(cc,cc->str)) goto end;
+			op[++o_top]=T_LPAR; fn[o_top]=i;
+			usign=0;
+			continue;
+		case T_SUB:
+			if (usign || o_top>=OP_STACK_MAX-1) goto end;
+			usign=1;
+			op[++o_top]=T_NEG; fn[o_top]=-1;
+			continue;
+		case T_ADD:
+			if (usign) goto end;
+			usign=1;
+			continue;
+		case T_LPAR:
+			if (o_top>=OP_STACK_MAX-1) goto end;
+			op[++o_top]=T_LPAR; fn[o_top]=-1;
+			usign=0;
+			continue;
+		default:
+			goto end;
+		}
+		usign=0;
+		
+		/* get an operator */
+expect_operator:
+		tok=scan(cc);
+		if (tok!=T_ADD && tok!=T_SUB && tok!=T_MUL && tok!=T_DIV &&
+			tok!=T_POW && tok!=T_RPAR && tok!=T_EOS) goto end;
+		while (PREC(tok)<=PREC(op[o_top])) {
+			if (op[o_top]==T_LPAR) {
+				if (tok!=T_RPAR) goto end;
+				if (fn[o_top]>=0 && !luf_emit(p,LOP_FN,fn[o_top],&depth,&dmax)) goto end;
+				o_top--;
+				goto expect_operator;
+			}
+			if (IS_RASS(tok) && op[o_top]==tok) break;
+			if (!luf_emit(p,luf_op(op[o_top]),0,&depth,&dmax)) goto end;
+			o_top--;
+		}
+		if (tok==T_RPAR) goto end;
+		if (tok==T_EOS) break;
+		if (o_top>=OP_STACK_MAX-1) goto end;
+		op[++o_top]=tok; fn[o_top]=-1;
+	}
+	ok = (o_top==0 && depth==1 && dmax<=LUF_STACK_MAX);
+end:
+	cc_leave(cc,&uw);
+	cc->outfile=oldoutfile;
+	cc->flags=oldflags;
+	cc->next=oldnext;
+	cc->line=oldline;
+	if (!ok) p->n=0;
+	return ok;
+}
+
+/***************************************************************************
+ *	constant folding
+ *	  after a udf body or a chunk is compiled, the constant subexpressions
+ *	  (numbers, + - * / ^, unary -, parentheses, the functions known by
+ *	  luf_func_find and matrix literals) are evaluated once with parse_expr
+ *	  and replaced in place, so that the jump offsets stay valid:
+ *	    0x05 len nodes real       a folded scalar
+ *	    0x04 len nodes offset     a folded real matrix, the object lies in
+ *	                              the constant area after the body, at
+ *	                              offset bytes from the token
+ *	  len is the size of the span replaced, the rest is padded with blanks.
+ *	  nodes is the number of operations folded, summed up by show.
+ *	  Function names are folded only if no udf, variable, parameter or
+ *	  local of the same name is known when the body is compiled. The
+ *	  builtin constants (pi) are folded where the code sees them, user
+ *	  consts are not: the body would keep the value they had when it
+ *	  was compiled.
+ *	  When an operand is not constant, the constant prefix before its
+ *	  operator is folded if that operator takes it whole (2*3+x, 2*3*x).
+ ***************************************************************************/
+#define FOLD_MATRIX_MAX		256		/* largest matrix literal folded */
+
+typedef struct {
+	char *		start;			/* code being folded */
+	char *		end;
+	header *	udf;			/* its function, NULL for a chunk */
+	char *		name;			/* name of the function */
+} fold_ctx;
+
+static int fold_is_arg (fold_ctx *fc, char *name)
+/* name is a parameter of the function */
+{	int k, nargs;
+	unsigned int defmap;
+	char *p;
+	if (!fc->udf) return 0;
+	p=udfargsof(fc->udf); nargs=*(int *)p; p+=sizeof(int);
+	defmap=*(unsigned int *)p; p+=sizeof(unsigned int);
+	for (k=0; k<nargs; k++) {
+		if (!strcmp(((udf_arg *)p)->name,name)) return 1;
+		p=udfnextarg(p, defmap & (1<<k));
+	}
+	return 0;
+}
+
+static int fold_name_free (Calc *cc, fold_ctx *fc, char *name)
+/* name is not a udf, a variable, a parameter or a local, so that
+   name(...) is the builtin */
+{	int n=strlen(name);
+	char *p, *q;
+	if (searchudf(cc,name) || (fc->name && !strcmp(fc->name,name))) return 0;
+	if (fold_is_arg(fc,name)) return 0;
+	/* any use other than a call may be a local variable */
+	for (p=fc->start; p+n<=fc->end; p++) {
+		if (strncmp(p,name,n) || (p>fc->start && (ISALPHA(p[-1]) || ISDIGIT(p[-1]) || p[-1]=='$'))
+			|| ISALPHA(p[n]) || ISDIGIT(p[n])) continue;
+		for (q=p+n; *q==' ' || *q=='\t'; q++) ;
+		if (*q!='(') return 0;
+	}
+	return 1;
+}
+
+static char *fold_builtin_cst[] = {"pi", NULL};
+
+static header* fold_const (Calc *cc, fold_ctx *fc, char *name)
+/* the builtin constant name, if the code sees it: a chunk runs in the
+   scope it is compiled in, a udf sees globals only after 'global *' or
+   a 'global' naming it. A const can neither be assigned nor cleared */
+{	header *hd;
+	char *p;
+	int n=strlen(name), cmd_idx, i;
+	for (i=0; fold_builtin_cst[i] && strcmp(fold_builtin_cst[i],name); i++) ;
+	if (!fold_builtin_cst[i]) return NULL;
+	for (hd=(header *)cc->globalstart; (char *)hd<cc->globalend; hd=nextof(hd))
+		if (!strcmp(hd->name,name)) break;
+	if ((char *)hd>=cc->globalend || !(hd->flags & FLAG_CONST) || hd->type!=s_real)
+		return NULL;
+	if (!fc->udf) return searchvar(cc,name)==hd ? hd : NULL;
+	if (fold_is_arg(fc,name)) return NULL;
+	for (p=fc->start; p<fc->end; ) {
+		if (*p==2) {
+			p+=1+sizeof(real);
+		} else if (*p==4 || *p==5) {
+			p+=(unsigned char)p[1];
+		} else if (*p==3) {
+			cmd_idx=p[1];
+			p+=2;
+			switch (cmd_list[cmd_idx].type) {
+			case c_do: case c_repeat: case c_if: case c_elseif: case c_else:
+				p+=sizeof(unsigned short);
+				continue;
+			default:
+				break;
+			}
+			if (cmd_list[cmd_idx].f!=do_global) continue;
+			/* global * or global a, b, ... */
+			while (1) {
+				while (*p==' ' || *p=='\t') p++;
+				if (*p=='*') return hd;
+				if (!strncmp(p,name,n) && !ISALPHA(p[n]) && !ISDIGIT(p[n])) return hd;
+				while (ISALPHA(*p) || ISDIGIT(*p) || *p=='$') p++;
+				while (*p==' ' || *p=='\t') p++;
+				if (*p!=',') break;
+				p++;
+			}
+		} else p++;
+	}
+	return NULL;
+}
+
+static int fold_expr (Calc *cc, fold_ctx *fc, int minprec, int *nodes, int *lowest);
+
+static int fold_operand (Calc *cc, fold_ctx *fc, int *nodes)
+/* scan a constant operand */
+{	token_t tok=scan(cc);
+	int low;
+	switch (tok) {
+	case T_REAL:
+		return 1;
+	case T_ADD:
+		return fold_operand(cc,fc,nodes);
+	case T_SUB:
+		/* parse_expr pushes a unary minus with the precedence of '+' */
+		if (fold_expr(cc,fc,PREC(T_NEG)+1,nodes,&low)!=1) return 0;
+		(*nodes)++;
+		return 1;
+	case T_FUNCREF:
+		if (luf_func_find(cc->str)<0) return 0;
+		if (!fold_name_free(cc,fc,cc->str)) return 0;
+		(*nodes)++;
+		/* fall through */
+	case T_LPAR:
+		return fold_expr(cc,fc,1,nodes,&low)==1 && scan(cc)==T_RPAR;
+	case T_LABEL:
+		/* a const alone is no operation, so that it is not folded
+		   by itself */
+		return fold_const(cc,fc,cc->str)!=NULL;
+	case T_LBRACKET:
+		(*nodes)++;
+		while (1) {
+			if (fold_expr(cc,fc,1,nodes,&low)!=1) return 0;
+			tok=scan(cc);
+			if (tok==T_RBRACKET) return 1;
+			if (tok!=T_COMMA && tok!=T_SEMICOL) return 0;
+		}
+	default:
+		return 0;
+	}
+}
+
+static int fold_expr (Calc *cc, fold_ctx *fc, int minprec, int *nodes, int *lowest)
+/* scan a constant expression made of the operators of precedence
+   minprec or more, with the rules of parse_expr. lowest gets the lowest
+   precedence of the operators found at this level. returns 0 if the
+   first operand is not constant, 1 if the expression ends there, 2 if
+   only a prefix is constant: cc->next is then left on the operator that
+   takes the rest */
+{	char *save;
+	token_t tok;
+	int low, n;
+	*lowest=16;
+	if (!fold_operand(cc,fc,nodes)) return 0;
+	while (1) {
+		save=cc->next;
+		tok=scan(cc);
+		cc->next=save;
+		if ((tok!=T_ADD && tok!=T_SUB && tok!=T_MUL && tok!=T_DIV && tok!=T_POW)
+			|| (int)PREC(tok)<minprec) {
+			/* an operator of this level that is not folded */
+			return (tok<=T_HASH && (IS_BIN(tok) || tok==T_COL || tok==T_TRANSPOSE)
+				&& (int)PREC(tok)>=minprec) ? 2 : 1;
+		}
+		scan(cc);
+		n=*nodes;
+		if (fold_expr(cc,fc,IS_RASS(tok) ? PREC(tok) : PREC(tok)+1,nodes,&low)!=1) {
+			/* the right operand is not constant: stop before tok */
+			cc->next=save;
+			*nodes=n;
+			return 2;
+		}
+		if ((int)PREC(tok)<*lowest) *lowest=PREC(tok);
+		(*nodes)++;
+	}
+}
+
+static header* fold_eval (Calc *cc, char *s, char *e, char *ram)
+/* evaluate the span [s,e[ with the stack at ram, silently. NULL if it
+   failed or was not a plain real value */
+{	unwind_t uw;
+	jmp_buf env;
+	char c=*e;
+	char *oldnewram=cc->newram;
+	FILE *oldoutfile=cc->outfile;
+	unsigned int oldflags=cc->flags;
+	header * volatile res=NULL;
+	uw.env=cc->env;
+	UNWIND_PUSH(cc,&uw,UW_CATCH);
+	cc->env=&env;
+	cc->outfile=NULL;
+	CC_UNSET(cc,CC_OUTPUTING|CC_NOSUBMREF|CC_PARSE_INDEX|CC_PARSE_PARAM_LIST);
+	*e=0;
+	cc->line=cc->next=s;
+	cc->newram=ram;
+	if (!setjmp(env)) {
+		if (parse_expr(cc)==T_EOS && cc->next==e && cc->result
+			&& (cc->result->type==s_real || cc->result->type==s_matrix))
+			res=cc->result;
+	}
+	*e=c;
+	cc_leave(cc,&uw);
+	cc->outfile=oldoutfile;
+	cc->flags=oldflags;
+	cc->newram=oldnewram;
+	return res;
+}
+
+static char* fold_body (Calc *cc, char *start, char *end, header *udf, char *name)
+/***** fold_body
+	fold the constant subexpressions of the compiled code [start,end[.
+	udf is the function the code belongs to and name its name, NULL for
+	a chunk. returns the new end of the code, after the constant area.
+*****/
+{	unwind_t uw;
+	jmp_buf env;
+	char *oldnext=cc->next, *oldline=cc->line;
+	fold_ctx fc={start,end,udf,name};
+	char * volatile q=start;
+	char * volatile cend=end;
+	volatile int operand=1, minprec=1, skip=0;
+	
+	uw.env=cc->env;
+	UNWIND_PUSH(cc,&uw,UW_CATCH);
+	cc->env=&env;
+	/* scanner errors only stop folding */
+	if (setjmp(env)) goto end;
+	while (q<end) {
+		char *s, *e;
+		header *res;
+		token_t tok;
+		int nodes=0, lowest, len;
+		switch (*q) {
+		case 0:
+			q++; operand=1; minprec=1; skip=0;
+			continue;
+		case 3:
+			switch (cmd_list[(int)q[1]].type) {
+			case c_do: case c_repeat: case c_if: case c_elseif: case c_else:
+				q+=2+sizeof(unsigned short); break;
+			case c_cmd: case c_global: case c_const:
+				/* arguments are not expressions */
+				skip=1; q+=2; break;
+			default:
+				q+=2; break;
+			}
+			operand=1; minprec=1;
+			continue;
+		case '"':
+			for (q++; *q && !(*q=='"' && q[-1]!='\\'); q++) ;
+			if (*q) q++;
+			operand=0;
+			continue;
+		case ' ':
+		case '\t':
+			q++;
+			continue;
+		case ';':
+			skip=0;
+			break;
+		default:
+			break;
+		}
+		if (operand && !skip) {
+			/* longest constant subexpression from here */
+			cc->line=cc->next=s=q;
+			if (fold_expr(cc,&fc,minprec,&nodes,&lowest) && nodes) {
+				e=cc->next;
+				tok=scan(cc);
+				len=e-s;
+				/* the next operator must not take a part of the span, one
+				   of the same precedence takes it whole from the left */
+				if ((tok==T_RPAR || (tok<=T_HASH && (IS_END(tok)
+					|| ((IS_BIN(tok) || tok==T_COL) && ((int)PREC(tok)<lowest
+					|| ((int)PREC(tok)==lowest && !IS_RASS(tok)))))))
+					&& len<=255 && len>=3+(int)sizeof(real)
+					&& cend+80<cc->udfstart
+					&& (res=fold_eval(cc,s,e,(char *)ALIGN((ULONG)cend)))!=NULL) {
+					if (res->type==s_real) {
+						s[0]=5; s[1]=len; s[2]=MIN(nodes,255);
+						memmove(s+3,realof(res),sizeof(real));
+						memset(s+3+sizeof(real),' ',len-3-sizeof(real));
+						q=e; operand=0;
+						continue;
+					} else if (dimsof(res)->r*dimsof(res)->c<=FOLD_MATRIX_MAX) {
+						uint32_t off;
+						char *obj=(char *)ALIGN((ULONG)cend);
+						if (obj+res->size<cc->udfstart-80) {
+							memmove(obj,res,res->size);
+							cend=obj+((header *)obj)->size;
+							off=obj-s;
+							s[0]=4; s[1]=len; s[2]=MIN(nodes,255);
+							memmove(s+3,&off,sizeof(uint32_t));
+							memset(s+3+sizeof(uint32_t),' ',len-3-sizeof(uint32_t));
+							q=e; operand=0;
+							continue;
+						}
+					}
+				}
+			}
+		}
+		/* not folded: step over a token */
+		cc->next=q;
+		tok=scan(cc);
+		q=cc->next;
+		switch (tok) {
+		case T_REAL: case T_IMAG: case T_LABEL: case T_HASH:
+		case T_RPAR: case T_RBRACKET: case T_RBRACE: case T_TRANSPOSE:
+			operand=0;
+			break;
+		case T_ADD:
+		case T_SUB:
+			if (operand) {
+				if (tok==T_SUB) minprec=PREC(T_NEG)+1;
+			} else {
+				operand=1; minprec=PREC(tok)+1;
+			}
+			break;
+		case T_NOT:
+			operand=1; minprec=PREC(T_NOT)+1;
+			break;
+		case T_COL:
+			operand=1; minprec=PREC(T_COL)+1;
+			break;
+		default:
+			operand=1;
+			minprec = (tok<=T_HASH && IS_BIN(tok)) ? (IS_RASS(tok) ? PREC(tok) : PREC(tok)+1) : 1;
+			break;
+		}
+	}
+end:
+	cc_leave(cc,&uw);
+	cc->next=oldnext; cc->line=oldline;
+	return cend;
+}
+
+static int udf_folded (char *p, char *end)
+/* number of operations folded in the body [p,end[ */
+{	int n=0;
+	while (p<end) {
+		if (*p==2) {
+			p+=1+sizeof(real);
+		} else if (*p==4 || *p==5) {
+			n+=(unsigned char)p[2];
+			p+=(unsigned char)p[1];
+		} else if (*p==3) {
+			int cmd_idx=*(p+1);
+			if (cmd_list[cmd_idx].type==c_endfunction) break;
+			p+=2;
+			switch (cmd_list[cmd_idx].type) {
+			case c_do:
+			case c_repeat:
+			case c_if:
+			case c_elseif:
+			case c_else:
+				p+=sizeof(unsigned short);
+				break;
+			default:
+				break;
+			}
+		} else p++;
+	}
+	return n;
+}
+
 #ifndef ASSIGN_OP 
 #define shift_by_offset(hd,offset) ((header *)((char *)(hd)+offset))
 #endif
-int parse(Calc *cc)
-{	
-	token_t tok;
-	int cmd=-1;
-	
-	cc->newram=cc->endlocal;
-	cc->nresults=0;
+static void skip_blank (Calc *cc)
+/* skip spaces, empty statements and comments up to the next statement */
+{
 	while(1) {
 		char c;
 		/* skip space */
@@ -3661,6 +5155,16 @@ int parse(Calc *cc)
 		if (*cc->next && *cc->next!='\n') break;
 		else next_line(cc);
 	}
+}
+
+int parse(Calc *cc)
+{	
+	token_t tok;
+	int cmd=-1;
+	
+	cc->newram=cc->endlocal;
+	cc->nresults=0;
+	skip_blank(cc);
 	
 	if ((cmd=cmd_parse_and_exec(cc))!=c_none) {
 		if (cmd!=c_return) cc->result=NULL;
@@ -3677,6 +5181,7 @@ int parse(Calc *cc)
 	case s_complex:
 	case s_matrix:
 	case s_cmatrix:
+	case s_qmatrix:
 	case s_string:
 	case s_funcref:
 		switch (tok) {
@@ -3716,7 +5221,10 @@ int parse(Calc *cc)
 				if (varcount>=8) cc_error(cc,"Too many commas!");
 			}
 			
+			int oldwanted=cc->nwanted;
+			cc->nwanted=varcount;
 			CC_SET(cc,CC_NOSUBMREF); tok=parse_expr(cc); CC_UNSET(cc,CC_NOSUBMREF);
+			cc->nwanted=oldwanted;
 			if (tok==T_RBRACKET || tok==T_RBRACE || tok==T_RPAR) cc_error(cc,"Illegal separator: only ';', ',' or '\\n' allowed");
 			/* count and note the values, that are assigned to the
 			   variables */
@@ -3871,6 +5379,99 @@ void cc_warn(Calc *cc, char *fmt, ...)
 	output(cc,text);
 }
 
+void cc_leave (Calc *cc, unwind_t *uw)
+/***** cc_leave
+	restore the context saved in the innermost unwind record uw and
+	pop it, when its scope ends or is unwound by an error.
+*****/
+{
+	switch (uw->kind) {
+	case UW_CATCH:
+		cc->env=uw->env;
+		break;
+	case UW_UDF:
+		cc->level=uw->level;
+		if (uw->prof) prof_leave(cc);
+		cc->epsilon=uw->epsilon;
+		cc->xstart=uw->xstart;
+		cc->xend=uw->xend;
+		if (cc->trace>=0) cc->trace=uw->trace;
+		/* fall through */
+	case UW_LUF:
+		cc->startlocal=uw->startlocal;
+		cc->endlocal=uw->endlocal;
+		cc->running=uw->running;
+		cc->actargn=uw->actargn;
+		cc->next=uw->next;
+		cc->line=uw->line;
+		cc->flags=uw->flags;
+		break;
+	case UW_CHUNK:
+		cc->next=uw->next;
+		cc->line=uw->line;
+		cc->flags=uw->flags;
+		cc->udfstart=uw->udfstart;
+		break;
+	case UW_FOR:
+		kill_local(cc,uw->name);
+		break;
+	case UW_FORIN:
+		kill_local(cc,uw->name);
+		cc->udfstart=uw->udfstart;
+		break;
+	}
+	cc->unwind=uw->prev;
+}
+
+static int cc_unwind (Calc *cc, int code)
+/***** cc_unwind
+	leave the scopes down to the nearest catch record, telling where
+	the error occured. code is 1 for an error raised in the innermost
+	scope, 2 when propagated by a catch handler, as given to longjmp.
+*****/
+{	unwind_t *uw;
+	while ((uw=cc->unwind)!=NULL && uw->kind!=UW_CATCH) {
+		switch (uw->kind) {
+		case UW_UDF:
+			if (code==2 && CC_ISSET(cc,CC_VERBOSE)) {output(cc,"  ");type_udfline(cc,cc->line);}
+			cc_leave(cc,uw);
+			outputf(cc,"error in function '%s'\n",uw->var->name);
+			break;
+		case UW_LUF:
+			cc_leave(cc,uw);
+			outputf(cc,"error in light user function '%s'\n",uw->var->name);
+			break;
+		case UW_CHUNK:
+			cc_leave(cc,uw);
+			output(cc,"error in chunk\n");
+			break;
+		case UW_FOR:
+			cc_leave(cc,uw);
+			outputf(cc,"error in for..to loop at index %s=%g\n",uw->name,*realof(uw->var));
+			break;
+		case UW_FORIN:
+			cc_leave(cc,uw);
+			outputf(cc,"error in for..in at loop var %s=\n",uw->name);
+			if (uw->var->type==s_real) real_out(cc,*realof(uw->var));
+			else complex_out(cc,*realof(uw->var),*imagof(uw->var));
+			output(cc,"\n");
+			break;
+		default:
+			break;
+		}
+		code=2;
+	}
+	return code;
+}
+
+void cc_rethrow (Calc *cc)
+/***** cc_rethrow
+	propagate an error caught by a catch record to the enclosing one.
+*****/
+{
+	longjmp(*cc->env, cc_unwind(cc,2));
+}
+
 void cc_error(Calc *cc, char *fmt, ...)
 {
 	char text [256];
@@ -3893,7 +5494,7 @@ void cc_error(Calc *cc, char *fmt, ...)
 	text[i]=0;
 	va_end(v);
 	output(cc,text);
-	longjmp(*cc->env, 1);
+	longjmp(*cc->env, cc_unwind(cc,1));
 }
 
 
@@ -3906,6 +5507,8 @@ void main_loop (Calc *cc, int argc, char *argv[])
 	cc->globalstart=cc->globalend=cc->ramstart;
 	cc->newram=cc->startlocal=cc->endlocal=cc->ramstart;
 	cc->udfstart=cc->udfend=cc->ramend;
+	cc->newrammax=cc->newram;
+	cc->udfstartmin=cc->udfstart;
 	cc->epsilon=EPSILON;
 	cc->xstart=NULL;
 	cc->xend=NULL;
@@ -3929,6 +5532,7 @@ void main_loop (Calc *cc, int argc, char *argv[])
 	cc->infile = NULL;
 	cc->outfile = NULL;
 	cc->env=&env;
+	cc->unwind=NULL;
 	
 	hd=new_real(cc,M_PI,"pi");
 	hd->flags=FLAG_CONST;
@@ -3951,18 +5555,22 @@ void main_loop (Calc *cc, int argc, char *argv[])
 		/* output(cc,"exception from global context\n"); */
 		cc->line = cc->next = input;
 		input[0]=0;
+		pool_reset();
 		break;
 	case 2:
 		/* output(cc,"back to global env from exception in function context\n"); */
 		cc->line = cc->next = input;
 		input[0]=0;
+		pool_reset();
 		break;
 	}
 	
 	cc->result = NULL;
+	cc->unwind = NULL;
 	cc->flags=CC_OUTPUTING;
 	cc->loopindex=0;
 	cc->level=0;
+	cc->nwanted=1;
 	
 	/* interpret until "quit" */
 	while (!cc->quit) {
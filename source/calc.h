@@ -79,6 +79,7 @@ typedef enum {
 	T_DQUOTE,			/* '"' */
 	T_REAL,				/* a real number */
 	T_IMAG,				/* an imaginary part number*/
+	T_CONST,			/* a folded constant object */
 	T_LABEL,			/* a label */
 	T_FUNCREF,			/* a function ref: 'name(' */
 	T_MATREF,			/* a matrix ref: 'name[' */
@@ -87,6 +88,42 @@ typedef enum {
 
 #define LINEMAX	256		/* Maximum input line length */
 
+/* error unwinding records
+   each scope changing the interpreter context (udf or luf call, for loop,
+   compiled chunk) pushes a record with the context of its caller, linked
+   on the C stack. cc_error() restores the records down to the nearest
+   catch record (load, input, ...) and does a single longjmp to its
+   recovery point.
+ */
+typedef enum {
+	UW_CATCH, UW_UDF, UW_LUF, UW_CHUNK, UW_FOR, UW_FORIN
+} unwind_kind;
+
+typedef struct _unwind_t {
+	struct _unwind_t *prev;		/* enclosing scope */
+	unwind_kind		kind;
+	/* saved context, each kind saves what it changes */
+	unsigned int	flags;
+	char *			line;
+	char *			next;
+	char *			startlocal;
+	char *			endlocal;
+	char *			udfstart;
+	char *			xstart;
+	char *			xend;
+	header *		running;
+	int				actargn;
+	int				trace;
+	int				level;
+	int				prof;			/* udf: prof_enter pushed a frame */
+	real			epsilon;
+	header *		var;			/* udf/luf running, loop variable value */
+	char *			name;			/* loop variable name */
+	jmp_buf *		env;			/* catch records: enclosing recovery point */
+} unwind_t;
+
+#define UNWIND_PUSH(cc,uw,k)	((uw)->kind=(k), (uw)->prev=(cc)->unwind, (cc)->unwind=(uw))
+
 struct _Calc {
 	char *			line;			/* pointer to the input line */
 	int				linenb;			/* line number */
@@ -94,6 +131,7 @@ struct _Calc {
 	char *			next;			/* pointer to the next char */
 	real			val;			/* real value scanned */
 	char			str[LABEL_LEN_MAX+1];	/* string scanned */
+	char *			cst;			/* folded constant object scanned (unaligned) */
 	
 #if 0
 	/* output mode (EDIT_ECHO/OUTPUT/WARNING/ERROR) */
@@ -120,6 +158,8 @@ struct _Calc {
 	char *			globalend;		/* end of the global context */
 	char *			startlocal;		/* start of current local variables */
 	char *			endlocal;		/* end of current local variables */
+	char *			newrammax;		/* high-water mark of newram */
+	char *			udfstartmin;	/* low-water mark of udfstart */
 	
 	/* IO */
 	FILE *			infile;			/* input file */
@@ -131,11 +171,14 @@ struct _Calc {
 	char *			xend;			/* extra parameter */
 	header *		result;			/* last result */
 	int				nresults;		/* number of results returned */
+	int				nwanted;		/* number of results wanted by a multiple
+									   assignment, 1 otherwise */
 	
 	/* user defined functions handling */
 	header *		running;		/* running udf */
 	int				actargn;		/* actual number of arguments */
 	int				trace;			/* tracing feature activated? */
+	int				profile;		/* statement profiler activated? */
 	long			loopindex;		/* index used by loop statement */
 	int				level;			/* udf call level */
 	
@@ -151,7 +194,8 @@ struct _Calc {
 	int				encoding;
 	
 	/* error handling */
-	jmp_buf *		env;
+	jmp_buf *		env;			/* recovery point of the nearest catch record */
+	unwind_t *		unwind;			/* innermost unwind record */
 };
 
 /*** calc flags ***
@@ -176,6 +220,9 @@ struct _Calc {
    CC_SEARCH_GLOBALS:   when 1 allow to look for variables in the global scope
                         if they don't exist in the local scope.
    CC_VERBOSE:          when 1 allow having extra information on errors
+   CC_PARSE_RANGE:      when 1 the next parse_expr() may return a lazy a:b:c
+                        range (for..in loops and indexes), else ranges are
+                        expanded to vectors.
  */
 #define	CC_OUTPUTING		1<<0
 #define	CC_NOSUBMREF		1<<1
@@ -188,6 +235,7 @@ struct _Calc {
 #define CC_TRACE_UDF		1<<8
 #define CC_SEARCH_GLOBALS	1<<9
 #define CC_VERBOSE			1<<10
+#define CC_PARSE_RANGE		1<<11
 #define CC_USE_UTF8			1<<16
 
 #define CC_SET(cc,prop)		((cc)->flags |= (prop))
@@ -198,14 +246,28 @@ struct _Calc {
 void output (Calc *cc, char *s);
 void outputf (Calc *cc, char *fmt, ...);
 
+#define FMT_BUF_SIZE	128		/* size of a fmt_num buffer */
+
+int fmt_num (char *s, real x, int prec, char conv);
+
 token_t scan(Calc *cc);
 token_t scan_path(Calc *cc);
 int parse(Calc *cc);
 token_t parse_expr(Calc *cc);
 void cc_warn(Calc *cc, char *s, ...);
 void cc_error(Calc *cc, char *s, ...);
+void cc_leave(Calc *cc, unwind_t *uw);
+void cc_rethrow(Calc *cc);
 void trace_udfline (Calc* cc, char *next);
+int  prof_enter (Calc *cc, header *udf);
+void prof_leave (Calc *cc);
+void prof_line (Calc *cc);
+void prof_alloc (Calc *cc, int size);
 void main_loop (Calc *cc, int argc, char *argv[]);
 token_t cmd2tok(int cmd);
 
+/* workspace snapshot */
+header* mstore (Calc *cc, header *hd);
+header* mrestore (Calc *cc, header *hd);
+
 #endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 
 ////////incluyo este header para usar la read_xyz en maccel/////////
@@ -41,9 +42,10 @@ header* mfilter (Calc *cc, header *hd)
 
 		result=new_matrix(cc,1,cx-cb+1,"");
 		real *mres=matrixof(result);
+		/* FIR part: the valid part of the convolution of b and x */
+		convolve(cc,mx,cx,mb,cb,mres,cb-1,cx-cb+1,0);
 		for (int i=0; i<cx-cb+1; i++) {
-			real s=0.0;
-			for (int j=0; j<cb; j++) s+=mb[j]*mx[cb-1+i-j];
+			real s=mres[i];
 			for (int j=1; j<ca; j++) {
 				if (i-j>=0) {
 					s-=mres[i-j]*ma[j];
@@ -56,30 +58,33 @@ header* mfilter (Calc *cc, header *hd)
 		}
 	} else if (isrealorcplx(hda) && isrealorcplx(hdb) && 
 		isrealorcplx(hdx) && isrealorcplx(hdy)) {
-		real r=ma[0]*ma[0]+ma[1]*ma[1];
-		if (r==0) cc_error(cc,"first denominator coeff must be non-zero");
+		header *h=hd;
+		for (int k=0; k<4; k++) {
+			make_complex(cc,h); h=nextof(h);
+		}
+		hdb=getvalue(cc,hd); hda=getvalue(cc,nextof(hd));
+		hdx=getvalue(cc,nextof(nextof(hd)));
+		hdy=getvalue(cc,nextof(nextof(nextof(hd))));
+		getmatrix(hdb,&rb,&cb,&mb); getmatrix(hda,&ra,&ca,&ma);
+		getmatrix(hdx,&rx,&cx,&mx); getmatrix(hdy,&ry,&cy,&my);
+		
+		cplx *a=(cplx*)ma, *yi=(cplx*)my, *y, s, t;
+		if (a[0][0]==0 && a[0][1]==0) cc_error(cc,"first denominator coeff must be non-zero");
 		result=new_cmatrix(cc,1,cx-cb+1,"");
-/*		real *mres=matrixof(result);
+		y=(cplx*)matrixof(result);
+		convolve(cc,mx,cx,mb,cb,(real*)y,cb-1,cx-cb+1,1);
 		for (int i=0; i<cx-cb+1; i++) {
-			real sre=0,sim=0;
-			for (int j=0; j<cb; j++) {
-				sre+=getvre(hdb,j)*getvre(hdx,cb-1+i-j)-getvim(hdb,j)*getvim(hdx,cb-1+i-j);
-				sim+=getvim(hdb,j)*getvre(hdx,cb-1+i-j)+getvre(hdb,j)*getvim(hdx,cb-1+i-j);
-			}
+			c_copy(y[i],s);
 			for (int j=1; j<ca; j++) {
 				if (i-j>=0) {
-					sre-=getvre(result,i-j)*getvre(hda,j)-getvim(result,i-j)*getvim(hda,j);
-					sim-=getvim(result,i-j)*getvre(hda,j)+getvre(result,i-j)*getvim(hda,j);
+					c_mul(y[i-j],a[j],t);
 				} else {
-					sre-=getvre(hdy,i-j+cy)*getvre(hda,j)-getvim(hdy,i-j+cy)*getvim(hda,j);
-					sim-=getvim(hdy,i-j+cy)*getvre(hda,j)+getvre(hdy,i-j+cy)*getvim(hda,j);
+					c_mul(yi[i-j+cy],a[j],t);
 				}
+				c_sub(s,t,s);
 			}
-			sre=(sre*getvre(hda,0)+sim*getvim(hda,0))/r;
-			sim=(sim*getvre(hda,0)-sre*getvim(hda,0))/r;
-			mres[2*i]=sre; mres[2*i+1]=sim;
+			c_div(s,a[0],y[i]);
 		}
-*/
 	} else cc_error(cc,"bad parameters in filter(b,a,x,yini)");
 
 	return moveresult(cc,hd,result);
@@ -99,7 +104,7 @@ static void rfft (LONG m0, LONG p0, LONG q0, LONG n)
 {	LONG p,q,m,l;
 	LONG mh,ml;
 	int found=0;
-	cplx sum,h;
+	cplx sum;
 	if (p0==1) return;
 //	if (test_key()==escape) cc_error("fft interrupted")
 	if (p0%2==0) {
@@ -120,17 +125,15 @@ static void rfft (LONG m0, LONG p0, LONG q0, LONG n)
 	mh=m0;
 	for (l=0; l<p0; l++) {
 		ml=l%p;
-		c_copy(ff[(m0+ml*q*q0)%nn],sum);
+		sum[0]=ff[(m0+ml*q*q0)%nn][0]; sum[1]=ff[(m0+ml*q*q0)%nn][1];
 		for (m=1; m<q; m++) {
-			c_mul(ff[(m0+(m+ml*q)*q0)%nn],zz[(n*l*m)%nn],h);
-			c_add(sum,h,sum);
+			c_mac(ff[(m0+(m+ml*q)*q0)%nn],zz[(n*l*m)%nn],sum);
 		}
-		sum[0]/=q; sum[1]/=q;
-		c_copy(sum,fh[mh]);
+		fh[mh][0]=sum[0]/q; fh[mh][1]=sum[1]/q;
 		mh+=q0; if (mh>=nn) mh-=nn;
 	}
 	for (l=0; l<p0; l++) {
-		c_copy(fh[m0],ff[m0]);
+		ff[m0][0]=fh[m0][0]; ff[m0][1]=fh[m0][1];
 		m0+=q0; if (m0>=nn) mh-=nn;
 	}
 }
@@ -144,12 +147,13 @@ static void fft (Calc *cc, real *a, int n, int signum)
 	nn=n;
 
 	char *ram=cc->newram;
+	cplx *buf=(cplx *)pool_alloc(2*n*sizeof(cplx));
 	ff=(cplx *)a;
+	if (buf) ram=(char *)buf;
+	else if (ram+2*n*sizeof(cplx)>cc->udfstart) cc_error(cc,"Memory overflow!");
 	zz=(cplx *)ram;
 	ram+=n*sizeof(cplx);
 	fh=(cplx *)ram;
-	ram+=n*sizeof(cplx);
-	if (ram>cc->udfstart)  cc_error(cc,"Memory overflow!");
 	
 	/* compute zz[k]=e^{-2*pi*i*k/n}, k=0,...,n-1 */
 	h=2*M_PI/n; z[0]=cos(h); z[1]=signum*sin(h);
@@ -159,6 +163,7 @@ static void fft (Calc *cc, real *a, int n, int signum)
 		else c_mul(zz[i-1],z,zz[i]);
 	}
 	rfft(0,n,1,1);
+	pool_free(buf);
 	if (signum==-1)
 		for (i=0; i<n; i++) {
 			ff[i][0]*=n; ff[i][1]*=n;
@@ -199,6 +204,690 @@ header* mifft (Calc *cc, header *hd)
 	return pushresults(cc,result);
 }
 
+/****************************************************************
+ *	convolution
+ ****************************************************************/
+#define CONV_DIRECT_MAX		8		/* shorter kernels are always convolved directly */
+
+static void conv_direct (real *x, int nx, real *h, int nh, real *y, int off, int ny, int complex)
+/***** conv_direct
+	y[k]=sum x[j]*h[off+k-j], k=0..ny-1 as dot products.
+*****/
+{	int k,j,j0,j1,n;
+	for (k=0; k<ny; k++) {
+		n=off+k;
+		j0=(n-nh+1>0) ? n-nh+1 : 0;
+		j1=(n<nx-1) ? n : nx-1;
+		if (complex) {
+			cv_dot(x+2*j0,1,h+2*(n-j0),-1,j1-j0+1,y+2*k);
+		} else {
+			real s=0.0;
+			for (j=j0; j<=j1; j++) s+=x[j]*h[n-j];
+			y[k]=s;
+		}
+	}
+}
+
+static void fft2 (cplx *a, cplx *w, int n, int ws, int signum)
+/***** fft2
+	in place radix 2 fft of a[0..n-1], n a power of 2, without scaling.
+	w[k*ws]=e^{-2*pi*i*k/n}, k=0..n/2-1; signum=1 gives the inverse
+	transform.
+*****/
+{	int i,j,k,len,half,step;
+	real tre,tim,wre,wim;
+	for (i=1,j=0; i<n; i++) {
+		int bit=n>>1;
+		for (; j&bit; bit>>=1) j^=bit;
+		j^=bit;
+		if (i<j) {
+			tre=a[i][0]; a[i][0]=a[j][0]; a[j][0]=tre;
+			tim=a[i][1]; a[i][1]=a[j][1]; a[j][1]=tim;
+		}
+	}
+	for (len=2; len<=n; len<<=1) {
+		half=len>>1; step=n/len;
+		for (i=0; i<n; i+=len) {
+			for (k=0; k<half; k++) {
+				real *u=a[i+k], *v=a[i+k+half];
+				wre=w[k*step*ws][0]; wim=-signum*w[k*step*ws][1];
+				tre=v[0]*wre-v[1]*wim;
+				tim=v[0]*wim+v[1]*wre;
+				v[0]=u[0]-tre; v[1]=u[1]-tim;
+				u[0]+=tre; u[1]+=tim;
+			}
+		}
+	}
+}
+
+static void conv_add (real *y, int off, int ny, int pos, real *src, int n, int complex)
+/***** conv_add
+	add the block src[0..n-1] (stride 2) at full output index pos into the
+	window y[0..ny-1] starting at off.
+*****/
+{	int t0=off-pos, t1=off+ny-pos, t;
+	if (t0<0) t0=0;
+	if (t1>n) t1=n;
+	if (complex) {
+		for (t=t0; t<t1; t++) {
+			y[2*(pos+t-off)]+=src[2*t];
+			y[2*(pos+t-off)+1]+=src[2*t+1];
+		}
+	} else {
+		for (t=t0; t<t1; t++) y[pos+t-off]+=src[2*t];
+	}
+}
+
+void convolve (Calc *cc, real *x, int nx, real *h, int nh, real *y, int off, int ny, int complex)
+/***** convolve
+	y[k]=sum x[j]*h[off+k-j], k=0..ny-1, i.e. the window [off,off+ny) of
+	the full convolution of x and h (length nx+nh-1). complex vectors are
+	interleaved re/im. Short kernels are done directly, longer ones by an
+	FFT overlap-add whose block size minimizes the estimated cost. Real
+	data packs two consecutive blocks in the re and im parts of one
+	transform. Scratch space is taken from the pool, or above cc->newram.
+*****/
+{	int sz=complex ? 2 : 1;
+	int x0,x1,n,bits,N=0,L,nb,i,k,pos;
+	real cost,best;
+	cplx *H,*X,*W,*buf;
+	
+	if (ny<=0) return;
+	if (nx<nh) {
+		real *t=x; x=h; h=t;
+		i=nx; nx=nh; nh=i;
+	}
+	/* only x[x0..x1-1] contributes to the window */
+	x0=off-nh+1; if (x0<0) x0=0;
+	x1=off+ny; if (x1>nx) x1=nx;
+	if (x1<=x0) {
+		memset(y,0,(size_t)ny*sz*sizeof(real));
+		return;
+	}
+	
+	best=(real)ny*nh*(complex ? 8 : 2);
+	if (nh>CONV_DIRECT_MAX) {
+		ULONG avail=MAX((ULONG)(cc->udfstart-cc->newram),pool_avail());
+		for (n=2, bits=1; n<2*nh; n<<=1) bits++;
+		for (;;) {
+			if ((ULONG)n*5/2*sizeof(cplx)>avail) break;
+			L=n-nh+1;
+			nb=(x1-x0+L-1)/L;
+			if (!complex) nb=(nb+1)/2;
+			cost=(real)nb*((real)10*n*bits+8*n)+(real)5*n*bits;
+			if (cost<best) { best=cost; N=n; }
+			if (n>=x1-x0+nh-1 || n>=(1<<29)) break;
+			n<<=1; bits++;
+		}
+	}
+	if (!N) {
+		conv_direct(x,nx,h,nh,y,off,ny,complex);
+		return;
+	}
+	
+	buf=(cplx*)pool_alloc((ULONG)N*5/2*sizeof(cplx));
+	H=buf ? buf : (cplx*)cc->newram;
+	X=H+N;
+	W=X+N;
+	for (k=0; k<N/2; k++) {
+		real a=-2*M_PI*k/N;
+		W[k][0]=cos(a); W[k][1]=sin(a);
+	}
+	for (k=0; k<N; k++) {
+		if (k<nh) {
+			H[k][0]=h[sz*k]; H[k][1]=complex ? h[2*k+1] : 0.0;
+		} else {
+			H[k][0]=0.0; H[k][1]=0.0;
+		}
+	}
+	fft2(H,W,N,1,-1);
+	/* fold the 1/N scaling of the inverse transform into H */
+	for (k=0; k<N; k++) { H[k][0]/=N; H[k][1]/=N; }
+	
+	memset(y,0,(size_t)ny*sz*sizeof(real));
+	L=N-nh+1;
+	for (pos=x0; pos<x1; pos+=complex ? L : 2*L) {
+		int l0=(x1-pos<L) ? x1-pos : L;
+		int l1=complex ? 0 : ((x1-pos-L<L) ? x1-pos-L : L);
+		if (l1<0) l1=0;
+		for (k=0; k<N; k++) {
+			if (complex) {
+				if (k<l0) { X[k][0]=x[2*(pos+k)]; X[k][1]=x[2*(pos+k)+1]; }
+				else { X[k][0]=0.0; X[k][1]=0.0; }
+			} else {
+				X[k][0]=(k<l0) ? x[pos+k] : 0.0;
+				X[k][1]=(k<l1) ? x[pos+L+k] : 0.0;
+			}
+		}
+		fft2(X,W,N,1,-1);
+		cv_mul((real*)X,(real*)H,(real*)X,N);
+		fft2(X,W,N,1,1);
+		conv_add(y,off,ny,pos,(real*)X,l0+nh-1,complex);
+		if (l1) conv_add(y,off,ny,pos+L,(real*)X+1,l1+nh-1,0);
+	}
+	pool_free(buf);
+}
+
+header* mconv (Calc *cc, header *hd)
+/***** conv
+	conv(a,b) convolution of the vectors a and b. The result has the
+	orientation of a.
+*****/
+{	header *st=hd,*hd1,*result;
+	int r1,c1,r2,c2,n1,n2,complex=0;
+	real *m1,*m2;
+	hd1=next_param(cc,hd);
+	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
+	if (!isrealorcplx(hd) || !isrealorcplx(hd1)) cc_error(cc,"bad parameters in conv(a,b)");
+	if (iscplx(hd) || iscplx(hd1)) {
+		make_complex(cc,st); make_complex(cc,nextof(st));
+		hd=getvalue(cc,st); hd1=getvalue(cc,nextof(st));
+		complex=1;
+	}
+	getmatrix(hd,&r1,&c1,&m1); getmatrix(hd1,&r2,&c2,&m2);
+	if ((r1!=1 && c1!=1) || (r2!=1 && c2!=1)) cc_error(cc,"vector expected");
+	n1=r1*c1; n2=r2*c2;
+	if (n1<1 || n2<1) cc_error(cc,"vectors must not be empty");
+	if ((ULONG)n1+n2-1>INT_MAX) cc_error(cc,"can't handle those large vectors");
+	if (complex)
+		result=(r1==1) ? new_cmatrix(cc,1,n1+n2-1,"") : new_cmatrix(cc,n1+n2-1,1,"");
+	else
+		result=(r1==1) ? new_matrix(cc,1,n1+n2-1,"") : new_matrix(cc,n1+n2-1,1,"");
+	convolve(cc,m1,n1,m2,n2,matrixof(result),0,n1+n2-1,complex);
+	return pushresults(cc,result);
+}
+
+/****************************************************************
+ *	real input FFT
+ ****************************************************************/
+static cplx* rdft_table (Calc *cc, int n)
+/***** rdft_table
+	push the twiddles t[k]=e^{-2*pi*i*k/n}, k=0..n/2-1, used by rdft and
+	irdft for an even length n. Returns NULL for an odd n.
+*****/
+{	header *hd;
+	cplx *t, z;
+	real h=2*M_PI/n;
+	int k;
+	if (n&1) return NULL;
+	hd=new_cmatrix(cc,1,n/2,"");
+	t=(cplx*)matrixof(hd);
+	z[0]=cos(h); z[1]=-sin(h);
+	for (k=0; k<n/2; k++) {
+		if (k%16) c_mul(t[k-1],z,t[k]);
+		else { t[k][0]=cos(k*h); t[k][1]=-sin(k*h); }
+	}
+	return t;
+}
+
+static void cdft (Calc *cc, cplx *a, int m, cplx *t, int signum)
+/***** cdft
+	complex transform of length m=n/2 with the table of rdft_table(n):
+	forward without scaling (signum=-1), inverse scaled by 1/m (signum=1).
+*****/
+{	int k;
+	if ((m&(m-1))==0) {
+		fft2(a,t,m,2,signum);
+		if (signum==1) for (k=0; k<m; k++) { a[k][0]/=m; a[k][1]/=m; }
+	} else {
+		fft(cc,(real*)a,m,signum);
+	}
+}
+
+static void rdft (Calc *cc, real *x, int n, real *X, cplx *t)
+/***** rdft
+	X[k], k=0..n/2 (interleaved re/im), DFT of the real x[0..n-1]. For an
+	even n, x is taken as n/2 complex values, transformed at half length
+	and split into the spectrum; X needs n+2 reals and may be x. An odd n
+	uses a full complex transform in scratch space above cc->newram.
+*****/
+{	int m=n/2, k;
+	cplx *Z=(cplx*)X;
+	if (n&1) {
+		char *ram=cc->newram;
+		cplx *b=(cplx*)ram;
+		if (ram+n*sizeof(cplx)>cc->udfstart) cc_error(cc,"Memory overflow!");
+		for (k=0; k<n; k++) { b[k][0]=x[k]; b[k][1]=0.0; }
+		cc->newram+=n*sizeof(cplx);
+		fft(cc,(real*)b,n,-1);
+		cc->newram=ram;
+		memmove(X,b,(m+1)*sizeof(cplx));
+		return;
+	}
+	if (x!=X) memmove(X,x,n*sizeof(real));
+	cdft(cc,Z,m,t,-1);
+	/* with E=(Z[k]+conj(Z[m-k]))/2 and O=(Z[k]-conj(Z[m-k]))/2i, the
+	   spectra of the even and odd samples:
+	     X[k]=E+t[k]*O and X[m-k]=conj(E-t[k]*O) */
+	Z[m][0]=Z[0][0]-Z[0][1]; Z[m][1]=0.0;
+	Z[0][0]=Z[0][0]+Z[0][1]; Z[0][1]=0.0;
+	for (k=1; k<=m/2; k++) {
+		real *a=Z[k], *b=Z[m-k];
+		real e0=(a[0]+b[0])*0.5, e1=(a[1]-b[1])*0.5;
+		real o0=(a[1]+b[1])*0.5, o1=(b[0]-a[0])*0.5;
+		real p0=o0*t[k][0]-o1*t[k][1], p1=o0*t[k][1]+o1*t[k][0];
+		a[0]=e0+p0; a[1]=e1+p1;
+		b[0]=e0-p0; b[1]=p1-e1;
+	}
+}
+
+static void irdft (Calc *cc, real *X, int n, real *x, cplx *t)
+/***** irdft
+	x[0..n-1], the real inverse DFT of the bins X[k], k=0..n/2. The
+	inverse of rdft, x must not overlap X.
+*****/
+{	int m=n/2, k;
+	cplx *Z=(cplx*)x, *Y=(cplx*)X;
+	if (n&1) {
+		char *ram=cc->newram;
+		cplx *b=(cplx*)ram;
+		if (ram+n*sizeof(cplx)>cc->udfstart) cc_error(cc,"Memory overflow!");
+		b[0][0]=Y[0][0]; b[0][1]=Y[0][1];
+		for (k=1; k<=m; k++) {
+			b[k][0]=Y[k][0]; b[k][1]=Y[k][1];
+			b[n-k][0]=Y[k][0]; b[n-k][1]=-Y[k][1];
+		}
+		cc->newram+=n*sizeof(cplx);
+		fft(cc,(real*)b,n,1);
+		cc->newram=ram;
+		for (k=0; k<n; k++) x[k]=b[k][0];
+		return;
+	}
+	/* rebuild Z[k]=E+i*O from E=(X[k]+conj(X[m-k]))/2 and
+	   O=conj(t[k])*(X[k]-conj(X[m-k]))/2 */
+	for (k=0; k<=m/2; k++) {
+		real *a=Y[k], *b=Y[k ? m-k : m];
+		real e0=(a[0]+b[0])*0.5, e1=(a[1]-b[1])*0.5;
+		real d0=(a[0]-b[0])*0.5, d1=(a[1]+b[1])*0.5;
+		real o0=t[k][0]*d0+t[k][1]*d1, o1=t[k][0]*d1-t[k][1]*d0;
+		Z[k][0]=e0-o1; Z[k][1]=e1+o0;
+		if (k) { Z[m-k][0]=e0+o1; Z[m-k][1]=o0-e1; }
+	}
+	cdft(cc,Z,m,t,1);
+}
+
+static void sig_dims (header *hd, int *r, int *c)
+/* rows and columns of a real or fixed point signal */
+{	real *m;
+	if (hd->type==s_qmatrix) {
+		*r=qdimsof(hd)->r; *c=qdimsof(hd)->c;
+	} else getmatrix(hd,r,c,&m);
+}
+
+static void sig_frame (header *hd, int row, long start, int n, real *w, real *f)
+/***** sig_frame
+	f[k]=w[k]*x[row,start+k], k=0..n-1, for a real, Q15 or Q31 signal x,
+	no windowing when w is NULL.
+*****/
+{	int r,c,k;
+	if (hd->type==s_qmatrix) {
+		real s=(real)1.0/(real)((int64_t)1<<qdimsof(hd)->q);
+		long o=(long)row*qdimsof(hd)->c+start;
+		if (qdimsof(hd)->q==15) {
+			int16_t *m=(int16_t*)qmatrixof(hd)+o;
+			for (k=0; k<n; k++) f[k]=(w ? w[k]*s : s)*m[k];
+		} else {
+			int32_t *m=(int32_t*)qmatrixof(hd)+o;
+			for (k=0; k<n; k++) f[k]=(w ? w[k]*s : s)*m[k];
+		}
+	} else {
+		real *m;
+		getmatrix(hd,&r,&c,&m);
+		m+=(long)row*c+start;
+		if (w) for (k=0; k<n; k++) f[k]=w[k]*m[k];
+		else memmove(f,m,n*sizeof(real));
+	}
+}
+
+/* rfft: spectrum of real data
+ *   X=rfft(x)
+ *   bins 0..n/2 of the DFT of each row of x (n columns); x is real, Q15
+ *   or Q31. Same values as the first n/2+1 columns of fft(x), in half the
+ *   memory and time.
+ *****/
+header* mrfft (Calc *cc, header *hd)
+{	header *result;
+	int r,c,i;
+	cplx *t;
+	hd=getvalue(cc,hd);
+	if (!isreal(hd) && !isqmatrix(hd)) cc_error(cc,"real or fixed point values expected");
+	sig_dims(hd,&r,&c);
+	if (c<1) cc_error(cc,"empty vector");
+	t=rdft_table(cc,c);
+	result=new_cmatrix(cc,r,c/2+1,"");
+	for (i=0; i<r; i++) {
+		real *X=matrixof(result)+(long)2*i*(c/2+1);
+		sig_frame(hd,i,0,c,NULL,X);
+		rdft(cc,X,c,X,t);
+	}
+	return pushresults(cc,result);
+}
+
+static header* irfft (Calc *cc, header *hd, int n)
+{	header *st=hd,*result;
+	int r,c,i;
+	real *m;
+	cplx *t;
+	hd=getvalue(cc,hd);
+	if (!isrealorcplx(hd)) cc_error(cc,"real or complex values expected");
+	if (isreal(hd)) {
+		make_complex(cc,st); hd=getvalue(cc,st);
+	}
+	getmatrix(hd,&r,&c,&m);
+	if (n<0) n=2*(c-1);
+	if (n<1 || n/2+1!=c) cc_error(cc,"n must be 2*(cols-1) or 2*cols-1");
+	t=rdft_table(cc,n);
+	result=new_matrix(cc,r,n,"");
+	for (i=0; i<r; i++) {
+		irdft(cc,m+(long)2*i*c,n,matrixof(result)+(long)i*n,t);
+	}
+	return pushresults(cc,result);
+}
+
+/* irfft: real signal of a half spectrum
+ *   x=irfft(X) | irfft(X,n)
+ *   inverse of rfft for each row of X; n is the signal length, 2*(c-1) by
+ *   default, or 2*c-1 for an odd length.
+ *****/
+header* mirfft (Calc *cc, header *hd)
+{	return irfft(cc,hd,-1);
+}
+
+header* mirfft2 (Calc *cc, header *hd)
+{	header *hd1=next_param(cc,hd);
+	hd1=getvalue(cc,hd1);
+	if (hd1->type!=s_real) cc_error(cc,"real length expected");
+	return irfft(cc,hd,(int)*realof(hd1));
+}
+
+static int spec_frames (Calc *cc, header *hd, int row, int nfft, int hop, real *w, cplx *t, real *f, real *P, int stride)
+/***** spec_frames
+	one-sided power spectra of the frames of nfft samples taken every hop
+	samples on the line row of the signal hd, windowed by w. f is a frame
+	scratch of nfft+2 reals. The spectrum of frame j goes to P+j*stride,
+	or is added to P when stride is 0. The scaling 2*|X[k]|^2/sum(w^2)
+	(not doubled at k=0 and n/2) makes sum(P)/nfft the signal power.
+	Returns the number of frames.
+*****/
+{	int r,c,j,k,nf,nb=nfft/2+1;
+	real u=0.0;
+	sig_dims(hd,&r,&c);
+	nf=(c-nfft)/hop+1;
+	for (k=0; k<nfft; k++) u+=w[k]*w[k];
+	u=(real)1.0/u;
+	for (j=0; j<nf; j++) {
+		real *p=P+(long)j*stride;
+		sig_frame(hd,row,(long)j*hop,nfft,w,f);
+		rdft(cc,f,nfft,f,t);
+		for (k=0; k<nb; k++) {
+			real v=(f[2*k]*f[2*k]+f[2*k+1]*f[2*k+1])*u;
+			if (k && 2*k<nfft) v*=2;
+			if (stride) p[k]=v; else p[k]+=v;
+		}
+	}
+	return nf;
+}
+
+static real* spec_window (Calc *cc, header *hdw, int nfft)
+/* the window given by hdw (a vector of nfft values) or a periodic Hann
+   window pushed on the stack */
+{	real *w;
+	int r,c,k;
+	if (hdw) {
+		if (!isreal(hdw)) cc_error(cc,"real window expected");
+		getmatrix(hdw,&r,&c,&w);
+		if ((r!=1 && c!=1) || r*c!=nfft) cc_error(cc,"the window must have nfft values");
+		return w;
+	}
+	w=matrixof(new_matrix(cc,1,nfft,""));
+	for (k=0; k<nfft; k++) w[k]=0.5-0.5*cos(2*M_PI*k/nfft);
+	return w;
+}
+
+static header* psd (Calc *cc, header *hd, header *hdn, header *hdw)
+{	header *result;
+	int r,c,i,k,nfft,nb,nf;
+	real *w,*f,*P;
+	cplx *t;
+	hd=getvalue(cc,hd); hdn=getvalue(cc,hdn);
+	if (hdw) hdw=getvalue(cc,hdw);
+	if (!isreal(hd) && !isqmatrix(hd)) cc_error(cc,"real or fixed point signal expected");
+	if (hdn->type!=s_real) cc_error(cc,"real nfft expected");
+	sig_dims(hd,&r,&c);
+	nfft=(int)*realof(hdn); nb=nfft/2+1;
+	if (nfft<2) cc_error(cc,"nfft must be at least 2");
+	if (c<nfft) cc_error(cc,"the signal is shorter than nfft");
+	w=spec_window(cc,hdw,nfft);
+	t=rdft_table(cc,nfft);
+	f=matrixof(new_matrix(cc,1,nfft+2,""));
+	result=new_matrix(cc,r,nb,"");
+	P=matrixof(result);
+	memset(P,0,(size_t)r*nb*sizeof(real));
+	for (i=0; i<r; i++) {
+		nf=spec_frames(cc,hd,i,nfft,nfft/2,w,t,f,P+(long)i*nb,0);
+		for (k=0; k<nb; k++) P[(long)i*nb+k]/=nf;
+	}
+	if (cc->nwanted>1) {
+		real *fr=matrixof(new_matrix(cc,1,nb,""));
+		for (k=0; k<nb; k++) fr[k]=(real)k/nfft;
+	}
+	return pushresults(cc,result);
+}
+
+/* psd: power spectral density (Welch method)
+ *   P=psd(x,nfft) | psd(x,nfft,window) | [P,f]=psd(...)
+ *   averages the one-sided spectra of frames of nfft samples with 50%
+ *   overlap, for each row of x (real, Q15 or Q31). The window is a
+ *   periodic Hann window by default. P is scaled so that sum(P)/nfft is
+ *   the mean power of x (divide P by fs for a density per Hz); f gives
+ *   the bin frequencies in cycles per sample (multiply by fs for Hz).
+ *****/
+header* mpsd (Calc *cc, header *hd)
+{	return psd(cc,hd,next_param(cc,hd),NULL);
+}
+
+header* mpsd3 (Calc *cc, header *hd)
+{	header *hdn=next_param(cc,hd);
+	return psd(cc,hd,hdn,next_param(cc,hdn));
+}
+
+/* spectrogram: short time power spectra
+ *   S=spectrogram(x,nfft,hop) | [S,f,t]=spectrogram(x,nfft,hop)
+ *   one line per frame of nfft samples of the row vector x (real, Q15 or
+ *   Q31), frames start every hop samples. Hann window and scaling as for
+ *   psd. f gives the bin frequencies in cycles per sample, t the frame
+ *   centres in samples.
+ *****/
+header* mspectrogram (Calc *cc, header *hd)
+{	header *hdn,*hdh,*result;
+	int r,c,k,nfft,hop,nf;
+	real *w,*f;
+	cplx *t;
+	hdn=next_param(cc,hd); hdh=next_param(cc,hdn);
+	hd=getvalue(cc,hd); hdn=getvalue(cc,hdn); hdh=getvalue(cc,hdh);
+	if (!isreal(hd) && !isqmatrix(hd)) cc_error(cc,"real or fixed point signal expected");
+	if (hdn->type!=s_real || hdh->type!=s_real) cc_error(cc,"real nfft and hop expected");
+	sig_dims(hd,&r,&c);
+	nfft=(int)*realof(hdn); hop=(int)*realof(hdh);
+	if (r!=1) cc_error(cc,"row vector expected");
+	if (nfft<2 || hop<1) cc_error(cc,"nfft must be at least 2, hop at least 1");
+	if (c<nfft) cc_error(cc,"the signal is shorter than nfft");
+	nf=(c-nfft)/hop+1;
+	w=spec_window(cc,NULL,nfft);
+	t=rdft_table(cc,nfft);
+	f=matrixof(new_matrix(cc,1,nfft+2,""));
+	result=new_matrix(cc,nf,nfft/2+1,"");
+	spec_frames(cc,hd,0,nfft,hop,w,t,f,matrixof(result),nfft/2+1);
+	if (cc->nwanted>1) {
+		real *fr=matrixof(new_matrix(cc,1,nfft/2+1,""));
+		for (k=0; k<=nfft/2; k++) fr[k]=(real)k/nfft;
+	}
+	if (cc->nwanted>2) {
+		real *tm=matrixof(new_matrix(cc,nf,1,""));
+		for (k=0; k<nf; k++) tm[k]=(real)k*hop+(real)nfft/2;
+	}
+	return pushresults(cc,result);
+}
+
+/****************************************************************
+ *	SOS biquad cascades (transposed direct form II)
+ ****************************************************************/
+int sos_init (sos_t *f, real *sos, int ns, int q)
+/***** sos_init
+	load a [ns x 6] matrix of sections [b0 b1 b2 a0 a1 a2], normalized by
+	a0. q=15 or q=31 also prepares the fixed point coefficients: each stage
+	gets sh headroom bits so that sum(|b|)+|a1|+|a2| < 2^sh, which bounds
+	the stage state for full scale in- and outputs. Returns 0 or -1 when
+	a section is invalid.
+*****/
+{	int i,k;
+	if (ns<1 || ns>SOS_STAGES_MAX) return -1;
+	f->ns=ns; f->q=q;
+	for (i=0; i<ns; i++, sos+=6) {
+		real a0=sos[3], sum=0.0;
+		if (a0==0.0) return -1;
+		f->c[i][0]=sos[0]/a0; f->c[i][1]=sos[1]/a0; f->c[i][2]=sos[2]/a0;
+		f->c[i][3]=sos[4]/a0; f->c[i][4]=sos[5]/a0;
+		f->sh[i]=0;
+		if (q) {
+			/* headroom, bounded by q-1 < 31; inf or nan coefficients
+			   can't be scaled */
+			for (k=0; k<5; k++) sum+=fabs(f->c[i][k]);
+			if (!isfinite(sum)) return -1;
+			while (f->sh[i]<q-1 && ldexp(1.0,f->sh[i])<=sum) f->sh[i]++;
+			if (f->sh[i]>=q-1) return -1;
+			for (k=0; k<5; k++) {
+				/* in double: floorf would drop the low bits of a q31 value */
+				double v=__builtin_floor((double)f->c[i][k]*ldexp(1.0,q-f->sh[i])+0.5);
+				double lim=(double)(1UL<<(q-1))*2.0-1.0;
+				f->cq[i][k]=(int32_t)(v>lim ? lim : (v<-lim-1.0 ? -lim-1.0 : v));
+			}
+		}
+	}
+	sos_reset(f);
+	return 0;
+}
+
+void sos_reset (sos_t *f)
+{	int i;
+	for (i=0; i<SOS_STAGES_MAX; i++) {
+		f->z[i][0]=f->z[i][1]=0.0;
+		f->zq[i][0]=f->zq[i][1]=0;
+	}
+}
+
+void sos_run (sos_t *f, real *x, real *y, int n, int stride)
+/***** sos_run
+	filter n samples x[0], x[stride], ... into y (may be x), one stage at
+	a time over the whole block so that the coefficients stay in registers.
+*****/
+{	int i,k;
+	for (i=0; i<f->ns; i++) {
+		real b0=f->c[i][0], b1=f->c[i][1], b2=f->c[i][2];
+		real a1=f->c[i][3], a2=f->c[i][4];
+		real z0=f->z[i][0], z1=f->z[i][1];
+		real *src=(i==0) ? x : y, *dst=y;
+		for (k=0; k<n; k++, src+=stride, dst+=stride) {
+			real v=*src, o=b0*v+z0;
+			z0=b1*v-a1*o+z1;
+			z1=b2*v-a2*o;
+			*dst=o;
+		}
+		f->z[i][0]=z0; f->z[i][1]=z1;
+	}
+}
+
+void sos_run_q15 (sos_t *f, int16_t *x, int16_t *y, int n, int stride)
+/***** sos_run_q15
+	Q15 samples, Q(15-sh) coefficients. The state is kept at the product
+	scale Q(30-sh); the headroom rule keeps it within 32 bits.
+*****/
+{	int i,k;
+	for (i=0; i<f->ns; i++) {
+		int32_t b0=f->cq[i][0], b1=f->cq[i][1], b2=f->cq[i][2];
+		int32_t a1=f->cq[i][3], a2=f->cq[i][4];
+		int32_t z0=(int32_t)f->zq[i][0], z1=(int32_t)f->zq[i][1];
+		int s=15-f->sh[i];
+		int16_t *src=(i==0) ? x : y, *dst=y;
+		for (k=0; k<n; k++, src+=stride, dst+=stride) {
+			int32_t v=*src, o=(b0*v+z0+(1L<<(s-1)))>>s;
+			if (o>32767) o=32767; else if (o<-32768) o=-32768;
+			z0=b1*v-a1*o+z1;
+			z1=b2*v-a2*o;
+			*dst=(int16_t)o;
+		}
+		f->zq[i][0]=z0; f->zq[i][1]=z1;
+	}
+}
+
+void sos_run_q31 (sos_t *f, int32_t *x, int32_t *y, int n, int stride)
+/***** sos_run_q31
+	Q31 samples, Q(31-sh) coefficients, 64 bit state at Q(62-sh).
+*****/
+{	int i,k;
+	for (i=0; i<f->ns; i++) {
+		int64_t b0=f->cq[i][0], b1=f->cq[i][1], b2=f->cq[i][2];
+		int64_t a1=f->cq[i][3], a2=f->cq[i][4];
+		int64_t z0=f->zq[i][0], z1=f->zq[i][1];
+		int s=31-f->sh[i];
+		int32_t *src=(i==0) ? x : y, *dst=y;
+		for (k=0; k<n; k++, src+=stride, dst+=stride) {
+			int64_t v=*src, o=(b0*v+z0+((int64_t)1<<(s-1)))>>s;
+			if (o>INT32_MAX) o=INT32_MAX; else if (o<INT32_MIN) o=INT32_MIN;
+			z0=b1*v-a1*o+z1;
+			z1=b2*v-a2*o;
+			*dst=(int32_t)o;
+		}
+		f->zq[i][0]=z0; f->zq[i][1]=z1;
+	}
+}
+
+static header* sosfilt (Calc *cc, header *hd, header *hdz)
+{	header *hdx,*result,*state;
+	int r,c,rx,cx,rz,cz,i;
+	real *m,*mx,*mz;
+	sos_t f;
+	hdx=next_param(cc,hd);
+	hd=getvalue(cc,hd); hdx=getvalue(cc,hdx);
+	if (!isreal(hd) || !isreal(hdx)) cc_error(cc,"real values expected");
+	getmatrix(hd,&r,&c,&m); getmatrix(hdx,&rx,&cx,&mx);
+	if (c!=6) cc_error(cc,"sos must be a [n x 6] matrix");
+	if (rx!=1 && cx!=1) cc_error(cc,"vector expected");
+	if (sos_init(&f,m,r,0)) cc_error(cc,"bad sections (at most %d, a0 non-zero)",SOS_STAGES_MAX);
+	if (hdz) {
+		hdz=getvalue(cc,hdz);
+		if (!isreal(hdz)) cc_error(cc,"real values expected");
+		getmatrix(hdz,&rz,&cz,&mz);
+		if (rz!=r || cz!=2) cc_error(cc,"state must be a [n x 2] matrix");
+		for (i=0; i<r; i++) {
+			f.z[i][0]=mz[2*i]; f.z[i][1]=mz[2*i+1];
+		}
+	}
+	result=new_matrix(cc,rx,cx,"");
+	state=new_matrix(cc,r,2,"");
+	sos_run(&f,mx,matrixof(result),rx*cx,1);
+	mz=matrixof(state);
+	for (i=0; i<r; i++) {
+		mz[2*i]=f.z[i][0]; mz[2*i+1]=f.z[i][1];
+	}
+	return pushresults(cc,result);
+}
+
+/* sosfilt: filter x by a cascade of second order sections
+ *   [y,state]=sosfilt(sos,x[,state])
+ *   sos is [n x 6], one [b0 b1 b2 a0 a1 a2] section per line, state is the
+ *   [n x 2] final state to chain block processing of a long signal.
+ *****/
+header* msosfilt (Calc *cc, header *hd)
+{
+	return sosfilt(cc,hd,next_param(cc,next_param(cc,hd)));
+}
+
+header* msosfilt2 (Calc *cc, header *hd)
+{
+	return sosfilt(cc,hd,NULL);
+}
+
 /* accelerometer */
 header* maccel (Calc *cc, header *hd)
 {
@@ -206,6 +895,7 @@ header* maccel (Calc *cc, header *hd)
 	real *m = matrixof(res);	///creo el puntero m que apunta a esa dirección de memoria
 
 	int32_t data[3]; ///necesito este data pq read_xyz escribe sobre int32_t* y no en real*
+	if (accel_count()) cc_error(cc,"Accelerometer is sampling, use accelread!");
 	status_t st = mma8652_read_xyz(data);
 
 	if (st == kStatus_Success) { //muestro en g y no en mg
@@ -220,6 +910,46 @@ header* maccel (Calc *cc, header *hd)
 	return pushresults(cc, res);
 }
 
+/* accelstart: start continuous sampling
+ *   fs=accelstart(rate,n) sample at the first sensor data rate >= rate
+ *   (1.56 to 800 Hz) by blocks of n samples, returns the effective rate.
+ *   accelstart(0,0) stops the sampling.
+ *****/
+header* maccelstart (Calc *cc, header *hd)
+{
+	header *hd1, *result;
+	real rate;
+	int n;
+	
+	hd1=next_param(cc,hd); hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
+	if (hd->type!=s_real || hd1->type!=s_real) cc_error(cc,"real values expected!");
+	rate=*realof(hd); n=(int)*realof(hd1);
+	if (rate>800.0) cc_error(cc,"rate must be <= 800 Hz!");
+	if (rate>0.0 && (n<1 || n>=512)) cc_error(cc,"block size must be in [1,511]!");
+	rate=accel_start(rate,n);
+	if (rate<0.0) cc_error(cc,"Accelerometer configuration failed");
+	result=new_real(cc,rate,"");
+	return pushresults(cc,result);
+}
+
+/* accelread: get the next block of samples
+ *   {acc,t}=accelread() acc is a nx3 matrix of X, Y, Z values in g,
+ *   t is a nx1 vector of timestamps in seconds.
+ *****/
+header* maccelread (Calc *cc, header *hd)
+{
+	header *result, *hdt;
+	unsigned long lost;
+	int n=accel_count();
+	
+	if (!n) cc_error(cc,"Accelerometer sampling not started!");
+	result=new_matrix(cc,n,3,"");
+	hdt=new_matrix(cc,n,1,"");
+	if (!accel_read(matrixof(result),matrixof(hdt),&lost)) cc_error(cc,"interrupted!");
+	if (lost) cc_warn(cc,"%lu samples lost",lost);
+	return pushresults(cc,result);
+}
+
 header* mpqcos(Calc* cc, header* hd) {
 	return NULL;
 }
@@ -285,6 +1015,8 @@ header* mpcmvol (Calc *cc, header *hd)
 
 /* pcmplay: play samples in [1xn] or [2xn] vector or a file
  *   pcmplay(vector) | pcmplay(filename)
+ *   the vector may be real or Q15/Q31 (q15(x), pcmrec(n,15)), Q15 samples
+ *   go to the CODEC unchanged.
  *****/
 header* mpcmplay (Calc *cc, header *hd)
 {	header *result;
@@ -292,10 +1024,15 @@ header* mpcmplay (Calc *cc, header *hd)
 	int r,c;
 
 	hd=getvalue(cc,hd);
-	if (hd->type!=s_matrix && dimsof(hd)->r<1) cc_error(cc,"[1xn] or [2xn] real matrix expected!");
-	getmatrix(hd,&r,&c,&m);
-
-	result = new_real(cc,(real)pcm_play(m,r,c),"");
+	if ((hd->type!=s_matrix && hd->type!=s_qmatrix) || dimsof(hd)->r<1 || dimsof(hd)->r>2)
+		cc_error(cc,"[1xn] or [2xn] real or fixed point matrix expected!");
+	if (hd->type==s_qmatrix) {
+		r=qdimsof(hd)->r; c=qdimsof(hd)->c;
+		result = new_real(cc,(real)pcm_play(qmatrixof(hd),qdimsof(hd)->q,r,c),"");
+	} else {
+		getmatrix(hd,&r,&c,&m);
+		result = new_real(cc,(real)pcm_play(m,0,r,c),"");
+	}
 
 	return pushresults(cc,result);
 }
@@ -309,7 +1046,26 @@ header* mpcmrec(Calc *cc, header *hd)
 	hd=getvalue(cc,hd);
 	if (hd->type!=s_real) cc_error(cc,"real value expected!");
 	result=new_matrix(cc,2,*realof(hd),"");
-	if (!pcm_rec(matrixof(result),*realof(hd))) cc_error(cc,"PCM Io error!");
+	if (!pcm_rec(matrixof(result),0,*realof(hd))) cc_error(cc,"PCM Io error!");
+
+	return pushresults(cc,result);
+}
+
+/* mpcmrec2: record n samples as Q15 (the CODEC format, 4 bytes per
+ *   stereo sample) or Q31 fixed point data
+ *  [2xn]=pcmrec(n,15) | pcmrec(n,31)
+ *****/
+header* mpcmrec2(Calc *cc, header *hd)
+{
+	header *result, *hd1;
+	int q;
+	hd1=next_param(cc,hd);
+	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
+	if (hd->type!=s_real || hd1->type!=s_real) cc_error(cc,"real value expected!");
+	q=(int)*realof(hd1);
+	if (q!=15 && q!=31) cc_error(cc,"format must be 15 or 31");
+	result=new_qmatrix(cc,2,*realof(hd),q,"");
+	if (!pcm_rec(qmatrixof(result),q,*realof(hd))) cc_error(cc,"PCM Io error!");
 
 	return pushresults(cc,result);
 }
@@ -322,13 +1078,39 @@ header* mpcmloop (Calc *cc, header *hd)
 	return new_real(cc,(real)pcm_loop(NULL),"");
 }
 
+/* pcmloop with a software SOS cascade on both channels
+ *   [n,cycles]=pcmloop(sos)
+ *   cycles is [average worst deadline]: CPU cycles spent filtering each
+ *   block of SAMPLE_NB samples, and the cycles one block lasts.
+ *****/
+header* mpcmloop1 (Calc *cc, header *hd)
+{
+	header *result, *cyc;
+	int r,c,n;
+	real *m;
+	hd=getvalue(cc,hd);
+	if (!isreal(hd)) cc_error(cc,"real values expected");
+	getmatrix(hd,&r,&c,&m);
+	if (c!=6) cc_error(cc,"sos must be a [n x 6] matrix");
+	n=pcm_sos(m,r);
+	if (n<0) cc_error(cc,"bad sections for Q15 (at most %d, a0 non-zero)",SOS_STAGES_MAX);
+	result=new_real(cc,(real)n,"");
+	cyc=new_matrix(cc,1,3,"");
+	pcm_loop_cycles(matrixof(cyc),matrixof(cyc)+1,matrixof(cyc)+2);
+	return pushresults(cc,result);
+}
+
 /********************* filters implementation *******************/
 
-/* pqbiquad(B,A) with B/A lines as SoS */
+/* pcmbiquad: PowerQuad biquad cascade on the live audio (both channels)
+ *   [n,cycles]=pcmbiquad(B,A)
+ *   B and A are [r x 3] matrices, one [b0 b1 b2] / [a0 a1 a2] section per
+ *   line. cycles is [average worst deadline] as for pcmloop(sos).
+ *****/
 header* mpcmbiquad(Calc* cc, header* hd)
 {
-	header *hd1, *result=NULL;
-	int rb, cb, ra, ca;
+	header *hd1, *result=NULL, *cyc;
+	int rb, cb, ra, ca, n;
 	real *mb, *ma;
 	
 	hd1=next_param(cc,hd); hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
@@ -336,11 +1118,49 @@ header* mpcmbiquad(Calc* cc, header* hd)
 	if (!isreal(hd) || !isreal(hd1)) cc_error(cc,"real values expected");
 	
 	getmatrix(hd,&rb,&cb,&mb); getmatrix(hd1,&ra,&ca,&ma);
-	if (ca!=cb || ca!=3 || ra!=rb || ra==0) cc_error(cc,"pqbiquad(B,A) with B and A [nx3] real matrices");
+	if (ca!=cb || ca!=3 || ra!=rb || ra==0) cc_error(cc,"pcmbiquad(B,A) with B and A [nx3] real matrices");
 	
-	result=new_real(cc,0.0,"");
+	n=pcm_biquad(mb,ma,ra);
+	if (n<0) cc_error(cc,"bad sections (at most 12, a0 non-zero)");
+	result=new_real(cc,(real)n,"");
+	cyc=new_matrix(cc,1,3,"");
+	pcm_loop_cycles(matrixof(cyc),matrixof(cyc)+1,matrixof(cyc)+2);
+
+	return pushresults(cc,result);
+}
+
+/* pcmbiquad(B,A,x): run the software model of the PowerQuad path on the
+ *   row vector x, |x|<1. A Q15 or Q31 x gives a result in the same format.
+ *   The model approximates the PowerQuad, it is not bit exact.
+ *****/
+header* mpcmbiquad3(Calc* cc, header* hd)
+{
+	header *hd1, *hdx, *result;
+	int rb, cb, ra, ca, rx, cx;
+	real *mb, *ma, *mx;
+	
+	hd1=next_param(cc,hd); hdx=next_param(cc,hd1);
+	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1); hdx=getvalue(cc,hdx);
+	
+	if (!isreal(hd) || !isreal(hd1) || !(isreal(hdx) || isqmatrix(hdx))) cc_error(cc,"real values expected");
+	
+	getmatrix(hd,&rb,&cb,&mb); getmatrix(hd1,&ra,&ca,&ma);
+	if (ca!=cb || ca!=3 || ra!=rb || ra==0) cc_error(cc,"pcmbiquad(B,A,x) with B and A [nx3] real matrices");
+	if (isqmatrix(hdx)) {
+		int q=qdimsof(hdx)->q;
+		if (qdimsof(hdx)->r!=1) cc_error(cc,"row vector expected");
+		cx=qdimsof(hdx)->c;
+		result=new_qmatrix(cc,1,cx,q,"");
+		if (pcm_biquad_model(mb,ma,ra,qmatrixof(hdx),qmatrixof(result),q,cx))
+			cc_error(cc,"bad sections (at most 12, a0 non-zero)");
+		return pushresults(cc,result);
+	}
+	getmatrix(hdx,&rx,&cx,&mx);
+	if (rx!=1) cc_error(cc,"row vector expected");
 	
-	pcm_biquad(mb,ma,ra,ca,realof(result));
+	result=new_matrix(cc,1,cx,"");
+	if (pcm_biquad_model(mb,ma,ra,mx,matrixof(result),0,cx))
+		cc_error(cc,"bad sections (at most 12, a0 non-zero)");
 
 	return pushresults(cc,result);
 }
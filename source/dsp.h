@@ -1,17 +1,53 @@
 #ifndef DSP_H
 #define DSP_H
 
+#include <stdint.h>
+
 #include "calc.h"
 
 /* filter */
 header* mfilter (Calc *cc, header *hd);
 
+/* convolution */
+void convolve (Calc *cc, real *x, int nx, real *h, int nh, real *y, int off, int ny, int complex);
+header* mconv (Calc *cc, header *hd);
+
+/* SOS biquad cascades, transposed direct form II */
+#define SOS_STAGES_MAX		12
+
+typedef struct {
+	int		ns;							/* number of stages */
+	int		q;							/* 0 (float), 15 or 31 */
+	real	c[SOS_STAGES_MAX][5];		/* b0 b1 b2 a1 a2, normalized by a0 */
+	int32_t	cq[SOS_STAGES_MAX][5];		/* fixed point coefficients, Q(q-sh) */
+	int		sh[SOS_STAGES_MAX];			/* headroom bits of each stage */
+	real	z[SOS_STAGES_MAX][2];		/* float state */
+	int64_t	zq[SOS_STAGES_MAX][2];		/* fixed point state */
+} sos_t;
+
+int  sos_init (sos_t *f, real *sos, int ns, int q);
+void sos_reset (sos_t *f);
+void sos_run (sos_t *f, real *x, real *y, int n, int stride);
+void sos_run_q15 (sos_t *f, int16_t *x, int16_t *y, int n, int stride);
+void sos_run_q31 (sos_t *f, int32_t *x, int32_t *y, int n, int stride);
+
+header* msosfilt (Calc *cc, header *hd);
+header* msosfilt2 (Calc *cc, header *hd);
+
 /* FFT */
 header* mfft (Calc *cc, header *hd);
 header* mifft (Calc *cc, header *hd);
+header* mrfft (Calc *cc, header *hd);
+header* mirfft (Calc *cc, header *hd);
+header* mirfft2 (Calc *cc, header *hd);
+header* mpsd (Calc *cc, header *hd);
+header* mpsd3 (Calc *cc, header *hd);
+header* mspectrogram (Calc *cc, header *hd);
 
 /* accelerometer */
 header* maccel (Calc *cc, header *hd);
+header* maccelstart (Calc *cc, header *hd);
+header* maccelread (Calc *cc, header *hd);
 
 /* power quad */
 header* mpqcos(Calc* cc, header* hd);
@@ -24,9 +60,12 @@ header* mpcmfreq0 (Calc *cc, header *hd);
 header* mpcmfreq (Calc *cc, header *hd);
 header* mpcmplay (Calc *cc, header *hd);
 header* mpcmrec(Calc *cc, header *hd);
+header* mpcmrec2(Calc *cc, header *hd);
 header* mpcmloop (Calc *cc, header *hd);
+header* mpcmloop1 (Calc *cc, header *hd);
 
 /* audio filters */
 header* mpcmbiquad(Calc* cc, header* hd);
+header* mpcmbiquad3(Calc* cc, header* hd);
 
 #endif
@@ -283,6 +283,7 @@ void next_line (Calc *cc)
 	if (CC_ISSET(cc,CC_EXEC_UDF)) {	/* executing a udf */
 		while (*cc->next==0) cc->next++;
 		cc->line=cc->next;
+		if (cc->profile) prof_line(cc);
 		if (cc->trace>0) trace_udfline(cc,cc->next);
 	} else {
 		if (cc->trace==-1) cc->trace=1;		/* ?? */
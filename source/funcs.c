@@ -10,19 +10,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "funcs.h"
 #include "spread.h"
 #include "edit.h"
 #include "sysdep.h"
 #include "solver.h"
+#include "dsp.h"
 #include "fsl_powerquad.h"
 
 
 /**************** inline input handling ****************/
 header* minput (Calc *cc, header *hd)
 {	header *st=hd;
-	jmp_buf *oldenv, env;
+	unwind_t uw;
+	jmp_buf env;
 	unsigned int oldflags;
 	char input[LINEMAX],*oldnext, *oldline;
 	hd=getvalue(cc,hd);
@@ -30,11 +33,12 @@ header* minput (Calc *cc, header *hd)
 
 	output(cc,stringof(hd)); output(cc,"? ");
 	edit(cc,input);
-	oldenv=cc->env;
 	oldflags=cc->flags;
 	oldline=cc->line; oldnext=cc->next;
 	CC_SET(cc,CC_EXEC_STRING);
 	cc->line=cc->next=input;
+	uw.env=cc->env;
+	UNWIND_PUSH(cc,&uw,UW_CATCH);
 	cc->env=&env;
 	switch (setjmp(env)) {
 	case 0:
@@ -43,68 +47,216 @@ header* minput (Calc *cc, header *hd)
 		cc->next=oldnext;
 		cc->line=oldline;
 		cc->flags=oldflags;
-		cc->env=oldenv;
+		cc_leave(cc,&uw);
 		CC_UNSET(cc,CC_EXEC_STRING);
 		return NULL;
 	}
 	parse(cc);
 	cc->next=oldnext;
 	cc->line=oldline;
-	cc->env=oldenv;
+	cc_leave(cc,&uw);
 	CC_UNSET(cc,CC_EXEC_STRING);
 	
 	return cc->result ? moveresult(cc,st,cc->result) : NULL;
 }
 
 /************** light user function (luf) handling **************/
+static void r_pow (real *x, real *y, real *z);
+
+/* functions usable in compiled light user functions */
+static const struct {
+	char	*name;
+	real	(*f)(real);
+} luf_funcs[] = {
+	{"abs",fabs}, {"acos",acos}, {"asin",asin}, {"atan",atan},
+	{"ceil",ceil}, {"cos",cos}, {"erf",erf}, {"erfc",erfc},
+	{"exp",exp}, {"floor",floor}, {"log",log}, {"sin",sin},
+	{"sqrt",sqrt}, {"tan",tan}
+};
+
+char* luf_func_name (int i)
+/* name of the i-th function, NULL past the end */
+{
+	return (i>=0 && i<(int)(sizeof(luf_funcs)/sizeof(luf_funcs[0]))) ? luf_funcs[i].name : NULL;
+}
+
+int luf_func_find (char *name)
+{	int i;
+	for (i=0; i<(int)(sizeof(luf_funcs)/sizeof(luf_funcs[0])); i++) {
+		if (strcmp(name,luf_funcs[i].name)==0) return i;
+	}
+	return -1;
+}
+
+/* compiled programs, keyed by the string contents and the number of
+   arguments. Strings that can't be compiled are cached as well
+   (prog.n==0) so they are not tried again. Longer strings are not
+   compiled. */
+#define LUF_CACHE_SIZE		8
+#define LUF_SRC_MAX			96
+
+typedef struct {
+	char			src[LUF_SRC_MAX];
+	int				len;
+	int				argn;
+	LufProg			prog;
+} LufCache;
+
+static LufCache luf_cache[LUF_CACHE_SIZE];
+static int luf_cache_next=0;
+
+static LufProg* luf_lookup (Calc *cc, header *var, int argn)
+{	char *s=stringof(var);
+	int i, len=strlen(s);
+	LufCache *e;
+	
+	if (len>=LUF_SRC_MAX) return NULL;
+	for (i=0; i<LUF_CACHE_SIZE; i++) {
+		e=&luf_cache[i];
+		if (e->argn==argn && e->len==len && !memcmp(e->src,s,len)) return &e->prog;
+	}
+	e=&luf_cache[luf_cache_next];
+	luf_cache_next=(luf_cache_next+1)%LUF_CACHE_SIZE;
+	memcpy(e->src,s,len+1); e->len=len; e->argn=argn;
+	luf_compile(cc,s,argn,&e->prog);
+	return &e->prog;
+}
+
+static header* luf_global (Calc *cc, char *name)
+/* global variable lookup, as searchvar does from a light user function */
+{	header *hd=(header *)cc->globalstart;
+	int r;
+	if (name[0]=='$') name++;
+	r=xor(name);
+	while ((char *)hd<cc->globalend) {
+		if (r==hd->xor && !strcmp(hd->name,name)) return hd;
+		hd=nextof(hd);
+	}
+	return NULL;
+}
+
+static int luf_matrix (LufProg *p, int *mat)
+/* type of the result for 1x1 operands, mat[k] is set for a matrix
+   operand. As in the interpreter, unary minus and functions keep a 1x1
+   matrix, binary operators give a real. */
+{	int s[LUF_STACK_MAX], t=-1;
+	LufIns *ins=p->code, *end=p->code+p->n;
+	
+	for ( ; ins<end; ins++) {
+		switch (ins->op) {
+		case LOP_CST: s[++t]=0; break;
+		case LOP_ARG: s[++t]=mat[ins->arg]; break;
+		case LOP_VAR: s[++t]=mat[p->nargs+ins->arg]; break;
+		case LOP_FN:
+		case LOP_NEG: break;
+		default: t--; s[t]=0; break;
+		}
+	}
+	return s[0];
+}
+
+static real luf_run (LufProg *p, real *v)
+{	real s[LUF_STACK_MAX], z;
+	LufIns *ins=p->code, *end=p->code+p->n;
+	int t=-1;
+	
+	for ( ; ins<end; ins++) {
+		switch (ins->op) {
+		case LOP_CST: s[++t]=p->cst[ins->arg]; break;
+		case LOP_ARG: s[++t]=v[ins->arg]; break;
+		case LOP_VAR: s[++t]=v[p->nargs+ins->arg]; break;
+		case LOP_FN:  s[t]=luf_funcs[ins->arg].f(s[t]); break;
+		case LOP_ADD: t--; s[t]=s[t]+s[t+1]; break;
+		case LOP_SUB: t--; s[t]=s[t]-s[t+1]; break;
+		case LOP_MUL: t--; s[t]=s[t]*s[t+1]; break;
+		case LOP_DIV: t--; s[t]=s[t]/s[t+1]; break;
+		case LOP_POW: t--; r_pow(&s[t],&s[t+1],&z); s[t]=z; break;
+		case LOP_NEG: s[t]=-s[t]; break;
+		}
+	}
+	return s[0];
+}
+
+/* luf_exec
+ *   evaluate a compiled light user function in one pass over the
+ *   elements of its real arguments (broadcast like map2). Returns NULL
+ *   when the arguments or the globals are not real, so the function is
+ *   interpreted.
+ */
+static header* luf_exec (Calc *cc, LufProg *p, header *args)
+{	header *hd=args, *v, *result;
+	real *m[MAXARGS+LUF_VAR_MAX], *row[MAXARGS+LUF_VAR_MAX], x[MAXARGS+LUF_VAR_MAX], *y;
+	int r[MAXARGS+LUF_VAR_MAX], c[MAXARGS+LUF_VAR_MAX], mat[MAXARGS+LUF_VAR_MAX];
+	int nop=p->nargs+p->nvars, rr=1, cr=1, i, j, k;
+	
+	for (k=0; k<nop; k++) {
+		if (k<p->nargs) {
+			v=hd; hd=nextof(hd);
+		} else if ((v=luf_global(cc,p->var[k-p->nargs]))==NULL) {
+			return NULL;
+		}
+		if (v->type==s_reference && !referenceof(v)) return NULL;
+		v=getvalue(cc,v);
+		if (v->type!=s_real && v->type!=s_matrix) return NULL;
+		mat[k]=(v->type==s_matrix);
+		getmatrix(v,&r[k],&c[k],&m[k]);
+		if (r[k]==0 || c[k]==0) return NULL;
+		if ((rr>1 && r[k]>1 && r[k]!=rr) || (cr>1 && c[k]>1 && c[k]!=cr)) return NULL;
+		if (r[k]>rr) rr=r[k];
+		if (c[k]>cr) cr=c[k];
+	}
+	if (rr==1 && cr==1 && !luf_matrix(p,mat)) {
+		result=new_real(cc,0.0,"");
+		y=realof(result);
+	} else {
+		result=new_matrix(cc,rr,cr,"");
+		y=matrixof(result);
+	}
+	for (i=0; i<rr; i++) {
+		for (k=0; k<nop; k++) row[k] = m[k] + (r[k]>1 ? (LONG)i*c[k] : 0);
+		for (j=0; j<cr; j++) {
+			for (k=0; k<nop; k++) x[k] = row[k][c[k]>1 ? j : 0];
+			*y++=luf_run(p,x);
+		}
+	}
+	return result;
+}
+
 /* interpret_luf
  *   interpret a one line function defined as a string
  *   used as ephemeral functions
  */
 header* interpret_luf (Calc *cc, header *var, header *args, int argn, int epos)
-{	header *st=args, *hd, *oldrunning, *results=(header*)cc->newram;
-	jmp_buf *oldenv, env;
-	unsigned int oldflags;
-	char *oldnext, *oldline, *oldstartlocal, *oldendlocal;
-	int oldargn;
+{	header *st=args, *hd, *results=(header*)cc->newram;
+	unwind_t uw;
 	token_t tok;
 	
 	if (var==cc->running) cc_error(cc,"recursion not allowed in light user functions");
 
-	oldenv=cc->env;
-	oldflags=cc->flags;
-	oldline=cc->line;
-	oldnext=cc->next;
-	oldargn=cc->actargn;
-	oldstartlocal=cc->startlocal;
-	oldendlocal=cc->endlocal;
-	oldrunning=cc->running; 
+	/* compiled version, when there are only positional arguments */
+	if (epos==argn) {
+		LufProg *p=luf_lookup(cc,var,argn);
+		if (p && p->n && (hd=luf_exec(cc,p,args))!=NULL) return moveresult(cc,st,hd);
+	}
+
+	/* save the context of the caller, unwound on error */
+	uw.flags=cc->flags;
+	uw.line=cc->line;
+	uw.next=cc->next;
+	uw.actargn=cc->actargn;
+	uw.startlocal=cc->startlocal;
+	uw.endlocal=cc->endlocal;
+	uw.running=cc->running;
+	uw.var=var;
+	UNWIND_PUSH(cc,&uw,UW_LUF);
 	
 	/* setup the new scope */
-	cc->env=&env;
 	cc->startlocal=(char *)args; cc->endlocal=cc->newram;
 	cc->running=var;
 	cc->actargn=argn;
 	CC_SET(cc,CC_EXEC_STRING|CC_SEARCH_GLOBALS|CC_EXEC_UDF);
 	cc->line=cc->next=stringof(var);
-	cc->env=&env;
 	cc->newram=cc->endlocal;
-
-	switch (setjmp(env)) {
-	case 0:
-		break;
-	default:
-		cc->next=oldnext;
-		cc->line=oldline;
-		cc->flags=oldflags;
-		cc->startlocal=oldstartlocal;
-		cc->endlocal=oldendlocal;
-		cc->running=oldrunning;
-		cc->actargn=oldargn;
-		cc->env=oldenv;
-		outputf(cc,"error in light user function '%s'\n",var->name);
-		longjmp(*cc->env,2);	/* back to enclosing error handler */
-	}
 	
 	hd=args;
 	if (strncmp(cc->next,"@(",2)!=0) {	/* function is just a string: */
@@ -146,14 +298,7 @@ header* interpret_luf (Calc *cc, header *var, header *args, int argn, int epos)
 		moveresult(cc,cc->result,hd);
 	} while (tok==T_COMMA);
 
-	cc->next=oldnext;
-	cc->line=oldline;
-	cc->flags=oldflags;
-	cc->startlocal=oldstartlocal;
-	cc->endlocal=oldendlocal;
-	cc->running=oldrunning;
-	cc->actargn=oldargn;
-	cc->env=oldenv;
+	cc_leave(cc,&uw);
 	
 	return moveresults(cc,st,results);
 }
@@ -206,15 +351,9 @@ header* interpret_udf (Calc *cc, header *var, header *args, int argn, int epos)
 ****/
 {
 	/* saved context */
-	jmp_buf *oldenv;
-	unsigned int oldflags;
-	int oldargn,oldtrace;
-	char *oldnext=cc->next,*oldstartlocal,*oldendlocal,*oldline;
-	real oldepsilon;
+	unwind_t uw;
 	char *oldxstart = cc->xstart, *oldxend=cc->xend;
-	header *oldrunning;
 	/* locals */
-	jmp_buf env;
 	char *p;
 	header *st=args,*hd=args,*hd1;
 	unsigned int arg_bitmap=0;
@@ -336,69 +475,33 @@ header* interpret_udf (Calc *cc, header *var, header *args, int argn, int epos)
 		hd->name[0]=0; hd->xor=0;
 	}
 //	new_real(cc, epos, "epos");
-	/* Save context of the caller */
-	oldenv=cc->env;
-	oldnext=cc->next;
-	oldline=cc->line;
-	oldflags=cc->flags;
-	oldtrace=cc->trace;
-	oldargn=cc->actargn;
-	oldstartlocal=cc->startlocal;
-	oldendlocal=cc->endlocal;
-	oldepsilon=cc->epsilon;
+	/* Save context of the caller, restored by cc_leave() when the
+	   function returns or is unwound on error */
+	uw.next=cc->next;
+	uw.line=cc->line;
+	uw.flags=cc->flags;
+	uw.trace=cc->trace;
+	uw.actargn=cc->actargn;
+	uw.startlocal=cc->startlocal;
+	uw.endlocal=cc->endlocal;
+	uw.epsilon=cc->epsilon;
+	uw.xstart=oldxstart;
+	uw.xend=oldxend;
+	uw.running=cc->running;
+	uw.level=cc->level;
+	uw.var=var;
+	uw.prof=0;
 	CC_UNSET(cc,CC_SEARCH_GLOBALS);	/* by default, allow on searching in local scope */
-	oldrunning=cc->running; 
+	UNWIND_PUSH(cc,&uw,UW_UDF);
 	
 	/* setup the new scope */
-	cc->env=&env;
 	cc->startlocal=(char *)args; cc->endlocal=cc->newram; cc->running=var;
 	cc->actargn=argn;
 	cc->line=cc->next=udfof(var);
 	CC_UNSET(cc,CC_NOSUBMREF|CC_EXEC_RETURN);
 	CC_SET(cc,CC_EXEC_UDF);
-
-	/* set the synchronisation point to deal with errors */
-	switch (setjmp(env)) {
-	case 0:
-		break;
-	case 1:
-		/* restore the calling context and jump to relevant error handler */
-		cc->epsilon=oldepsilon;
-		cc->xstart=oldxstart;
-		cc->xend=oldxend;
-		cc->endlocal=oldendlocal;
-		cc->startlocal=oldstartlocal;
-		cc->running=oldrunning;
-		if (cc->trace>=0) cc->trace=oldtrace;
-		cc->next=oldnext;
-		cc->line=oldline;
-		cc->actargn=oldargn;
-		cc->flags=oldflags;
-		cc->env=oldenv;
-		outputf(cc,"error in function '%s'\n",var->name);
-		longjmp(*cc->env,2);	/* back to enclosing error handler */
-		break;
-	case 2:
-		if (CC_ISSET(cc,CC_VERBOSE)) {output(cc,"  ");type_udfline(cc,cc->line);}
-		/* restore the calling context and jump to relevant error handler */
-		cc->endlocal=oldendlocal;
-		cc->startlocal=oldstartlocal;
-		cc->running=oldrunning;
-		if (cc->trace>=0) cc->trace=oldtrace;
-		cc->epsilon=oldepsilon;
-		cc->xstart=oldxstart;
-		cc->xend=oldxend;
-		cc->next=oldnext;
-		cc->line=oldline;
-		cc->actargn=oldargn;
-		cc->flags=oldflags;
-		cc->env=oldenv;
-		outputf(cc,"error in function '%s'\n",var->name);
-		longjmp(*cc->env,2);	/* back to enclosing error handler */
-		break;
-	}
 	
-	if ((oldtrace=cc->trace)>0) {
+	if (cc->trace>0) {
 		if (cc->trace==2) cc->trace=0;
 		if (cc->trace>0) trace_udfline(cc,cc->next);
 	} else if (var->flags & FLAG_UDFTRACE) {
@@ -408,6 +511,7 @@ header* interpret_udf (Calc *cc, header *var, header *args, int argn, int epos)
 	
 	cc->level++;
 	if (cc->level>UDF_LEVEL_MAX) cc_error(cc,"Deepest UDF call level reached or too many recursions!");
+	if (cc->profile) uw.prof=prof_enter(cc,var);
 	/* interpret the udf code */
 	while (CC_ISSET(cc,CC_EXEC_UDF)) {
 		cmdtyp cmd=parse(cc);
@@ -416,19 +520,8 @@ header* interpret_udf (Calc *cc, header *var, header *args, int argn, int epos)
 		}
 		if (sys_test_key()==escape) cc_error(cc,"User interrupted!");
 	}
-	cc->level--;
 	/* function finished, restore the context of the caller */
-	cc->endlocal=oldendlocal; cc->startlocal=oldstartlocal;
-	cc->running=oldrunning;
-	if (cc->trace>=0) cc->trace=oldtrace;
-	cc->epsilon=oldepsilon;
-	cc->xstart=oldxstart;
-	cc->xend=oldxend;
-	cc->next=oldnext;
-	cc->line=oldline;
-	cc->actargn=oldargn;
-	cc->flags=oldflags;
-	cc->env=oldenv;
+	cc_leave(cc,&uw);
 	
 	if (cc->result) {
 		if (cc->nresults) {		/* multiple results */
@@ -761,49 +854,48 @@ header* msetepsilon (Calc *cc, header *hd)
 /****************************************************************
  *	basic operators
  ****************************************************************/
-static void r_add (real *x, real *y, real *z)
-{	*z=*x+*y;
-}
-
 void c_add (cplx x, cplx y, cplx z)
 {	z[0]=x[0]+y[0];
 	z[1]=x[1]+y[1];
 }
 
+static int32_t q_add (int32_t x, int32_t y, int q)
+{	int64_t z=(int64_t)x+y;
+	return (int32_t)QSAT(z,q);
+}
+
 header* add (Calc *cc, header *hd, header *hd1)
 /***** add
 	add the values.
 *****/
 {	header *result;
-	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
-	result=map2(cc,r_add,c_add,hd,hd1);
+	hd=getrange(cc,hd); hd1=getrange(cc,hd1);
+	if (isqmatrix(hd) || isqmatrix(hd1)) result=qmap2(cc,q_add,hd,hd1);
+	else result=map2(cc,r_add,c_add,hd,hd1);
 	return pushresults(cc,result);
 }
 
-static void r_sub (real *x, real *y, real *z)
-{	*z=*x-*y;
-}
-
 void c_sub (cplx x, cplx y, cplx z)
 {	z[0]=x[0]-y[0];
 	z[1]=x[1]-y[1];
 }
 
+static int32_t q_sub (int32_t x, int32_t y, int q)
+{	int64_t z=(int64_t)x-y;
+	return (int32_t)QSAT(z,q);
+}
+
 header* subtract (Calc *cc, header *hd, header *hd1)
 /***** subtract
 	subtract the values.
 *****/
 {	header *result;
-	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
-	result=map2(cc,r_sub,c_sub,hd,hd1);
+	hd=getrange(cc,hd); hd1=getrange(cc,hd1);
+	if (isqmatrix(hd) || isqmatrix(hd1)) result=qmap2(cc,q_sub,hd,hd1);
+	else result=map2(cc,r_sub,c_sub,hd,hd1);
 	return pushresults(cc,result);
 }
 
-static void r_mul (real *x, real *y, real *z)
-{	*z=*x*(*y);
-}
-
-
 void c_mul (cplx x, cplx y, cplx z)
 {	/* temp var h so that the same var can be used as src and dest operand */
 	real h=x[0]*y[0] - x[1]*y[1];
@@ -811,28 +903,25 @@ void c_mul (cplx x, cplx y, cplx z)
 	z[0]=h;
 }
 
+static int32_t q_mul (int32_t x, int32_t y, int q)
+/* rounded product, only -1*-1 saturates */
+{	int64_t z=((int64_t)x*y+((int64_t)1<<(q-1)))>>q;
+	return (int32_t)QSAT(z,q);
+}
+
 header* dotmultiply (Calc *cc, header *hd, header *hd1)
 /***** dotmultiply
 	multiply the values elementwise.
 *****/
 {	header *result;
-	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
-	result=map2(cc,r_mul,c_mul,hd,hd1);
+	hd=getrange(cc,hd); hd1=getrange(cc,hd1);
+	if (isqmatrix(hd) || isqmatrix(hd1)) result=qmap2(cc,q_mul,hd,hd1);
+	else result=map2(cc,r_mul,c_mul,hd,hd1);
 	return pushresults(cc,result);
 }
 
-static void r_div (real *x, real *y, real *z)
-{	
-	*z=*x/(*y);
-}
-
 void c_div (cplx x, cplx y, cplx z)
-{	/* temp var h so that the same var can be used as src and dest operand */
-	real r,h;
-	r=y[0]*y[0] + y[1]*y[1];
-	h=(x[0]*y[0] + x[1]*y[1])/r;
-	z[1]=(x[1]*y[0] - x[0]*y[1])/r;
-	z[0]=h;
+{	c_smith(x,y,z);
 }
 
 header* dotdivide (Calc *cc, header *hd, header *hd1)
@@ -840,17 +929,11 @@ header* dotdivide (Calc *cc, header *hd, header *hd1)
 	divide the values elementwise.
 *****/
 {	header *result;
-	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
+	hd=getrange(cc,hd); hd1=getrange(cc,hd1);
 	result=map2(cc,r_div,c_div,hd,hd1);
 	return pushresults(cc,result);
 }
 
-/* cumulative sum of products: s += x*y */
-static void c_scalp (cplx x, cplx y, cplx s)
-{	s[0] += x[0]*y[0] - x[1]*y[1];
-	s[1] += x[0]*y[1] + x[1]*y[0];
-}
-
 /* complex number copy: y=x */
 void c_copy (cplx x, cplx y)
 {	y[0]=x[0]; y[1]=x[1];
@@ -900,8 +983,7 @@ header* multiply (Calc *cc, header *hd, header *hd1)
 			   mm1=mat(m1,d->c,i,0); mm2=m2+2*j;
 				x[0]=0.0; x[1]=0.0;
 				for (k=0; k<d->c; k++) {
-					cplx a={*mm1,0.0};
-					c_scalp(a,mm2,x);
+					x[0]+=(*mm1)*mm2[0]; x[1]+=(*mm1)*mm2[1];
 					mm1++; mm2+=2*d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j));
@@ -922,15 +1004,13 @@ header* multiply (Calc *cc, header *hd, header *hd1)
 				mm1=cmat(m1,d->c,i,0); mm2=m2+j;
 				x[0]=0.0; x[1]=0.0;
 				for (k=0; k<d->c; k++) {
-					cplx a={*mm2,0.0};
-					c_scalp(mm1,a,x);
+					x[0]+=mm1[0]*(*mm2); x[1]+=mm1[1]*(*mm2);
 					mm1+=2; mm2+=d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j));
 			}
 		return pushresults(cc,result);
 	} else if (hd->type==s_cmatrix && hd1->type==s_cmatrix) {
-		cplx x;
 		d=dimsof(hd);
 		d1=dimsof(hd1);
 		if (d->c != d1->r) cc_error(cc,"Cannot multiply these!");
@@ -939,16 +1019,11 @@ header* multiply (Calc *cc, header *hd, header *hd1)
 		m=matrixof(result);
 		m1=matrixof(hd);
 		m2=matrixof(hd1);
+		/* row i of the result accumulates m1[i,k]*(row k of m2) */
+		memset(m,0,(size_t)r*c*2*sizeof(real));
 		for (i=0; i<r; i++)
-			for (j=0; j<c; j++) {
-			   mm1=cmat(m1,d->c,i,0); mm2=m2+2*j;
-				x[0]=0.0; x[1]=0.0;
-				for (k=0; k<d->c; k++) {
-					c_scalp(mm1,mm2,x);
-					mm1+=2; mm2+=2*d1->c;
-				}
-				c_copy(x,cmat(m,c,i,j));
-			}
+			for (k=0; k<d->c; k++)
+				cv_axpy(cmat(m1,d->c,i,k),cmat(m2,c,k,0),cmat(m,c,i,0),c);
 		return pushresults(cc,result);
 	}
 	return dotmultiply(cc,st,nextof(st));
@@ -1000,7 +1075,7 @@ header* wmultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					cplx a={*mm1,0.0};
 					if ((*mm2!=0.0 || *(mm2+1)!=0.0) &&
-							(*mm1!=0.0)) c_scalp(a,mm2,x);
+							(*mm1!=0.0)) c_mac(a,mm2,x);
 					mm1++; mm2+=2*d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j));
@@ -1023,7 +1098,7 @@ header* wmultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					cplx a={*mm2,0.0};
 					if ((*mm2!=0.0) && (*mm1!=0.0 || *(mm1+1)!=0.0))
-						c_scalp(mm1,a,x);
+						c_mac(mm1,a,x);
 					mm1+=2; mm2+=d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j));
@@ -1046,7 +1121,7 @@ header* wmultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					if ((*mm2!=0.0 || *(mm2+1)!=0.0) &&
 							(*mm1!=0.0 || *(mm1+1)!=0.0))
-						c_scalp(mm1,mm2,x);
+						c_mac(mm1,mm2,x);
 					mm1+=2; mm2+=2*d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j));
@@ -1103,7 +1178,7 @@ header* smultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					cplx a={*mm1,0.0};
 					if ((*mm2!=0.0 || *(mm2+1)!=0.0) &&
-							(*mm1!=0.0)) c_scalp(a,mm2,x);
+							(*mm1!=0.0)) c_mac(a,mm2,x);
 					mm1++; mm2+=2*d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j)); x[1]=-x[1];
@@ -1127,7 +1202,7 @@ header* smultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					cplx a={*mm2,0.0};
 					if ((*mm2!=0.0) && (*mm1!=0.0 || *(mm1+1)!=0.0))
-						c_scalp(mm1,a,x);
+						c_mac(mm1,a,x);
 					mm1+=2; mm2+=d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j)); x[1]=-x[1];
@@ -1151,7 +1226,7 @@ header* smultiply (Calc *cc, header *hd)
 				for (k=0; k<d->c; k++) {
 					if ((*mm2!=0.0 || *(mm2+1)!=0.0) &&
 							(*mm1!=0.0 || *(mm1+1)!=0.0))
-						c_scalp(mm1,mm2,x);
+						c_mac(mm1,mm2,x);
 					mm1+=2; mm2+=2*d1->c;
 				}
 				c_copy(x,cmat(m,c,i,j)); x[1]=-x[1];
@@ -1176,8 +1251,9 @@ header* opposite (Calc *cc, header *hd)
 	compute -matrix.
 *****/
 {	header *result;
-	hd=getvalue(cc,hd);
-	result=map1(cc,r_opposite,c_opposite,hd);
+	hd=getrange(cc,hd);
+	if (isqmatrix(hd)) result=qmap2(cc,q_sub,new_real(cc,0.0,""),hd);
+	else result=map1(cc,r_opposite,c_opposite,hd);
 	return pushresults(cc,result);
 }
 
@@ -1189,6 +1265,7 @@ void make_complex (Calc *cc, header *hd)
 	int size;
 	int r,c,i,j;
 	real *m,*m1;
+	if (hd->type==s_range) range_expand(cc,hd);
 	hd=getvalue(cc,hd);
 	if (hd->type==s_real) {
 		size=sizeof(header)+2*sizeof(real);
@@ -1437,9 +1514,8 @@ header* transpose (Calc *cc, header *hd)
 }
 
 header* vectorize (Calc *cc, header *init, header *step, header *end)
-{	real vinit,vstep,vend,*m;
+{	real vinit,vstep,vend;
 	int count;
-	header *result;
 	init=getvalue(cc,init); step=getvalue(cc,step); end=getvalue(cc,end);
 	if (init->type!=s_real || step->type!=s_real || end->type!=s_real)
 		cc_error(cc,"The ':' allows only real arguments!");
@@ -1450,14 +1526,9 @@ header* vectorize (Calc *cc, header *init, header *step, header *end)
 	count=1+(int)(floor(fabs(vend-vinit)/fabs(vstep)*(1+cc->epsilon)));
 	if ((vend>vinit && vstep<0) || (vend<vinit && vstep>0))
 		count=0;
-	result=new_matrix(cc,1,count,"");
-	m=matrixof(result);
-	while (count>0) {
-		*m++=vinit;
-		vinit+=vstep;
-		count--;
-	}
-	return pushresults(cc,result);
+	/* the vector is only generated when a consumer needs it, see
+	   range_expand() */
+	return pushresults(cc,new_range(cc,vinit,vstep,count));
 }
 
 header* msolve (Calc *cc, header *hd, header *hd1)
@@ -1496,11 +1567,6 @@ header* msolve (Calc *cc, header *hd, header *hd1)
 /****************************************************************
  *	compare operators
  ****************************************************************/
-static void rgreater (real *x, real *y, real *z)
-{	if (*x>*y) *z=1.0;
-	else *z=0.0;
-}
-
 header* mgreater (Calc *cc, header *hd, header *hd1)
 {	
 	header *result=NULL;
@@ -1514,11 +1580,6 @@ header* mgreater (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void rless (real *x, real *y, real *z)
-{	if (*x<*y) *z=1.0;
-	else *z=0.0;
-}
-
 header* mless (Calc *cc, header *hd, header *hd1)
 {
 	header *result=NULL;
@@ -1532,11 +1593,6 @@ header* mless (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void rgreatereq (real *x, real *y, real *z)
-{	if (*x>=*y) *z=1.0;
-	else *z=0.0;
-}
-
 header* mgreatereq (Calc *cc, header *hd, header *hd1)
 {
 	header *result=NULL;
@@ -1550,11 +1606,6 @@ header* mgreatereq (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void rlesseq (real *x, real *y, real *z)
-{	if (*x<=*y) *z=1.0;
-	else *z=0.0;
-}
-
 header* mlesseq (Calc *cc, header *hd, header *hd1)
 {
 	header *result=NULL;
@@ -1568,11 +1619,6 @@ header* mlesseq (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void requal (real *x, real *y, real *z)
-{
-	*z = (*x==*y) ? 1.0 : 0.0;
-}
-
 static void cequal (cplx x, cplx y, real *z)
 {
 	*z = (x[0]==y[0] && x[1]==y[1]) ? 1.0 : 0.0;
@@ -1605,11 +1651,6 @@ header* mequal (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void runequal (real *x, real *y, real *z)
-{	if (*x!=*y) *z=1.0;
-	else *z=0.0;
-}
-
 static void cunequal (cplx x, cplx y, real *z)
 {
 	*z = (x[0]!=y[0] || x[1]!=y[1]) ? 1.0 : 0.0;
@@ -1685,11 +1726,6 @@ header* mnot (Calc *cc, header *hd)
 	return pushresults(cc,result);
 }
 
-static void r_or (real *x, real *y, real *z)
-{	if (*x!=0.0 || *y!=0.0) *z=1.0;
-	else *z=0.0;
-}
-
 header* mor (Calc *cc, header *hd, header *hd1)
 {
 	header *result;
@@ -1705,11 +1741,6 @@ header* mor (Calc *cc, header *hd, header *hd1)
 	return pushresults(cc,result);
 }
 
-static void r_and (real *x, real *y, real *z)
-{	if (*x!=0.0 && *y!=0.0) *z=1.0;
-	else *z=0.0;
-}
-
 header* mand (Calc *cc, header *hd, header *hd1)
 {
 	header *result;
@@ -1772,7 +1803,29 @@ static void c_realpart (cplx x, real *z)
 }
 
 header* mre (Calc *cc, header *hd)
-{	return spread1r(cc,ident,c_realpart,hd);
+{	header *st=hd;
+	hd=getvalue(cc,hd);
+	if (isqmatrix(hd)) return moveresult(cc,st,qconvert(cc,hd,0));
+	return spread1r(cc,ident,c_realpart,st);
+}
+
+header* mq15 (Calc *cc, header *hd)
+/***** q15
+	convert to a Q15 fixed point matrix (16 bit samples in [-1,1[),
+	rounding and saturating. re(q) converts back to real values.
+*****/
+{	header *st=hd;
+	hd=getvalue(cc,hd);
+	return moveresult(cc,st,qconvert(cc,hd,15));
+}
+
+header* mq31 (Calc *cc, header *hd)
+/***** q31
+	convert to a Q31 fixed point matrix (32 bit samples in [-1,1[).
+*****/
+{	header *st=hd;
+	hd=getvalue(cc,hd);
+	return moveresult(cc,st,qconvert(cc,hd,31));
 }
 
 static real zero (real x)
@@ -1798,15 +1851,33 @@ static void c_arg (cplx x, real *z)
 }
 
 header* marg (Calc *cc, header *hd)
-{	return spread1r(cc,rarg,c_arg,hd);
+{	header *st=hd,*result;
+	hd=getvalue(cc,hd);
+	if (hd->type==s_cmatrix) {
+		result=new_matrix(cc,dimsof(hd)->r,dimsof(hd)->c,"");
+		cv_arg(matrixof(hd),matrixof(result),(long)dimsof(hd)->r*dimsof(hd)->c);
+		return moveresult(cc,st,result);
+	}
+	return spread1r(cc,rarg,c_arg,st);
 }
 
 static void c_abs (cplx x, real *z)
-{	*z=sqrt(x[0]*x[0] + x[1]*x[1]);
+/* hypot: squaring overflows for |x|>1.8e19 in single precision */
+{	*z=hypot(x[0],x[1]);
 }
 
 header* mabs (Calc *cc, header *hd)
-{	return spread1r(cc,fabs,c_abs,hd);
+{	header *st=hd,*result;
+	hd=getvalue(cc,hd);
+	if (hd->type==s_cmatrix) {
+		long i,n=(long)dimsof(hd)->r*dimsof(hd)->c;
+		real *m,*a=matrixof(hd);
+		result=new_matrix(cc,dimsof(hd)->r,dimsof(hd)->c,"");
+		m=matrixof(result);
+		for (i=0; i<n; i++, a+=2) m[i]=hypot(a[0],a[1]);
+		return moveresult(cc,st,result);
+	}
+	return spread1r(cc,fabs,c_abs,st);
 }
 
 /****************************************************************
@@ -2555,10 +2626,53 @@ header* mredim (Calc *cc, header *hd)
 	return pushresults(cc,result);
 }
 
+#define SUM_BLOCK		32		/* pairwise summation: blocks summed directly */
+
+static real sum_pairwise (real *m, long n, int stride)
+/***** sum_pairwise
+	sum of the n values m[0], m[stride], ... by recursive halving down to
+	blocks of SUM_BLOCK values, so that the rounding error grows with
+	log(n) instead of n. Blocks use 4 partial sums.
+*****/
+{	real s0,s1,s2,s3;
+	long i,h;
+	if (n>SUM_BLOCK) {
+		h=n/2;
+		return sum_pairwise(m,h,stride)+sum_pairwise(m+h*stride,n-h,stride);
+	}
+	s0=s1=s2=s3=0.0;
+	for (i=0; i+3<n; i+=4, m+=4*stride) {
+		s0+=m[0]; s1+=m[stride]; s2+=m[2*stride]; s3+=m[3*stride];
+	}
+	for (; i<n; i++, m+=stride) s0+=*m;
+	return (s0+s1)+(s2+s3);
+}
+
+static void sum_rows (Calc *cc, real *m, int r, int n, real *mr)
+/***** sum_rows
+	mr[k]=sum of the column k of the r x n matrix m, rows streamed in
+	memory order. Each column keeps a Kahan compensation in a scratch
+	row above cc->newram.
+*****/
+{	real *e=(real *)cc->newram, y, t;
+	int i,k;
+	if ((char *)(e+n)>cc->udfstart) cc_error(cc,"Memory overflow!");
+	for (k=0; k<n; k++) { mr[k]=0.0; e[k]=0.0; }
+	for (i=0; i<r; i++) {
+		for (k=0; k<n; k++) {
+			y=m[k]-e[k];
+			t=mr[k]+y;
+			e[k]=(t-mr[k])-y;
+			mr[k]=t;
+		}
+		m+=n;
+	}
+}
+
 header* msum (Calc *cc, header *hd)
 {	header *result=NULL;
-	int c,r,i,j;
-	real *m,*mr,s,si;
+	int c,r,i;
+	real *m,*mr;
 	hd=getvalue(cc,hd);
 	if (hd->type==s_real || hd->type==s_matrix) {
 		getmatrix(hd,&r,&c,&m);
@@ -2566,9 +2680,8 @@ header* msum (Calc *cc, header *hd)
 		result=new_matrix(cc,r,1,"");
 		mr=matrixof(result);
 		for (i=0; i<r; i++) {
-			s=0.0;
-			for (j=0; j<c; j++) s+=*m++;
-			*mr++=s;
+			*mr++=sum_pairwise(m,c,1);
+			m+=c;
 		}
 	} else if (hd->type==s_complex || hd->type==s_cmatrix) {
 		getmatrix(hd,&r,&c,&m);
@@ -2576,9 +2689,9 @@ header* msum (Calc *cc, header *hd)
 		result=new_cmatrix(cc,r,1,"");
 		mr=matrixof(result);
 		for (i=0; i<r; i++)  {
-			s=0.0; si=0.0;
-			for (j=0; j<c; j++) { s+=*m++; si+=*m++; }
-			*mr++=s; *mr++=si;
+			*mr++=sum_pairwise(m,c,2);
+			*mr++=sum_pairwise(m+1,c,2);
+			m+=2*c;
 		}
 	} else cc_error(cc,"real or complex value or matrix expected");
 	return pushresults(cc,result);
@@ -2587,27 +2700,18 @@ header* msum (Calc *cc, header *hd)
 header* mcolsum (Calc *cc, header *hd)
 {
 	header *result=NULL;
-	int c,r,i,j;
-	real *m,*mr,*p,s,si;
+	int c,r;
+	real *m;
 	hd=getvalue(cc,hd);
 	if (hd->type==s_real || hd->type==s_matrix) {
 		getmatrix(hd,&r,&c,&m);
 		result=new_matrix(cc,1,c,"");
-		mr=matrixof(result);
-		for (i=0; i<c; i++) {
-			s=0.0; p=m+i;
-			for (j=0; j<r; j++) {s+=*p;p+=c;}
-			*mr++=s;
-		}
+		sum_rows(cc,m,r,c,matrixof(result));
 	} else if (hd->type==s_complex || hd->type==s_cmatrix) {
 		getmatrix(hd,&r,&c,&m);
 		result=new_cmatrix(cc,1,c,"");
-		mr=matrixof(result);
-		for (i=0; i<c; i++)  {
-			s=0.0; si=0.0; p=m+2*i;
-			for (j=0; j<r; j++) { s+=*p; si+=*(p+1); p+=2*c;}
-			*mr++=s; *mr++=si;
-		}
+		/* re and im parts are independent columns */
+		sum_rows(cc,m,r,2*c,matrixof(result));
 	} else cc_error(cc,"real or complex value or matrix expected");
 	
 	return pushresults(cc,result);
@@ -2647,36 +2751,45 @@ header* mprod (Calc *cc, header *hd)
 	return pushresults(cc,result);
 }
 
+static void cumsum_row (real *m, int n, int sz, real *mr)
+/* running sums of the n values of sz reals (1 real, 2 complex) in a
+   single Kahan compensated pass */
+{	real s[2]={0.0,0.0}, e[2]={0.0,0.0}, y, t;
+	int j,k;
+	for (j=0; j<n; j++)
+		for (k=0; k<sz; k++) {
+			y=*m++-e[k];
+			t=s[k]+y;
+			e[k]=(t-s[k])-y;
+			s[k]=t;
+			*mr++=t;
+		}
+}
+
 header* mcumsum (Calc *cc, header *hd)
 {	header *result=NULL;
-	real *m,*mr,sum=0,sumr=0,sumi=0;
-	int r,c,i,j;
+	real *m,*mr;
+	int r,c,i;
 	hd=getvalue(cc,hd);
 	if (hd->type==s_real || hd->type==s_matrix) {
 		getmatrix(hd,&r,&c,&m);
 		if (c<1) result=new_matrix(cc,r,1,"");
 		else result=new_matrix(cc,r,c,"");
 		mr=matrixof(result);
-		for (i=0; i<r; i++) {
-			if (c>=1) sum=*m++;
-			*mr++=sum;
-			for (j=1; j<c; j++) {
-				sum+=*m++;
-				*mr++=sum;
-			}
+		if (c<1) { for (i=0; i<r; i++) mr[i]=0.0; }
+		else for (i=0; i<r; i++) {
+			cumsum_row(m,c,1,mr);
+			m+=c; mr+=c;
 		}
 	} else if (hd->type==s_complex || hd->type==s_cmatrix) {
 		getmatrix(hd,&r,&c,&m);
 		if (c<1) result=new_cmatrix(cc,r,1,"");
 		else result=new_cmatrix(cc,r,c,"");
 		mr=matrixof(result);
-		for (i=0; i<r; i++) {
-			if (c>=1) { sumr=*m++; sumi=*m++; }
-			*mr++=sumr; *mr++=sumi;
-			for (j=1; j<c; j++) {
-				sumr+=*m++; *mr++=sumr;
-				sumi+=*m++; *mr++=sumi;
-			}
+		if (c<1) { for (i=0; i<2*r; i++) mr[i]=0.0; }
+		else for (i=0; i<r; i++) {
+			cumsum_row(m,c,2,mr);
+			m+=2*c; mr+=2*c;
 		}
 	}
 	else cc_error(cc,"bad type");
@@ -2800,40 +2913,254 @@ header* mmin (Calc *cc, header *hd)
 {	return spread2(cc,r_min,0,hd);
 }
 
-typedef struct { real val; int ind; } sorttyp;
+/* sort engine: introsort on the values for short vectors, stable LSD radix
+ * sort on the IEEE bit pattern, 8 bits per pass, for long ones. Passes
+ * where all keys share the same digit are skipped.
+ */
+#ifdef FLOAT32
+typedef uint32_t sortkey;
+#define SORT_RADIX_MIN		192
+#else
+typedef uint64_t sortkey;
+#define SORT_RADIX_MIN		1024
+#endif
+#define SORT_KEY_BITS		(8*(int)sizeof(sortkey))
+#define SORT_SIGN			((sortkey)1<<(SORT_KEY_BITS-1))
+#define SORT_SMALL			16
+
+/* order preserving map of a real to an unsigned key */
+static sortkey sort_key (real x)
+{	sortkey u;
+	memcpy(&u,&x,sizeof(u));
+	return (u&SORT_SIGN) ? ~u : u|SORT_SIGN;
+}
+
+static real sort_val (sortkey u)
+{	real x;
+	u=(u&SORT_SIGN) ? u&~SORT_SIGN : ~u;
+	memcpy(&x,&u,sizeof(x));
+	return x;
+}
+
+static void sort_radix (sortkey *k, sortkey *kt, int *ix, int *ixt, int n, int *cnt)
+/***** sort_radix
+	stable sort of the keys k[0..n-1], carrying ix along when not NULL.
+	kt/ixt are scratch arrays of the same size, cnt 256*sizeof(sortkey)
+	counters. The sorted data ends up in k and ix.
+*****/
+{	int d,i,nd=(int)sizeof(sortkey);
+	sortkey *ks=k, *kd=kt, *tk;
+	int *is=ix, *id=ixt, *ti;
+	memset(cnt,0,256*nd*sizeof(int));
+	for (i=0; i<n; i++) {
+		sortkey u=k[i];
+		for (d=0; d<nd; d++, u>>=8) cnt[256*d+(u&0xFF)]++;
+	}
+	for (d=0; d<nd; d++) {
+		int *c=cnt+256*d, s=0, t, sh=8*d;
+		if (c[(k[0]>>sh)&0xFF]==n) continue;	/* single digit value */
+		for (i=0; i<256; i++) { t=c[i]; c[i]=s; s+=t; }
+		if (is) {
+			for (i=0; i<n; i++) {
+				int j=c[(ks[i]>>sh)&0xFF]++;
+				kd[j]=ks[i]; id[j]=is[i];
+			}
+			ti=is; is=id; id=ti;
+		} else {
+			for (i=0; i<n; i++) kd[c[(ks[i]>>sh)&0xFF]++]=ks[i];
+		}
+		tk=ks; ks=kd; kd=tk;
+	}
+	if (ks!=k) {
+		memcpy(k,ks,n*sizeof(sortkey));
+		if (ix) memcpy(ix,is,n*sizeof(int));
+	}
+}
+
+#define SORT_SWAP(i,j) { real t_=v[i]; v[i]=v[j]; v[j]=t_; \
+	if (ix) { int u_=ix[i]; ix[i]=ix[j]; ix[j]=u_; } }
+
+static void sort_insertion (real *v, int *ix, int lo, int hi)
+{	int i,j;
+	for (i=lo+1; i<=hi; i++) {
+		real x=v[i];
+		int u=ix ? ix[i] : 0;
+		for (j=i-1; j>=lo && v[j]>x; j--) {
+			v[j+1]=v[j];
+			if (ix) ix[j+1]=ix[j];
+		}
+		v[j+1]=x;
+		if (ix) ix[j+1]=u;
+	}
+}
 
-static int sorttyp_compare (const sorttyp *x, const sorttyp *y)
-{	if (x->val>y->val) return 1;
-	else if (x->val==y->val) return 0;
-	else return -1;
+static void sort_sift (real *v, int *ix, int lo, int i, int n)
+{	int c;
+	while ((c=2*i+1)<n) {
+		if (c+1<n && v[lo+c+1]>v[lo+c]) c++;
+		if (!(v[lo+c]>v[lo+i])) break;
+		SORT_SWAP(lo+i,lo+c);
+		i=c;
+	}
+}
+
+static void sort_intro (real *v, int *ix, int lo, int hi, int depth)
+/***** sort_intro
+	quicksort with median of 3 pivots, heapsort when the recursion gets
+	too deep, insertion sort for the short runs.
+*****/
+{	while (hi-lo>SORT_SMALL) {
+		int i,j,mid=lo+(hi-lo)/2;
+		real p;
+		if (depth--==0) {
+			int n=hi-lo+1;
+			for (i=n/2-1; i>=0; i--) sort_sift(v,ix,lo,i,n);
+			for (i=n-1; i>0; i--) {
+				SORT_SWAP(lo,lo+i);
+				sort_sift(v,ix,lo,0,i);
+			}
+			return;
+		}
+		if (v[mid]<v[lo]) SORT_SWAP(mid,lo);
+		if (v[hi]<v[lo]) SORT_SWAP(hi,lo);
+		if (v[hi]<v[mid]) SORT_SWAP(hi,mid);
+		p=v[mid];
+		i=lo; j=hi;
+		for (;;) {
+			do i++; while (i<hi && v[i]<p);
+			do j--; while (j>lo && p<v[j]);
+			if (i>=j) break;
+			SORT_SWAP(i,j);
+		}
+		/* recurse on the shorter part, loop on the longer one */
+		if (j-lo<hi-j) {
+			sort_intro(v,ix,lo,j,depth);
+			lo=j+1;
+		} else {
+			sort_intro(v,ix,j+1,hi,depth);
+			hi=j;
+		}
+	}
+	sort_insertion(v,ix,lo,hi);
+}
+
+static void sort_values (Calc *cc, real *v, int *ix, int n)
+/***** sort_values
+	sort v[0..n-1] ascending in place, permuting ix along if not NULL.
+	Scratch space is taken above cc->newram.
+*****/
+{	if (n<SORT_RADIX_MIN) {
+		int depth=0, k;
+		for (k=n; k>1; k>>=1) depth+=2;
+		sort_intro(v,ix,0,n-1,depth);
+	} else {
+		ULONG size=(ULONG)2*n*sizeof(sortkey)+(ix ? (ULONG)n*sizeof(int) : 0)
+			+256*sizeof(sortkey)*sizeof(int);
+		sortkey *k=(sortkey*)cc->newram, *kt=k+n;
+		int *ixt=(int*)(kt+n), *cnt=ixt+(ix ? n : 0);
+		int i;
+		if (cc->newram+size>cc->udfstart) cc_error(cc,"Out of memory!");
+		for (i=0; i<n; i++) k[i]=sort_key(v[i]);
+		sort_radix(k,kt,ix,ix ? ixt : NULL,n,cnt);
+		for (i=0; i<n; i++) v[i]=sort_val(k[i]);
+	}
 }
 
 header* msort (Calc *cc, header *hd)
-{	header *result=NULL,*result1;
-	real *m,*m1;
-	sorttyp *t;
-	int r,c,i;
+/***** sort
+	[v,i]=sort(x) sorts the vector x; i, the permutation, is only built
+	when it is assigned.
+*****/
+{	header *result=NULL,*result1=NULL;
+	real *m,*mr;
+	int r,c,i,n,*ix=NULL;
 	hd=getvalue(cc,hd);
 	if (hd->type!=s_real && hd->type!=s_matrix) cc_error(cc,"real value or matrix expected");
 	getmatrix(hd,&r,&c,&m);
-	if (c==1 || r==1) result=new_matrix(cc,r,c,"");
-	else cc_error(cc,"row or colum vector expected");
-	result1=new_matrix(cc,r,c,"");
-	if (c==1) c=r;
-	if (c==0) cc_error(cc,"can't sort a 0-sized vector");
-	if (cc->newram+c*sizeof(sorttyp)>cc->udfstart) cc_error(cc,"Out of memory!");
-	t=(sorttyp *)cc->newram;
-	for (i=0; i<c; i++) {
-		t->val=*m++; t->ind=i; t++;
+	if (c!=1 && r!=1) cc_error(cc,"row or colum vector expected");
+	n=r*c;
+	if (n==0) cc_error(cc,"can't sort a 0-sized vector");
+	result=new_matrix(cc,r,c,"");
+	mr=matrixof(result);
+	memcpy(mr,m,n*sizeof(real));
+	if (cc->nwanted>1) {
+		result1=new_matrix(cc,r,c,"");
+		if (cc->newram+n*sizeof(int)>cc->udfstart) cc_error(cc,"Out of memory!");
+		ix=(int*)cc->newram;
+		for (i=0; i<n; i++) ix[i]=i;
+		cc->newram+=n*sizeof(int);
+		sort_values(cc,mr,ix,n);
+		cc->newram-=n*sizeof(int);
+		m=matrixof(result1);
+		for (i=0; i<n; i++) m[i]=(real)(ix[i]+1);
+	} else {
+		sort_values(cc,mr,NULL,n);
 	}
-	qsort(cc->newram,c,sizeof(sorttyp),
-		(int (*) (const void *, const void *))sorttyp_compare);
-	m=matrixof(result); m1=matrixof(result1);
-	t=(sorttyp *)cc->newram;
-	for (i=0; i<c; i++) {
-		*m++=t->val; *m1++=t->ind+1; t++;
+	return pushresults(cc,result);
+}
+
+static header* sortrows (Calc *cc, header *hd, header *hdc)
+{	header *result,*result1=NULL;
+	real *m,*mc=NULL,*mr;
+	int r,c,rc=1,cc1=0,i,j,k,*ix,*ixt,*cnt;
+	sortkey *key,*kt;
+	ULONG size;
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_real && hd->type!=s_matrix) cc_error(cc,"real matrix expected");
+	getmatrix(hd,&r,&c,&m);
+	if (hdc) {
+		hdc=getvalue(cc,hdc);
+		if (hdc->type!=s_real && hdc->type!=s_matrix) cc_error(cc,"real vector of columns expected");
+		getmatrix(hdc,&rc,&cc1,&mc);
+		if (rc!=1 && cc1!=1) cc_error(cc,"real vector of columns expected");
+		cc1*=rc;
+		for (k=0; k<cc1; k++) {
+			int col=(int)fabs(mc[k]);
+			if (col<1 || col>c) cc_error(cc,"column index out of range");
+		}
+	} else cc1=c;
+	result=new_matrix(cc,r,c,"");
+	if (cc->nwanted>1) result1=new_matrix(cc,r,1,"");
+	if (r==0 || c==0) return pushresults(cc,result);
+	size=(ULONG)2*r*sizeof(sortkey)+(ULONG)2*r*sizeof(int)+256*sizeof(sortkey)*sizeof(int);
+	if (cc->newram+size>cc->udfstart) cc_error(cc,"Out of memory!");
+	key=(sortkey*)cc->newram; kt=key+r;
+	ix=(int*)(kt+r); ixt=ix+r; cnt=ixt+r;
+	for (i=0; i<r; i++) ix[i]=i;
+	/* LSD over the key columns: a stable sort per column, last one first;
+	   a negative column sorts descending */
+	for (k=cc1-1; k>=0; k--) {
+		int col=hdc ? (int)fabs(mc[k])-1 : k;
+		int desc=hdc && mc[k]<0;
+		for (i=0; i<r; i++) {
+			sortkey u=sort_key(*mat(m,c,ix[i],col));
+			key[i]=desc ? ~u : u;
+		}
+		sort_radix(key,kt,ix,ixt,r,cnt);
+	}
+	mr=matrixof(result);
+	for (i=0; i<r; i++)
+		for (j=0; j<c; j++) *mat(mr,c,i,j)=*mat(m,c,ix[i],j);
+	if (result1) {
+		mr=matrixof(result1);
+		for (i=0; i<r; i++) mr[i]=(real)(ix[i]+1);
 	}
-	return pushresults(cc,result); /* result and result1 */
+	return pushresults(cc,result);
+}
+
+/* sortrows: sort the lines of a matrix
+ *   [B,i]=sortrows(A[,cols])
+ *   cols lists the key columns, most significant first; -k sorts column k
+ *   in descending order. Equal keys keep their order.
+ *****/
+header* msortrows (Calc *cc, header *hd)
+{
+	return sortrows(cc,hd,next_param(cc,hd));
+}
+
+header* msortrows1 (Calc *cc, header *hd)
+{
+	return sortrows(cc,hd,NULL);
 }
 
 header* mstatistics (Calc *cc, header *hd)
@@ -3020,9 +3347,8 @@ header* mpolyadd (Calc *cc, header *hd)
 
 header* mpolymult (Calc *cc, header *hd)
 {	header *hd1,*result;
-	int flag,c,c1,c2,i,r1,r2,j,k;
-	real *m1,*m2,*mr,x;
-	cplx *mc1,*mc2,*mcr,xc,hc;
+	int flag,c,c1,c2,r1,r2;
+	real *m1,*m2;
 	hd1=next_param(cc,hd);
 	flag=testparams(cc,&hd,&hd1);
 	getmatrix(hd,&r1,&c1,&m1);
@@ -3031,31 +3357,9 @@ header* mpolymult (Calc *cc, header *hd)
 	
 	if ((ULONG)c1+c2-1>INT_MAX) cc_error(cc,"can't handle those large vectors");
 	c=c1+c2-1;
-	if (flag) {
-		mc1=(cplx*)m1; mc2=(cplx*)m2;
-		result=new_cmatrix(cc,1,c,"");
-		mcr=(cplx*)matrixof(result);
-		c_copy(*mc1,xc); mc1++;
-		for (i=0; i<c2; i++) c_mul(xc,mc2[i],mcr[i]);
-		for (j=1; j<c1; j++) {
-			c_copy(*mc1,xc); mc1++;
-			for (k=j,i=0; i<c2-1; i++,k++) {
-				c_mul(xc,mc2[i],hc);
-				c_add(hc,mcr[k],mcr[k]);
-			}
-			c_mul(xc,mc2[i],mcr[k]);
-		}
-	} else {
-		result=new_matrix(cc,1,c,"");
-		mr=matrixof(result);
-		x=*m1++;
-		for (i=0; i<c2; i++) mr[i]=x*m2[i];
-		for (j=1; j<c1; j++) {
-			x=*m1++;
-			for (k=j,i=0; i<c2-1; i++,k++) mr[k]+=x*m2[i];
-			mr[k]=x*m2[i];
-		}
-	}
+	if (flag) result=new_cmatrix(cc,1,c,"");
+	else result=new_matrix(cc,1,c,"");
+	convolve(cc,m1,c1,m2,c2,matrixof(result),0,c,flag);
 	return pushresults(cc,result);
 }
 
@@ -3888,72 +4192,149 @@ header* mlogbin (Calc *cc, header *hd)
 /****************************************************************
  *	random and statistics
  ****************************************************************/
-#define IM1 2147483563
-#define IM2 2147483399
-#define AM (1.0/IM1)
-#define IMM1 (IM1-1)
-#define IA1 40014
-#define IA2 40692
-#define IQ1 53668
-#define IQ2 52774
-#define IR1 12211
-#define IR2 3791
-#define NTAB 32
-#define NDIV (1+IMM1/NTAB)
-#define RNMX (1.0-EPS)
-
-static long randseed=1234512345;
-#define IDUM2 123456789
-static long idum2=IDUM2;
-static long iy=0;
-static long iv[NTAB];
-
-static real ran2 (void)
-{
-	int j;
+/* Philox4x32-10 counter based generator (Salmon et al., SC11): a block of
+ * four 32 bit words is a pure function of a 128 bit counter and the key,
+ * so any part of a matrix can be filled on its own, in any order, with
+ * the same result. Word g of the stream is lane g&3 of block g>>2.
+ * rng_pos counts the words handed out since the last seed(); the counter
+ * tags keep uniform words, normal fast path words and normal retries apart.
+ */
+#define PHILOX_M0		0xD2511F53U
+#define PHILOX_M1		0xCD9E8D57U
+#define PHILOX_W0		0x9E3779B9U
+#define PHILOX_W1		0xBB67AE85U
+
+#define RNG_UNIFORM		0		/* counter tags */
+#define RNG_NORMAL		1
+#define RNG_RETRY		2
+
+static uint32_t rng_key[2]={0x6C078965U,0x2545F491U};
+static uint64_t rng_pos=0;
+
+static void philox (uint32_t c[4], uint64_t ctr, uint32_t a, uint32_t tag)
+{	uint32_t k0=rng_key[0], k1=rng_key[1];
+	uint32_t c0=(uint32_t)ctr, c1=(uint32_t)(ctr>>32), c2=a, c3=tag;
+	int r;
+	for (r=0; r<10; r++) {
+		uint64_t p0=(uint64_t)PHILOX_M0*c0, p1=(uint64_t)PHILOX_M1*c2;
+		c0=(uint32_t)(p1>>32)^c1^k0; c1=(uint32_t)p1;
+		c2=(uint32_t)(p0>>32)^c3^k1; c3=(uint32_t)p0;
+		k0+=PHILOX_W0; k1+=PHILOX_W1;
+	}
+	c[0]=c0; c[1]=c1; c[2]=c2; c[3]=c3;
+}
+
+/* uniform in ]0,1[ from a 32 bit word */
+#ifdef FLOAT32
+#define RNG_UNI(w)		(((real)((w)>>9)+0.5f)*(1.0f/8388608.0f))
+#else
+#define RNG_UNI(w)		(((real)(w)+0.5)*(1.0/4294967296.0))
+#endif
+
+/* Ziggurat (Marsaglia and Tsang, 2000), 128 layers */
+#define ZIG_R			3.442619855899
+static uint32_t zig_k[128];
+static real zig_w[128], zig_f[128];
+static int zig_ready=0;
+
+static void zig_init (void)
+{	real dn=ZIG_R, tn=dn, vn=9.91256303526217e-3, q, m1=2147483648.0;
+	int i;
+	q=vn/exp(-0.5*dn*dn);
+	zig_k[0]=(uint32_t)((dn/q)*m1); zig_k[1]=0;
+	zig_w[0]=q/m1; zig_w[127]=dn/m1;
+	zig_f[0]=1.0; zig_f[127]=exp(-0.5*dn*dn);
+	for (i=126; i>=1; i--) {
+		dn=sqrt(-2.0*log(vn/dn+exp(-0.5*dn*dn)));
+		zig_k[i+1]=(uint32_t)((dn/tn)*m1);
+		tn=dn;
+		zig_f[i]=exp(-0.5*dn*dn);
+		zig_w[i]=dn/m1;
+	}
+	zig_ready=1;
+}
+
+static real zig_slow (int32_t hz, uint64_t g)
+/***** zig_slow
+	rejection part of the ziggurat for word g (about 1.5% of the draws);
+	each retry takes its words from block (g, attempt).
+*****/
+{	uint32_t c[4], a=1;
+	int iz=hz&127;
+	for (;;) {
+		real x=hz*zig_w[iz];
+		philox(c,g,a++,RNG_RETRY);
+		if (iz==0) {
+			/* tail beyond ZIG_R */
+			real y;
+			x=-log(RNG_UNI(c[0]))*(real)(1.0/ZIG_R);
+			y=-log(RNG_UNI(c[1]));
+			if (y+y>=x*x) return (hz>0) ? (real)ZIG_R+x : -(real)ZIG_R-x;
+			continue;
+		}
+		if (zig_f[iz]+RNG_UNI(c[0])*(zig_f[iz-1]-zig_f[iz])<exp(-0.5*x*x)) return x;
+		hz=(int32_t)c[1]; iz=hz&127;
+		if ((hz<0 ? -(uint32_t)hz : (uint32_t)hz)<zig_k[iz]) return hz*zig_w[iz];
+	}
+}
+
+static void uniform_fill (real *m, long n, uint64_t g)
+/* m[k]=word g+k of the stream, as a uniform value */
+{	uint32_t c[4];
 	long k;
-	real temp;
-
-	if (randseed <= 0) {
-		if (-(randseed) < 1) randseed=1;
-		else randseed = -(randseed);
-		idum2=(randseed);
-		for (j=NTAB+7;j>=0;j--) {
-			k=(randseed)/IQ1;
-			randseed=IA1*(randseed-k*IQ1)-k*IR1;
-			if (randseed < 0) randseed += IM1;
-			if (j < NTAB) iv[j] = randseed;
-		}
-		iy=iv[0];
-	}
-	k=(randseed)/IQ1;
-	randseed=IA1*(randseed-k*IQ1)-k*IR1;
-	if (randseed < 0) randseed += IM1;
-	k=idum2/IQ2;
-	idum2=IA2*(idum2-k*IQ2)-k*IR2;
-	if (idum2 < 0) idum2 += IM2;
-	j=iy/NDIV;
-	iy=iv[j]-idum2;
-	iv[j] = randseed;
-	if (iy < 1) iy += IMM1;
-	if ((temp=AM*iy) > RNMX) return RNMX;
-	else return temp;
+	for (k=0; k<n; k++, g++) {
+		if (!k || !(g&3)) philox(c,g>>2,0,RNG_UNIFORM);
+		m[k]=RNG_UNI(c[g&3]);
+	}
+}
+
+static void normal_fill (real *m, long n, uint64_t g)
+/* m[k]=normal value from word g+k of the stream */
+{	uint32_t c[4];
+	long k;
+	for (k=0; k<n; k++, g++) {
+		int32_t hz;
+		int iz;
+		if (!k || !(g&3)) philox(c,g>>2,0,RNG_NORMAL);
+		hz=(int32_t)c[g&3]; iz=hz&127;
+		if ((hz<0 ? -(uint32_t)hz : (uint32_t)hz)<zig_k[iz]) m[k]=hz*zig_w[iz];
+		else m[k]=zig_slow(hz,g);
+	}
+}
+
+static uint32_t rng_word (void)
+{	uint32_t c[4];
+	uint64_t g=rng_pos++;
+	philox(c,g>>2,0,RNG_UNIFORM);
+	return c[g&3];
 }
 
 header* mseed (Calc *cc, header *hd)
+/***** seed
+	seed(x) restarts the generator with a key derived from the bits of x.
+*****/
 {   header *result;
+	uint32_t h[2]={0,0};
 	hd=getvalue(cc,hd);
 	if (hd->type!=s_real) cc_error(cc,"real value expected!");
 	result=new_real(cc,*realof(hd),"");
-	randseed=-labs((long)(*realof(hd)*LONG_MAX));
+	memcpy(h,realof(hd),sizeof(real));
+	/* murmur3 finalizer on each key word */
+	for (int i=0; i<2; i++) {
+		uint32_t x=h[i]^(0x9E3779B9U*(i+1));
+		x^=x>>16; x*=0x85EBCA6BU; x^=x>>13; x*=0xC2B2AE35U; x^=x>>16;
+		rng_key[i]=x;
+	}
+	rng_pos=0;
 	return pushresults(cc,result);
 }
 
-header* mrandom (Calc *cc, header *hd)
+static header* rng_matrix (Calc *cc, header *hd,
+	void fill (real *, long, uint64_t), char *usage)
 {	header *result;
-	real row, col, *m;
+	real row, col;
 	int r=0,c=0;
-	long k,n;
+	long n;
 	hd=getvalue(cc,hd);
 	if (hd->type==s_matrix && dimsof(hd)->r==1 && dimsof(hd)->c==2) {
 		row=*matrixof(hd); col=*(matrixof(hd)+1);
@@ -3962,55 +4343,23 @@ header* mrandom (Calc *cc, header *hd)
 	} else if (hd->type==s_real) {
 		col=*realof(hd);
 		r=1; c=(col>-1.0 && col<(real)INT_MAX) ? (int)col : 0;
-	} else cc_error(cc,"random([n,m]) or random(m)");
-//	if (r<1 || c<0) cc_error(cc,"positive integer value or [r,c] vector expected!");
+	} else cc_error(cc,usage);
 	result=new_matrix(cc,r,c,"");
-	m=matrixof(result);
 	n=(long)c*r;
-	for (k=0; k<n; k++) *m++=(real)ran2();
-	return pushresults(cc,result);
-}
-
-static real gasdev (void)
-{	static int iset=0;
-	static real gset;
-	real fac,rsq,v1,v2;
-	if  (iset == 0) {
-		do {
-			v1=2.0*ran2()-1.0;
-			v2=2.0*ran2()-1.0;
-			rsq=v1*v1+v2*v2;
-		} while (rsq >= 1.0 || rsq == 0.0);
-		fac=sqrt(-2.0*log(rsq)/rsq);
-		gset=v1*fac;
-		iset=1;
-		return v2*fac;
-	} else {
-		iset=0;
-		return gset;
-	}
+	fill(matrixof(result),n,rng_pos);
+	rng_pos+=n;
+	return pushresults(cc,result);
+}
+
+header* mrandom (Calc *cc, header *hd)
+{
+	return rng_matrix(cc,hd,uniform_fill,"random([n,m]) or random(m)");
 }
 
 header* mnormal (Calc *cc, header *hd)
-{	header *result;
-	real row, col, *m;
-	int r=0, c=0;
-	long k,n;
-	hd=getvalue(cc,hd);
-	if (hd->type==s_matrix && dimsof(hd)->r==1 && dimsof(hd)->c==2) {
-		row=*matrixof(hd); col=*(matrixof(hd)+1);
-		r=(row>-1.0 && row<(real)INT_MAX) ? (int)row : 0;
-		c=(col>-1.0 && col<(real)INT_MAX) ? (int)col : 0;
-	} else if (hd->type==s_real) {
-		col=*realof(hd);
-		r=1; c=(col>-1.0 && col<(real)INT_MAX) ? (int)col : 0;
-	} else cc_error(cc,"normal([n,m]) or normal(m)");
-//	if (r<1 || c<0) cc_error(cc,"positive integer value or [r,c] vector expected!");
-	result=new_matrix(cc,r,c,"");
-	m=matrixof(result);
-	n=(long)c*r;
-	for (k=0; k<n; k++) *m++=(real)gasdev();
-	return pushresults(cc,result);
+{
+	if (!zig_ready) zig_init();
+	return rng_matrix(cc,hd,normal_fill,"normal([n,m]) or normal(m)");
 }
 
 header* mshuffle (Calc *cc, header *hd)
@@ -4026,7 +4375,8 @@ header* mshuffle (Calc *cc, header *hd)
 	for (i=0; i<n; i++) *mr++=*m++;
 	mr=matrixof(result);
 	for (i=n-1; i>0; i--) {
-		j=(int)floor(ran2()*(i+1));
+		/* j=floor(w*(i+1)/2^32), bias below (i+1)/2^32 */
+		j=(int)(((uint64_t)rng_word()*(uint32_t)(i+1))>>32);
 		if (i!=j) {
 			x=*(mr+i); *(mr+i)=*(mr+j); *(mr+j)=x;
 		}
@@ -4034,10 +4384,288 @@ header* mshuffle (Calc *cc, header *hd)
 	return pushresults(cc,result);
 }
 
+/* streaming statistics: one pass, no temporaries. Blocks of STAT_BLOCK
+ * samples are summed around their first value, then merged into the
+ * running count/mean/M2 with Chan's update, so that the inner loop has
+ * no division and the result is as stable as Welford's.
+ */
+#define STAT_BLOCK		64
+
+typedef struct {
+	real n, mean, m2, min, max;
+} stat_acc;
+
+static void stat_init (stat_acc *a)
+{	a->n=a->mean=a->m2=0.0;
+	a->min=INFINITY; a->max=-INFINITY;
+}
+
+static void stat_add (stat_acc *a, real *x, int n)
+/***** stat_add
+	the blocks are merged relative to K, the running mean (or the first
+	sample), so that the rounding of the mean does not build up.
+*****/
+{	int i,k,nb;
+	real K, r=0.0, cnt=a->n, m2=a->m2;
+	real lo=a->min, hi=a->max;
+	if (n<=0) return;
+	K=(a->n>0.0) ? a->mean : x[0];
+	for (i=0; i<n; i+=nb) {
+		real k0=x[i], s=0.0, s2=0.0, mb, m2b, d, nn;
+		nb=(n-i<STAT_BLOCK) ? n-i : STAT_BLOCK;
+		for (k=i; k<i+nb; k++) {
+			real v=x[k], t=v-k0;
+			s+=t; s2+=t*t;
+			if (v<lo) lo=v;
+			if (v>hi) hi=v;
+		}
+		mb=(k0-K)+s/nb;
+		m2b=s2-s*s/nb;
+		if (m2b<0.0) m2b=0.0;
+		nn=cnt+nb;
+		d=mb-r;
+		r+=d*nb/nn;
+		m2+=m2b+d*d*cnt*nb/nn;
+		cnt=nn;
+	}
+	a->n=cnt; a->mean=K+r; a->m2=m2;
+	a->min=lo; a->max=hi;
+}
+
+static real stat_var (stat_acc *a)
+{	return (a->n>1.0) ? a->m2/(a->n-1.0) : 0.0;
+}
+
+#define STAT_MEAN		0
+#define STAT_VAR		1
+#define STAT_STD		2
+#define STAT_MINMAX		3
+
+static header* stat_rows (Calc *cc, header *hd, int what)
+/***** stat_rows
+	statistics of each row of a matrix, or of a whole vector.
+*****/
+{	header *result;
+	real *m,*mr;
+	int r,c,i;
+	stat_acc a;
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_real && hd->type!=s_matrix) cc_error(cc,"real value or matrix expected");
+	getmatrix(hd,&r,&c,&m);
+	if (r==1 || c==1) { c=r*c; r=1; }
+	if (c==0) cc_error(cc,"no data");
+	result=new_matrix(cc,r,what==STAT_MINMAX ? 2 : 1,"");
+	mr=matrixof(result);
+	for (i=0; i<r; i++, m+=c) {
+		stat_init(&a);
+		stat_add(&a,m,c);
+		switch (what) {
+		case STAT_MEAN: *mr++=a.mean; break;
+		case STAT_VAR: *mr++=stat_var(&a); break;
+		case STAT_STD: *mr++=sqrt(stat_var(&a)); break;
+		default: *mr++=a.min; *mr++=a.max; break;
+		}
+	}
+	return pushresults(cc,result);
+}
+
+/* mean, var, std, minmax of each row of a matrix or of a vector; var and
+ * std are normalized by n-1, minmax gives [min max].
+ *****/
+header* mmean (Calc *cc, header *hd)
+{	return stat_rows(cc,hd,STAT_MEAN);
+}
+
+header* mvar (Calc *cc, header *hd)
+{	return stat_rows(cc,hd,STAT_VAR);
+}
+
+header* mstd (Calc *cc, header *hd)
+{	return stat_rows(cc,hd,STAT_STD);
+}
+
+header* mminmax (Calc *cc, header *hd)
+{	return stat_rows(cc,hd,STAT_MINMAX);
+}
+
+static header* statacc (Calc *cc, header *hd, header *hda)
+{	header *result;
+	real *m,*ma=NULL,*mr;
+	int r,c,ra,ca,i;
+	stat_acc a;
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_real && hd->type!=s_matrix) cc_error(cc,"real value or matrix expected");
+	getmatrix(hd,&r,&c,&m);
+	if (r==1 || c==1) { c=r*c; r=1; }
+	if (hda) {
+		hda=getvalue(cc,hda);
+		if (hda->type!=s_real && hda->type!=s_matrix) cc_error(cc,"accumulator expected");
+		getmatrix(hda,&ra,&ca,&ma);
+		if (ra!=r || ca!=5) cc_error(cc,"accumulator must be [n x 5], one line per data line");
+	}
+	result=new_matrix(cc,r,5,"");
+	mr=matrixof(result);
+	for (i=0; i<r; i++, m+=c) {
+		if (ma) {
+			a.n=ma[0]; a.mean=ma[1];
+			a.m2=(ma[0]>1.0) ? ma[2]*(ma[0]-1.0) : 0.0;
+			a.min=ma[3]; a.max=ma[4];
+			ma+=5;
+		} else stat_init(&a);
+		stat_add(&a,m,c);
+		*mr++=a.n; *mr++=a.mean; *mr++=stat_var(&a); *mr++=a.min; *mr++=a.max;
+	}
+	return pushresults(cc,result);
+}
+
+/* statacc: resumable accumulator
+ *   acc=statacc(x[,acc])
+ *   acc has one line [n mean var min max] per line of x (a vector is one
+ *   line), and can be fed the next block of a stream.
+ *****/
+header* mstatacc (Calc *cc, header *hd)
+{	return statacc(cc,hd,next_param(cc,hd));
+}
+
+header* mstatacc1 (Calc *cc, header *hd)
+{	return statacc(cc,hd,NULL);
+}
+
+/* P^2 quantile estimator (Jain and Chlamtac, 1985): 5 markers per
+ * quantile, state [count q0..q4 n0..n4]. Up to 5 samples, the q's hold
+ * the sorted samples and the quantile is interpolated between them. The
+ * markers start on these samples, and from the 6th one, the middle
+ * markers move toward their desired ranks 1+(n-1)p/2, 1+(n-1)p and
+ * 1+(n-1)(1+p)/2.
+ */
+#define P2_SIZE			11
+
+static void p2_add (real *st, real p, real x)
+{	real *q=st+1, *np=st+6, cnt=st[0];
+	int i,k;
+	if (cnt<5.0) {
+		for (i=(int)cnt; i>0 && q[i-1]>x; i--) q[i]=q[i-1];
+		q[i]=x;
+		st[0]=cnt+1.0;
+		for (i=0; i<5; i++) np[i]=i+1;
+		return;
+	}
+	if (x<q[0]) { q[0]=x; k=0; }
+	else if (x>=q[4]) { q[4]=x; k=3; }
+	else for (k=0; k<3 && x>=q[k+1]; k++) ;
+	for (i=k+1; i<5; i++) np[i]+=1.0;
+	cnt+=1.0; st[0]=cnt;
+	for (i=1; i<4; i++) {
+		real dn=(i==1) ? p/2 : (i==2) ? p : (1.0+p)/2;
+		real d=1.0+(cnt-1.0)*dn-np[i];
+		if ((d>=1.0 && np[i+1]-np[i]>1.0) || (d<=-1.0 && np[i-1]-np[i]<-1.0)) {
+			int s=(d>0.0) ? 1 : -1;
+			real qp=q[i]+s/(np[i+1]-np[i-1])*
+				((np[i]-np[i-1]+s)*(q[i+1]-q[i])/(np[i+1]-np[i])
+				+(np[i+1]-np[i]-s)*(q[i]-q[i-1])/(np[i]-np[i-1]));
+			if (q[i-1]<qp && qp<q[i+1]) q[i]=qp;
+			else q[i]+=s*(q[i+s]-q[i])/(np[i+s]-np[i]);
+			np[i]+=s;
+		}
+	}
+}
+
+static real p2_get (real *st, real p)
+{	int n=(int)st[0], i;
+	real h;
+	if (n>5) return st[3];
+	if (n==0) return NAN;
+	h=p*(n-1); i=(int)h;
+	return (i+1<n) ? st[1+i]+(h-i)*(st[2+i]-st[1+i]) : st[1+i];
+}
+
+static header* quantile (Calc *cc, header *hd, header *hds)
+{	header *hdp,*result,*state=NULL;
+	real *m,*mp,*ms=NULL,*mr,*st;
+	int r,c,rp,cp,np,rs,cs,i,j,k;
+	hdp=next_param(cc,hd);
+	hd=getvalue(cc,hd); hdp=getvalue(cc,hdp);
+	if ((hd->type!=s_real && hd->type!=s_matrix) ||
+		(hdp->type!=s_real && hdp->type!=s_matrix)) cc_error(cc,"real values expected");
+	getmatrix(hd,&r,&c,&m); getmatrix(hdp,&rp,&cp,&mp);
+	if (r==1 || c==1) { c=r*c; r=1; }
+	np=rp*cp;
+	if (np<1) cc_error(cc,"no quantile asked");
+	for (j=0; j<np; j++) if (!(mp[j]>0.0 && mp[j]<1.0)) cc_error(cc,"quantiles must be in ]0,1[");
+	if (hds) {
+		hds=getvalue(cc,hds);
+		if (hds->type!=s_matrix) cc_error(cc,"quantile state expected");
+		getmatrix(hds,&rs,&cs,&ms);
+		if (rs!=r || cs!=np*P2_SIZE) cc_error(cc,"quantile state does not fit the data");
+	}
+	result=new_matrix(cc,r,np,"");
+	if (hds || cc->nwanted>1) {
+		state=new_matrix(cc,r,np*P2_SIZE,"");
+		st=matrixof(state);
+	} else {
+		if (cc->newram+np*P2_SIZE*sizeof(real)>cc->udfstart) cc_error(cc,"Out of memory!");
+		st=(real*)cc->newram;
+	}
+	mr=matrixof(result);
+	for (i=0; i<r; i++, m+=c) {
+		for (j=0; j<np; j++) {
+			real *s=st+(state ? i*np*P2_SIZE : 0)+j*P2_SIZE;
+			if (ms) memcpy(s,ms+(i*np+j)*P2_SIZE,P2_SIZE*sizeof(real));
+			else memset(s,0,P2_SIZE*sizeof(real));
+			for (k=0; k<c; k++) p2_add(s,mp[j],m[k]);
+			*mr++=p2_get(s,mp[j]);
+		}
+	}
+	return pushresults(cc,result);
+}
+
+/* quantile: approximate quantiles in one pass (P^2)
+ *   q=quantile(x,p)
+ *   [q,state]=quantile(x,p[,state])
+ *   p is a vector of probabilities in ]0,1[, one column of q each; rows
+ *   of x are processed separately. state resumes the estimation on the
+ *   next block of a stream.
+ *****/
+header* mquantile (Calc *cc, header *hd)
+{	return quantile(cc,hd,NULL);
+}
+
+header* mquantile3 (Calc *cc, header *hd)
+{	return quantile(cc,hd,next_param(cc,next_param(cc,hd)));
+}
+
+/* interval lookup engine for find() and histc(): number of elements of the
+ * nondecreasing vector e[0..ne-1] that are <= q. Binary search per query,
+ * or a forward walk from the previous position (merge) when the queries
+ * come sorted too.
+ */
+static int lookup (real *e, int ne, real q, int *pos, int merge)
+{	int lo, hi;
+	if (merge) {
+		lo=*pos;
+		while (lo<ne && e[lo]<=q) lo++;
+		*pos=lo;
+		return lo;
+	}
+	lo=0; hi=ne;
+	while (lo<hi) {
+		int mid=lo+(hi-lo)/2;
+		if (e[mid]<=q) lo=mid+1;
+		else hi=mid;
+	}
+	return lo;
+}
+
+static int is_sorted (real *m, int n)
+{	int i;
+	for (i=1; i<n; i++) if (!(m[i-1]<=m[i])) return 0;
+	return 1;
+}
+
 header* mfind (Calc *cc, header *hd)
 {	header *hd1,*result;
 	real *m,*m1,*mr;
-	int i,j,k,c,r,c1,r1;
+	int i,k,c,r,c1,r1,n,pos=0,merge,sorted;
 	hd1=next_param(cc,hd);
 	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
 	if ((hd->type!=s_matrix && hd->type!=s_real) || 
@@ -4048,13 +4676,49 @@ header* mfind (Calc *cc, header *hd)
 	if (r!=1) c=r;
 	result=new_matrix(cc,c1,r1,"");
 	mr=matrixof(result);
-	for (i=0; i<r1; i++) {
-		for (j=0; j<c1; j++) {
+	n=c1*r1;
+	sorted=is_sorted(m,c);
+	merge=sorted && is_sorted(m1,n);
+	for (i=0; i<n; i++) {
+		if (sorted) k=lookup(m,c,m1[i],&pos,merge);
+		else {
+			/* not sorted: keep the first element > m1[i] */
 			k=0;
-			while (k<c && m[k]<=*m1) k++;
-			if (k==c && *m1<=m[c-1]) k=c-1;
-			*mr++=k; m1++;
+			while (k<c && m[k]<=m1[i]) k++;
 		}
+		if (k==c && m1[i]<=m[c-1]) k=c-1;
+		mr[i]=k;
+	}
+	return pushresults(cc,result);
+}
+
+/* histc: count the elements of x in the intervals given by edges
+ *   n=histc(x,edges)
+ *   n[k] counts edges[k]<=x<edges[k+1], the last bin counts x==edges[n].
+ *****/
+header* mhistc (Calc *cc, header *hd)
+{	header *hd1,*result;
+	real *m,*me,*mr;
+	int i,k,r,c,re,ce,n,ne,pos=0,merge;
+	hd1=next_param(cc,hd);
+	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1);
+	if ((hd->type!=s_matrix && hd->type!=s_real) || 
+	    (hd1->type!=s_matrix && hd1->type!=s_real)) cc_error(cc,"real matrices expected!");
+	getmatrix(hd,&r,&c,&m);
+	getmatrix(hd1,&re,&ce,&me);
+	if (re!=1 && ce!=1) cc_error(cc,"edges: real vector expected!");
+	n=r*c; ne=re*ce;
+	if (ne<1) cc_error(cc,"edges must not be empty");
+	if (!is_sorted(me,ne)) cc_error(cc,"edges must be sorted");
+	result=new_matrix(cc,re,ce,"");
+	mr=matrixof(result);
+	for (i=0; i<ne; i++) mr[i]=0.0;
+	merge=is_sorted(m,n);
+	for (i=0; i<n; i++) {
+		k=lookup(me,ne,m[i],&pos,merge);
+		if (k==0) continue;
+		if (k<ne) mr[k-1]+=1.0;
+		else if (m[i]==me[ne-1]) mr[ne-1]+=1.0;
 	}
 	return pushresults(cc,result);
 }
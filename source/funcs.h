@@ -16,6 +16,36 @@ header* minput (Calc *cc, header *hd);
 /* light user functions */
 header* interpret_luf (Calc *cc, header *var, header *hd, int argn, int epos);
 
+/* compiled light user functions: postfix program */
+#define LUF_CODE_MAX		48		/* instructions */
+#define LUF_CST_MAX			16		/* constants */
+#define LUF_VAR_MAX			4		/* global variables */
+#define LUF_STACK_MAX		16		/* evaluation stack depth */
+
+typedef enum {
+	LOP_CST, LOP_ARG, LOP_VAR, LOP_FN,
+	LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_POW, LOP_NEG
+} lufop_t;
+
+typedef struct {
+	unsigned char	op;				/* lufop_t */
+	unsigned char	arg;			/* constant, parameter, variable or function index */
+} LufIns;
+
+typedef struct {
+	int				n;				/* program length, 0 if not compiled */
+	int				nargs;			/* formal parameters */
+	int				ncst;			/* constants */
+	int				nvars;			/* global variables */
+	LufIns			code[LUF_CODE_MAX];
+	real			cst[LUF_CST_MAX];
+	char			var[LUF_VAR_MAX][LABEL_LEN_MAX+1];
+} LufProg;
+
+int luf_compile (Calc *cc, char *s, int argn, LufProg *p);
+int luf_func_find (char *name);
+char* luf_func_name (int i);
+
 /* user defined functions */
 void make_xors (void);
 header* interpret_udf (Calc *cc, header *var, header *args, int argn, int epos);
@@ -44,6 +74,78 @@ void c_div (cplx x, cplx y, cplx z);
 void c_copy (cplx x, cplx y);
 void make_complex (Calc *cc, header *hd);
 
+/* inline complex kernels on interleaved re/im arrays, n values each.
+   The destination may be one of the sources. */
+static inline void c_mac (const real *x, const real *y, real *s)
+/* s+=x*y */
+{	s[0]+=x[0]*y[0]-x[1]*y[1];
+	s[1]+=x[0]*y[1]+x[1]*y[0];
+}
+
+static inline void c_smith (const real *x, const real *y, real *z)
+/* z=x/y with Smith's algorithm: y is scaled by its larger part, which
+   avoids the overflow of |y|^2, and 1/d is shared by both parts */
+{	real r,d,h;
+	if (fabs(y[0])>=fabs(y[1])) {
+		if (y[0]==0.0) {
+			/* y=0: infinities, as x/0 for reals */
+			z[0]=x[0]/y[0]; z[1]=x[1]/y[0];
+			return;
+		}
+		r=y[1]/y[0]; d=1/(y[0]+y[1]*r);
+		h=(x[0]+x[1]*r)*d;
+		z[1]=(x[1]-x[0]*r)*d;
+	} else {
+		r=y[0]/y[1]; d=1/(y[0]*r+y[1]);
+		h=(x[0]*r+x[1])*d;
+		z[1]=(x[1]*r-x[0])*d;
+	}
+	z[0]=h;
+}
+
+static inline void cv_mul (const real *a, const real *b, real *z, long n)
+/* z=a.*b */
+{	long i;
+	for (i=0; i<n; i++, a+=2, b+=2, z+=2) {
+		real re=a[0]*b[0]-a[1]*b[1];
+		z[1]=a[0]*b[1]+a[1]*b[0];
+		z[0]=re;
+	}
+}
+
+static inline void cv_div (const real *a, const real *b, real *z, long n)
+/* z=a./b */
+{	long i;
+	for (i=0; i<n; i++, a+=2, b+=2, z+=2) c_smith(a,b,z);
+}
+
+static inline void cv_axpy (const real *a, const real *x, real *y, long n)
+/* y+=a*x, a scalar */
+{	real ar=a[0], ai=a[1];
+	long i;
+	for (i=0; i<n; i++, x+=2, y+=2) {
+		y[0]+=ar*x[0]-ai*x[1];
+		y[1]+=ar*x[1]+ai*x[0];
+	}
+}
+
+static inline void cv_dot (const real *x, long sx, const real *y, long sy, long n, real *s)
+/* s=sum x[i*sx]*y[i*sy], strides in complex values */
+{	real sr=0.0, si=0.0;
+	long i;
+	for (i=0; i<n; i++, x+=2*sx, y+=2*sy) {
+		sr+=x[0]*y[0]-x[1]*y[1];
+		si+=x[0]*y[1]+x[1]*y[0];
+	}
+	s[0]=sr; s[1]=si;
+}
+
+static inline void cv_arg (const real *a, real *m, long n)
+/* m=arg(a), real */
+{	long i;
+	for (i=0; i<n; i++, a+=2) m[i]=atan2(a[1],a[0]);
+}
+
 /* time functions */
 header* mtime (Calc *cc, header *hd);
 header* mwait (Calc *cc, header *hd);
@@ -95,6 +197,10 @@ header* mim (Calc *cc, header *hd);
 header* marg (Calc *cc, header *hd);
 header* mabs (Calc *cc, header *hd);
 
+/* fixed point conversions */
+header* mq15 (Calc *cc, header *hd);
+header* mq31 (Calc *cc, header *hd);
+
 /* elementwise math func */
 header* msin (Calc *cc, header *hd);
 header* mcos (Calc *cc, header *hd);
@@ -157,6 +263,8 @@ header* mmin (Calc *cc, header *hd);
 header* mmax1 (Calc *cc, header *hd);
 header* mmin1 (Calc *cc, header *hd);
 header* msort (Calc *cc, header *hd);
+header* msortrows (Calc *cc, header *hd);
+header* msortrows1 (Calc *cc, header *hd);
 header* mstatistics (Calc *cc, header *hd);
 
 /* polynoms */
@@ -190,5 +298,14 @@ header* mnormal (Calc *cc, header *hd);
 header* mshuffle (Calc *cc, header *hd);
 header* mcount (Calc *cc, header *hd);
 header* mfind (Calc *cc, header *hd);
+header* mhistc (Calc *cc, header *hd);
+header* mmean (Calc *cc, header *hd);
+header* mvar (Calc *cc, header *hd);
+header* mstd (Calc *cc, header *hd);
+header* mminmax (Calc *cc, header *hd);
+header* mstatacc (Calc *cc, header *hd);
+header* mstatacc1 (Calc *cc, header *hd);
+header* mquantile (Calc *cc, header *hd);
+header* mquantile3 (Calc *cc, header *hd);
 
 #endif
@@ -5,6 +5,8 @@
 #include "calc.h"
 #include "io.h"
 
+#define IO_LINE_SIZE		512		/* text line buffer for writematrix */
+
 /* mwritematrix
  *	stack: filename matrix flag -- matrix
  *
@@ -25,6 +27,7 @@ header* mwritematrix (Calc *cc, header *hd)
 	unsigned int flags, mtype=0;
 	size_t len;
 	FILE *f;
+	char line[IO_LINE_SIZE];
 	
 	hd1=next_param(cc,hd); hd2=next_param(cc,hd1);
 	hd=getvalue(cc,hd); hd1=getvalue(cc,hd1); hd2=getvalue(cc,hd2);
@@ -49,28 +52,51 @@ header* mwritematrix (Calc *cc, header *hd)
 			switch (mtype) {
 			case 0:
 				for (int j=0; j<c; j++) {
+					len=0;
 					for (int i=0; i<r; i++) {
-						fprintf(f,"\t%f",*mat(m,c,i,j));
+						line[len++]='\t';
+						len+=fmt_num(line+len,*mat(m,c,i,j),6,'f');
+						if (len>IO_LINE_SIZE-2*FMT_BUF_SIZE-8) {
+							line[len]=0; fputs(line,f); len=0;
+						}
 					}
-					fprintf(f,"\n");
+					line[len++]='\n'; line[len]=0;
+					fputs(line,f);
 				}
 				break;
 			case 1:
 				for (int j=0; j<c; j++) {
+					len=0;
 					for (int i=0; i<r; i++) {
 						real *p=cmat(m,c,i,j);
-						fprintf(f,"\t%f%+fi",p[0],p[1]);
+						line[len++]='\t';
+						len+=fmt_num(line+len,p[0],6,'f');
+						if (!signbit(p[1])) line[len++]='+';
+						len+=fmt_num(line+len,p[1],6,'f');
+						line[len++]='i';
+						if (len>IO_LINE_SIZE-2*FMT_BUF_SIZE-8) {
+							line[len]=0; fputs(line,f); len=0;
+						}
 					}
-					fprintf(f,"\n");
+					line[len++]='\n'; line[len]=0;
+					fputs(line,f);
 				}
 				break;
 			case 2:
 				for (int j=0; j<c; j++) {
+					len=0;
 					for (int i=0; i<r; i++) {
 						real *p=cmat(m,c,i,j);
-						fprintf(f,"\t%f\t%f",p[0],p[1]);
+						line[len++]='\t';
+						len+=fmt_num(line+len,p[0],6,'f');
+						line[len++]='\t';
+						len+=fmt_num(line+len,p[1],6,'f');
+						if (len>IO_LINE_SIZE-2*FMT_BUF_SIZE-8) {
+							line[len]=0; fputs(line,f); len=0;
+						}
 					}
-					fprintf(f,"\n");
+					line[len++]='\n'; line[len]=0;
+					fputs(line,f);
 				}
 				break;
 			default:
@@ -109,6 +135,56 @@ err_io:
 	return NULL;
 }
 
+/* msendmatrix
+ *	stack: matrix -- [r,c]
+ *
+ *  send a real or complex matrix on the console as a binary frame, with
+ *  the same layout as the binary files of mwritematrix:
+ *       "CCBI" c r mtype data
+ */
+header* msendmatrix (Calc *cc, header *hd)
+{
+	header *result;
+	real *m;
+	int r, c;
+	unsigned int mtype;
+	
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_real && hd->type!=s_matrix &&
+		hd->type!=s_complex && hd->type!=s_cmatrix) cc_error(cc,"msend(mtx)");
+	getmatrix(hd,&r,&c,&m);
+	mtype = (hd->type==s_real || hd->type==s_matrix) ? 0 : 1;
+	
+	sys_write("CCBI",4);
+	sys_write(&c,4);
+	sys_write(&r,4);
+	sys_write(&mtype,4);
+	sys_write(m,(size_t)r*(size_t)c*(mtype+1)*sizeof(real));
+	
+	result=new_matrix(cc,1,2,"");
+	m=matrixof(result);
+	m[0]=r;m[1]=c;
+	return pushresults(cc,result);
+}
+
+/* mbaud
+ *	stack: rate -- oldrate
+ *
+ *  set the console baud rate (0: unchanged), return the previous one.
+ */
+header* mbaud (Calc *cc, header *hd)
+{
+	header *result;
+	unsigned long old;
+	
+	hd=getvalue(cc,hd);
+	if (hd->type!=s_real || *realof(hd)<0.0) cc_error(cc,"baud(rate)");
+	old=sys_baud((unsigned long)*realof(hd));
+	if (old==0) cc_error(cc,"baud rate not supported");
+	result=new_real(cc,(real)old,"");
+	return pushresults(cc,result);
+}
+
 /* mreadmatrix
  *  stack:  filename -- matrix
  */
@@ -3,6 +3,8 @@
 
 header* mwritematrix (Calc *cc, header *hd);
 header* mreadmatrix (Calc *cc, header *hd);
+header* msendmatrix (Calc *cc, header *hd);
+header* mbaud (Calc *cc, header *hd);
 
 header* mwritewav (Calc *cc, header *hd);
 header* mreadwav (Calc *cc, header *hd);
@@ -35,6 +35,18 @@ restart:
 			in++;
 		}
 		/*add for complex i */
+	} else if (c==0x05) {
+		/* folded constant: len, nodes, value, padding */
+		memcpy(&cc->val,in+2,sizeof(real));
+		in+=(unsigned char)*in-1;
+		tok=T_REAL;
+	} else if (c==0x04) {
+		/* folded matrix: len, nodes, offset to the object */
+		uint32_t off;
+		memcpy(&off,in+2,sizeof(uint32_t));
+		cc->cst=in-1+off;
+		in+=(unsigned char)*in-1;
+		tok=T_CONST;
 	} else if (c==0x03) {
 		/* compiled command */
 		int cmd=*in++;
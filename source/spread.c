@@ -15,10 +15,151 @@
 #include <ctype.h>
 
 #include "spread.h"
+#include "funcs.h"
 
 #define isreal(hd) (((hd)->type==s_real || (hd)->type==s_matrix))
 #define iscomplex(hd) (((hd)->type==s_complex || (hd)->type==s_cmatrix))
 
+/* real binary operators with specialized broadcast loops: name and
+   value of the element computed from x and y. For each one, the table
+   generates the elementwise function passed to map2/map2r and the loops
+     vv: m[i]=a[i] op b[i]   sv: m[i]=a[0] op b[i]   vs: m[i]=a[i] op b[0]
+   map2 finds the loops from the elementwise function. */
+#define MAP2_KERNELS(K) \
+	K(r_add,		x+y) \
+	K(r_sub,		x-y) \
+	K(r_mul,		x*y) \
+	K(r_div,		x/y) \
+	K(rgreater,		x>y ? 1.0 : 0.0) \
+	K(rless,		x<y ? 1.0 : 0.0) \
+	K(rgreatereq,	x>=y ? 1.0 : 0.0) \
+	K(rlesseq,		x<=y ? 1.0 : 0.0) \
+	K(requal,		x==y ? 1.0 : 0.0) \
+	K(runequal,		x!=y ? 1.0 : 0.0) \
+	K(r_or,			(x!=0.0 || y!=0.0) ? 1.0 : 0.0) \
+	K(r_and,		(x!=0.0 && y!=0.0) ? 1.0 : 0.0)
+
+typedef struct {
+	void	(*f)(real *, real *, real *);
+	void	(*vv)(const real *, const real *, real *, long);
+	void	(*sv)(const real *, const real *, real *, long);
+	void	(*vs)(const real *, const real *, real *, long);
+} map2_kernel_t;
+
+#define MAP2_LOOPS(name, expr) \
+void name (real *px, real *py, real *z) \
+{	real x=*px, y=*py; \
+	*z=(expr); \
+} \
+static void name##_vv (const real *a, const real *b, real *m, long n) \
+{	long i; \
+	for (i=0; i<n; i++) { real x=a[i], y=b[i]; m[i]=(expr); } \
+} \
+static void name##_sv (const real *a, const real *b, real *m, long n) \
+{	real x=*a; long i; \
+	for (i=0; i<n; i++) { real y=b[i]; m[i]=(expr); } \
+} \
+static void name##_vs (const real *a, const real *b, real *m, long n) \
+{	real y=*b; long i; \
+	for (i=0; i<n; i++) { real x=a[i]; m[i]=(expr); } \
+}
+
+#define MAP2_ENTRY(name, expr)	{ name, name##_vv, name##_sv, name##_vs },
+
+MAP2_KERNELS(MAP2_LOOPS)
+
+static const map2_kernel_t map2_kernels[] = {
+	MAP2_KERNELS(MAP2_ENTRY)
+};
+
+#define MAP2_NKERNELS	(int)(sizeof(map2_kernels)/sizeof(map2_kernel_t))
+
+static void map2_fill (void f (real *, real *, real *),
+	real *m1, int r1, int c1, real *m2, int r2, int c2,
+	real *m, int rr, int cr)
+/* fill the rr x cr real result m of the broadcast operation. The shape
+   is classified once: same shape and scalar operands are walked as a
+   single vector, row and column broadcasts run by rows. */
+{	int i;
+	for (i=0; i<MAP2_NKERNELS && map2_kernels[i].f!=f; i++) ;
+	if (i<MAP2_NKERNELS) {
+		const map2_kernel_t *k=map2_kernels+i;
+		long n=(long)rr*cr;
+		int r;
+		if (r1==r2 && c1==c2) k->vv(m1,m2,m,n);
+		else if (r1==1 && c1==1) k->sv(m1,m2,m,n);
+		else if (r2==1 && c2==1) k->vs(m1,m2,m,n);
+		else for (r=0; r<rr; r++, m+=cr) {
+			/* row or column broadcast: one run per row */
+			real *a=m1+(r1>1 ? r*c1 : 0), *b=m2+(r2>1 ? r*c2 : 0);
+			if (c1>1 && c2>1) k->vv(a,b,m,cr);
+			else if (c2>1) k->sv(a,b,m,cr);
+			else k->vs(a,b,m,cr);
+		}
+	} else {
+		real *l1=m1, *l2=m2;
+		int r,c;
+		for (r=0; r<rr; r++) {
+			for (c=0; c<cr; c++) {
+				f(m1,m2,m);
+				if (c1>1) m1++;
+				if (c2>1) m2++;
+				m++;
+			}
+			if (r1==1) m1=l1;
+			else if (c1==1) m1++;
+			if (r2==1) m2=l2;
+			else if (c2==1) m2++;
+		}
+	}
+}
+
+static int range_operand (header *hd, int n, range_t **rg, real **m)
+/* can hd be combined elementwise with a 1xn range without broadcasting
+   to a matrix? */
+{
+	*rg=NULL; *m=NULL;
+	if (hd->type==s_range) {
+		*rg=rangeof(hd);
+		return (*rg)->n==n;
+	}
+	if (hd->type==s_real) {
+		*m=realof(hd);
+		return 1;
+	}
+	if (hd->type==s_matrix && dimsof(hd)->r==1 && dimsof(hd)->c==n) {
+		*m=matrixof(hd);
+		return 1;
+	}
+	return 0;
+}
+
+static header* map2_range (Calc *cc, 
+	void f (real *, real *, real *),
+	header *hd1, header *hd2)
+/* real binary operator with at least one range operand: the elements
+   of the range are generated while the result is filled. NULL if the
+   other operand needs the general case (complex, broadcast to a matrix) */
+{	range_t *rg1,*rg2;
+	real *m1,*m2,*m,x,y;
+	header *result;
+	int i,n;
+	n=(hd1->type==s_range) ? rangeof(hd1)->n : rangeof(hd2)->n;
+	if (!f || n<2) return NULL;
+	if (!range_operand(hd1,n,&rg1,&m1) || !range_operand(hd2,n,&rg2,&m2))
+		return NULL;
+	result=new_matrix(cc,1,n,"");
+	m=matrixof(result);
+	for (i=0; i<n; i++) {
+		if (rg1) x=rg1->start+(real)i*rg1->step;
+		else x=(hd1->type==s_real) ? *m1 : m1[i];
+		if (rg2) y=rg2->start+(real)i*rg2->step;
+		else y=(hd2->type==s_real) ? *m2 : m2[i];
+		f(&x,&y,m++);
+	}
+	return result;
+}
+
 header* map1 (Calc *cc, 
 	void f(real *, real *),
 	void fc(cplx, cplx),
@@ -32,7 +173,16 @@ header* map1 (Calc *cc,
 	header *hd1=NULL;
 	real *m,*m1;
 	long i,n;
-	if (hd->type==s_real) {
+	if (hd->type==s_range) {
+		/* walk the range, it is never materialized */
+		range_t *rg=rangeof(hd);
+		hd1=new_matrix(cc,1,rg->n,"");
+		m1=matrixof(hd1);
+		for (i=0; i<rg->n; i++) {
+			x=rg->start+(real)i*rg->step;
+			f(&x,m1++);
+		}
+	} else if (hd->type==s_real) {
 		f(realof(hd),&x);
 		hd1=new_real(cc,x,"");
 	} else if (hd->type==s_matrix) {
@@ -40,7 +190,7 @@ header* map1 (Calc *cc,
 		hd1=new_matrix(cc,d->r,d->c,"");
 		m=matrixof(hd);
 		m1=matrixof(hd1);
-		n=d->c*d->r;
+		n=(long)d->c*d->r;
 		for (i=0; i<n; i++) {
 			f(m,m1); m++; m1++;
 		}
@@ -119,6 +269,11 @@ header* map2 (Calc *cc,
 	real *m1,*m2,*m,x,*l1,*l2;
 	cplx z;
 	header *result;
+	if (hd1->type==s_range || hd2->type==s_range) {
+		result=map2_range(cc,f,hd1,hd2);
+		if (result) return result;
+		hd1=getvalue(cc,hd1); hd2=getvalue(cc,hd2);
+	}
 	if (isreal(hd1)) t1=0;
 	else if (iscomplex(hd1)) t1=1;
 	else {
@@ -158,19 +313,7 @@ header* map2 (Calc *cc,
 				return new_real(cc,x,"");
 			}
 			result=new_matrix(cc,rr,cr,"");
-			m=matrixof(result);
-			for (r=0; r<rr; r++) {
-				for (c=0; c<cr; c++) {
-					f(m1,m2,m);
-					if (c1>1) m1++;
-					if (c2>1) m2++;
-					m++;
-				}
-				if (r1==1) m1=l1;
-				else if (c1==1) m1++;
-				if (r2==1) m2=l2;
-				else if (c2==1) m2++;
-			}
+			if (rr && cr) map2_fill(f,m1,r1,c1,m2,r2,c2,matrixof(result),rr,cr);
 			return result;
 		case 1 :
 			if (rr==1 && cr==1) {
@@ -185,6 +328,14 @@ header* map2 (Calc *cc,
 			}
 			result=new_cmatrix(cc,rr,cr,"");
 			m=matrixof(result);
+			if (t1==1 && t2==1 && r1==r2 && c1==c2) {
+				/* same shape complex operands: inline kernels */
+				long n=(long)rr*cr;
+				if (fc==c_mul) { cv_mul(m1,m2,m,n); return result; }
+				if (fc==c_div) { cv_div(m1,m2,m,n); return result; }
+				if (fc==c_add) { r_add_vv(m1,m2,m,2*n); return result; }
+				if (fc==c_sub) { r_sub_vv(m1,m2,m,2*n); return result; }
+			}
 			for (r=0; r<rr; r++) {
 				for (c=0; c<cr; c++) {
 					if (t1==0) {
@@ -267,19 +418,7 @@ header* map2r (Calc *cc,
 				return new_real(cc,x,"");
 			}
 			result=new_matrix(cc,rr,cr,"");
-			m=matrixof(result);
-			for (r=0; r<rr; r++) {
-				for (c=0; c<cr; c++) {
-					f(m1,m2,m);
-					if (c1>1) m1++;
-					if (c2>1) m2++;
-					m++;
-				}
-				if (r1==1) m1=l1;
-				else if (c1==1) m1++;
-				if (r2==1) m2=l2;
-				else if (c2==1) m2++;
-			}
+			if (rr && cr) map2_fill(f,m1,r1,c1,m2,r2,c2,matrixof(result),rr,cr);
 			return result;
 		case 1 :
 			if (rr==1 && cr==1) {
@@ -380,3 +519,121 @@ header* spread1r (Calc *cc,
 	result=map1r(cc,funceval,fc,hd);
 	return pushresults(cc,result);
 }
+
+/****************************************************************
+ *	fixed point matrices
+ ****************************************************************/
+static int32_t q_quantize (real x, int q)
+/* round x*2^q to the nearest integer, saturated to the Qq range */
+{	real s=(real)((int64_t)1<<q), v=floor(x*s+(real)0.5);
+	if (v>=s) return (int32_t)(((int64_t)1<<q)-1);
+	if (v<-s) return (int32_t)(-((int64_t)1<<q));
+	if (v!=v) return 0;
+	return (int32_t)v;
+}
+
+/* an operand of qmap2: q is 0 for real values */
+typedef struct {
+	int		r, c, q;
+	void	*m;
+} qop;
+
+static void q_operand (Calc *cc, header *hd, qop *o)
+{	if (hd->type==s_qmatrix) {
+		o->r=qdimsof(hd)->r; o->c=qdimsof(hd)->c; o->q=qdimsof(hd)->q;
+		o->m=qmatrixof(hd);
+	} else if (isreal(hd)) {
+		real *m;
+		getmatrix(hd,&o->r,&o->c,&m);
+		o->q=0; o->m=m;
+	} else {
+		cc_error(cc,"Can't operate on non numerical value");
+	}
+}
+
+static int32_t q_elt (qop *o, long k, int q)
+/* element k of the operand, in the Qq format */
+{	switch (o->q) {
+	case 15:
+		return q==15 ? ((int16_t*)o->m)[k] : ((int16_t*)o->m)[k]*65536;
+	case 31:
+		return ((int32_t*)o->m)[k];
+	default:
+		return q_quantize(((real*)o->m)[k],q);
+	}
+}
+
+header* qmap2 (Calc *cc, 
+	int32_t f (int32_t, int32_t, int),
+	header *hd1, header *hd2)
+/**** qmap2
+    apply a binary operator to fixed point matrices elementwise, with the
+    broadcasting rules of map2. f gets and returns saturated samples in
+    the Qq format of the result. A real operand is quantized to the format
+    of the other one, Q15 combined with Q31 gives Q31.
+ ****/
+{	qop a, b;
+	int q, rr, cr, i, j;
+	long k=0, k1, k2;
+	header *result;
+	hd1=getvalue(cc,hd1); hd2=getvalue(cc,hd2);
+	q_operand(cc,hd1,&a); q_operand(cc,hd2,&b);
+	q=a.q>b.q ? a.q : b.q;
+	if ((a.r>1 && b.r>1 && a.r!=b.r) || (a.c>1 && b.c>1 && a.c!=b.c)) {
+	    cc_error(cc,"Cannot combine these matrices!");
+	}
+	rr=(a.r && b.r) ? MAX(a.r,b.r) : 0;
+	cr=(a.c && b.c) ? MAX(a.c,b.c) : 0;
+	result=new_qmatrix(cc,rr,cr,q,"");
+	for (i=0; i<rr; i++) {
+		k1=a.r>1 ? (long)i*a.c : 0;
+		k2=b.r>1 ? (long)i*b.c : 0;
+		for (j=0; j<cr; j++, k++) {
+			int32_t v=f(q_elt(&a,k1+(a.c>1 ? j : 0),q),
+						q_elt(&b,k2+(b.c>1 ? j : 0),q),q);
+			if (q==15) ((int16_t*)qmatrixof(result))[k]=(int16_t)v;
+			else ((int32_t*)qmatrixof(result))[k]=v;
+		}
+	}
+	return result;
+}
+
+header* qconvert (Calc *cc, header *hd, int q)
+/**** qconvert
+    convert a real or fixed point matrix to the Qq format (q=15 or 31),
+    or back to real values (q=0). Samples are rounded and saturated.
+ ****/
+{	qop a;
+	header *result;
+	long k, n;
+	q_operand(cc,hd,&a);
+	if (a.q==q) return hd;
+	n=(long)a.r*a.c;
+	if (q==0) {
+		real s=(real)1.0/(real)((int64_t)1<<a.q), *m;
+		if (a.r==1 && a.c==1) return new_real(cc,(real)q_elt(&a,0,a.q)*s,"");
+		result=new_matrix(cc,a.r,a.c,"");
+		m=matrixof(result);
+		for (k=0; k<n; k++) m[k]=(real)q_elt(&a,k,a.q)*s;
+	} else if (q==31 || a.q==0) {
+		result=new_qmatrix(cc,a.r,a.c,q,"");
+		if (q==15) {
+			int16_t *m=(int16_t*)qmatrixof(result);
+			for (k=0; k<n; k++) m[k]=(int16_t)q_elt(&a,k,15);
+		} else {
+			int32_t *m=(int32_t*)qmatrixof(result);
+			for (k=0; k<n; k++) m[k]=q_elt(&a,k,31);
+		}
+	} else {
+		/* Q31 to Q15 */
+		int32_t *m1=(int32_t*)a.m;
+		int16_t *m;
+		result=new_qmatrix(cc,a.r,a.c,15,"");
+		m=(int16_t*)qmatrixof(result);
+		for (k=0; k<n; k++) {
+			int64_t v=((int64_t)m1[k]+32768)>>16;
+			m[k]=(int16_t)QSAT(v,15);
+		}
+	}
+	return result;
+}
@@ -38,6 +38,20 @@ header* map2r (Calc *cc,
 	void fc (cplx, cplx, real *),
 	header *hd1, header *hd2);
 
+/* real binary operators, map2/map2r run them with specialized loops */
+void r_add (real *x, real *y, real *z);
+void r_sub (real *x, real *y, real *z);
+void r_mul (real *x, real *y, real *z);
+void r_div (real *x, real *y, real *z);
+void rgreater (real *x, real *y, real *z);
+void rless (real *x, real *y, real *z);
+void rgreatereq (real *x, real *y, real *z);
+void rlesseq (real *x, real *y, real *z);
+void requal (real *x, real *y, real *z);
+void runequal (real *x, real *y, real *z);
+void r_or (real *x, real *y, real *z);
+void r_and (real *x, real *y, real *z);
+
 header* spread2 (Calc *cc, 
 	void f (real *, real *, real *),
 	void fc (cplx, cplx, cplx),
@@ -47,4 +61,14 @@ header* spread2r (Calc *cc,
 	void fc (cplx, cplx, real *),
 	header *hd);
 
+/* fixed point matrices */
+/* saturate the 64 bit value x to the Qq sample range */
+#define QSAT(x,q)	((x)<-((int64_t)1<<(q)) ? -((int64_t)1<<(q)) : \
+					((x)>=((int64_t)1<<(q)) ? ((int64_t)1<<(q))-1 : (x)))
+
+header* qmap2 (Calc *cc, 
+	int32_t f (int32_t, int32_t, int),
+	header *hd1, header *hd2);
+header* qconvert (Calc *cc, header *hd, int q);
+
 #endif
@@ -93,6 +93,8 @@ int stack_init(Calc *cc, unsigned long stacksize)
 		cc->startlocal=cc->endlocal=cc->ramstart;
 		cc->newram=cc->ramstart;
 		cc->udfstart=cc->udfend=cc->ramend=cc->ramstart+stacksize;
+		cc->newrammax=cc->newram;
+		cc->udfstartmin=cc->udfstart;
 		
 		return 1;
 	}
@@ -144,6 +146,9 @@ void* stack_alloc (Calc *cc, stacktyp type, int size, char *name)
 	}
 	erg=cc->newram+sizeof(header);
 	cc->newram+=size+sizeof(header);
+	if (cc->newram>cc->newrammax) cc->newrammax=cc->newram;
+	if (cc->udfstart<cc->udfstartmin) cc->udfstartmin=cc->udfstart;
+	if (cc->profile) prof_alloc(cc,size+sizeof(header));
 	return erg;
 }
 
@@ -208,6 +213,172 @@ void* stack_realloc(Calc *cc, header* hd, int size)
 }
 #endif
 
+/* Scratch pool
+
+   Large scratch buffers (FFT work areas, ...) only live during a
+   builtin call and don't need to take room in the interpreter stack:
+   they are taken from a buddy allocator over the RAM banks the board
+   registers with pool_add. A bank is cut into naturally aligned power of
+   two blocks. A block of order k splits into two buddies of order k-1
+   that merge back when both are free, so the pool doesn't fragment over
+   time. This is not an arena for matrix values: interpreter objects stay
+   in the stack, they are moved and copied as a whole everywhere.
+ */
+#define POOL_MIN_ORDER		6		/* 64 bytes, block header included */
+#define POOL_MAX_ORDER		16		/* 64 KB */
+#define POOL_HDR			ALIGN(2)
+
+typedef struct _pool_blk {
+	unsigned char		order;
+	unsigned char		isfree;
+	struct _pool_blk *	next;		/* free list links, free blocks only */
+	struct _pool_blk *	prev;
+} pool_blk;
+
+typedef struct {
+	char *			base;
+	unsigned long	size;
+	unsigned long	used;
+	unsigned long	hwm;			/* high-water mark of used */
+} pool_bank;
+
+static pool_bank pool_banks[POOL_BANKS_MAX];
+static int pool_nbanks=0;
+static pool_blk *pool_lists[POOL_MAX_ORDER+1];
+
+static void pool_push (pool_blk *b, int k)
+{	b->order=k; b->isfree=1;
+	b->prev=NULL; b->next=pool_lists[k];
+	if (b->next) b->next->prev=b;
+	pool_lists[k]=b;
+}
+
+static void pool_unlink (pool_blk *b)
+{	if (b->prev) b->prev->next=b->next;
+	else pool_lists[b->order]=b->next;
+	if (b->next) b->next->prev=b->prev;
+	b->isfree=0;
+}
+
+static void pool_cut (pool_bank *bk)
+/* put the whole bank in the free lists as the largest aligned blocks */
+{	unsigned long off=0;
+	int k;
+	while (bk->size-off>=(1UL<<POOL_MIN_ORDER)) {
+		for (k=POOL_MAX_ORDER; k>POOL_MIN_ORDER; k--)
+			if (off%(1UL<<k)==0 && off+(1UL<<k)<=bk->size) break;
+		pool_push((pool_blk *)(bk->base+off),k);
+		off+=1UL<<k;
+	}
+}
+
+static pool_bank* pool_bank_of (void *p)
+{	int i;
+	for (i=0; i<pool_nbanks; i++)
+		if ((char *)p>=pool_banks[i].base && (char *)p<pool_banks[i].base+pool_banks[i].size)
+			return &pool_banks[i];
+	return NULL;
+}
+
+int pool_add (char *start, unsigned long size)
+/***** pool_add
+	give the RAM bank [start,start+size[ to the pool. start should be
+	aligned on the largest block size. returns 0 if the bank table is
+	full.
+*****/
+{	pool_bank *bk;
+	if (pool_nbanks>=POOL_BANKS_MAX) return 0;
+	bk=&pool_banks[pool_nbanks++];
+	bk->base=start; bk->size=size;
+	bk->used=bk->hwm=0;
+	pool_cut(bk);
+	return 1;
+}
+
+void pool_reset (void)
+/***** pool_reset
+	free all the blocks, after an error aborted the builtins that
+	owned them. The high-water marks are kept.
+*****/
+{	int i;
+	for (i=0; i<=POOL_MAX_ORDER; i++) pool_lists[i]=NULL;
+	for (i=0; i<pool_nbanks; i++) {
+		pool_banks[i].used=0;
+		pool_cut(&pool_banks[i]);
+	}
+}
+
+void* pool_alloc (unsigned long size)
+/***** pool_alloc
+	get size bytes from the pool, NULL if there is no free block large
+	enough. The caller falls back to the stack.
+*****/
+{	pool_blk *b;
+	pool_bank *bk;
+	int k=POOL_MIN_ORDER, j;
+	while ((1UL<<k)<size+POOL_HDR) if (++k>POOL_MAX_ORDER) return NULL;
+	for (j=k; j<=POOL_MAX_ORDER && !pool_lists[j]; j++) ;
+	if (j>POOL_MAX_ORDER) return NULL;
+	b=pool_lists[j];
+	pool_unlink(b);
+	/* split down to the requested order, keeping the low half */
+	while (j>k) {
+		j--;
+		pool_push((pool_blk *)((char *)b+(1UL<<j)),j);
+	}
+	b->order=k;
+	bk=pool_bank_of(b);
+	bk->used+=1UL<<k;
+	if (bk->used>bk->hwm) bk->hwm=bk->used;
+	return (char *)b+POOL_HDR;
+}
+
+void pool_free (void *p)
+/***** pool_free
+	give back a block from pool_alloc. p may be NULL.
+*****/
+{	pool_blk *b, *buddy;
+	pool_bank *bk;
+	unsigned long off;
+	int k;
+	if (!p) return;
+	b=(pool_blk *)((char *)p-POOL_HDR);
+	bk=pool_bank_of(b);
+	k=b->order;
+	bk->used-=1UL<<k;
+	/* merge with the free buddy of the same order, as far as possible */
+	while (k<POOL_MAX_ORDER) {
+		off=((char *)b-bk->base)^(1UL<<k);
+		if (off+(1UL<<k)>bk->size) break;
+		buddy=(pool_blk *)(bk->base+off);
+		if (!buddy->isfree || buddy->order!=k) break;
+		pool_unlink(buddy);
+		if (buddy<b) b=buddy;
+		k++;
+	}
+	pool_push(b,k);
+}
+
+unsigned long pool_avail (void)
+/***** pool_avail
+	size of the largest buffer pool_alloc can give now.
+*****/
+{	int k;
+	for (k=POOL_MAX_ORDER; k>=POOL_MIN_ORDER; k--)
+		if (pool_lists[k]) return (1UL<<k)-POOL_HDR;
+	return 0;
+}
+
+int pool_info (int i, char **base, unsigned long *size, unsigned long *used, unsigned long *hwm)
+/***** pool_info
+	state of the bank i, 0 if there is no such bank.
+*****/
+{	if (i<0 || i>=pool_nbanks) return 0;
+	*base=pool_banks[i].base; *size=pool_banks[i].size;
+	*used=pool_banks[i].used; *hwm=pool_banks[i].hwm;
+	return 1;
+}
+
 header *new_real (Calc *cc, real x, char *name)
 /***** new real
 	push a real on stack.
@@ -319,6 +490,28 @@ header *new_cmatrix (Calc *cc, int rows, int columns, char *name)
 	return hd;
 }
 
+header *new_qmatrix (Calc *cc, int rows, int columns, int q, char *name)
+/***** new_qmatrix
+	push a new Q15 or Q31 fixed point matrix on the stack.
+*****/
+{
+	header *hd=(header *)cc->newram;
+	qdims* d=(qdims *)stack_alloc(cc,s_qmatrix,qmatrixsize(columns,rows,q),name);
+	d->c=columns; d->r=rows; d->q=q;
+	return hd;
+}
+
+header *new_range (Calc *cc, real start, real step, int n)
+/***** new_range
+	push a lazy a:b:c vector of n elements on the stack.
+*****/
+{
+	header *hd=(header *)cc->newram;
+	range_t* d=(range_t *)stack_alloc(cc,s_range,sizeof(range_t),"");
+	d->start=start; d->step=step; d->n=n;
+	return hd;
+}
+
 header *new_command (Calc *cc, int no)
 /***** new_command
 	push a command on stack.
@@ -425,6 +618,71 @@ header *new_csubm (Calc *cc, header *var, ULONG l, char *name)
 	return hd;
 }
 
+static int index_count (Calc *cc, header *ind, int nvar, int *all)
+/* number of values in the index ind, all is set for ':' */
+{
+	*all=0;
+	if (ind->type==s_matrix) {
+		if (dimsof(ind)->r==1) return dimsof(ind)->c;
+		if (dimsof(ind)->c==1) return dimsof(ind)->r;
+	} else if (ind->type==s_real) {
+		return 1;
+	} else if (ind->type==s_range) {
+		return rangeof(ind)->n;
+	} else if (ind->type==s_command && *commandof(ind)==c_allv) {
+		*all=1; return nvar;
+	}
+	cc_error(cc,"Illegal index!");
+	return 0;
+}
+
+static int index_push (header *ind, int n, int nvar, int all, int *p)
+/* push the valid 0 based indexes of ind to p, return their count.
+   ranges are walked without being materialized */
+{	real x,*m;
+	int i,k=0;
+	if (all) {
+		for (i=0; i<nvar; i++) p[i]=i;
+		return nvar;
+	}
+	if (ind->type==s_range) {
+		range_t *rg=rangeof(ind);
+		for (i=0; i<n; i++) {
+			x=rg->start+(real)i*rg->step-1;
+			if (x>=0.0 && x<nvar) p[k++]=(int)x;
+		}
+	} else {
+		m=(ind->type==s_real) ? realof(ind) : matrixof(ind);
+		for (i=0; i<n; i++) {
+			x=m[i]-1;
+			if (x>=0.0 && x<nvar) p[k++]=(int)x;
+		}
+	}
+	return k;
+}
+
+static int index_span (header *ind, int n, int nvar, int all, int *first)
+/* the index ind selects the n contiguous values first, first+1, ...
+   all in the bounds, so that they can be copied as a block */
+{	real x;
+	if (all) {
+		*first=0;
+		return 1;
+	}
+	if (n<1) return 0;
+	if (ind->type==s_real) {
+		x=*realof(ind)-1;
+	} else if (ind->type==s_range) {
+		if (n>1 && rangeof(ind)->step!=1.0) return 0;
+		x=rangeof(ind)->start-1;
+	} else {
+		return 0;
+	}
+	if (x<0.0 || x!=(real)(int)x || (int)x+n>nvar) return 0;
+	*first=(int)x;
+	return 1;
+}
+
 static header *new_submatrixref (Calc *cc, header *var, header *rows, header *cols, 
 	char *name, int type)
 /* make a new submatrix reference (general case), which structure is
@@ -433,39 +691,31 @@ static header *new_submatrixref (Calc *cc, header *var, header *rows, header *co
      dims    : dims of the submatrix (nb of row indexes, nb of col indexes)
      int[]   : indexes of rows, followed by indexes of cols in the original
                matrix.
+   a block of contiguous rows and cols (FLAG_SUBMBLOCK) only stores its
+   first row and col.
  */
 {	ULONG size;
 	header **d;
-	real *mr=NULL,*mc=NULL,x,*mvar;
+	real *mvar;
 	dims *dim;
-	int c=0,r=0,*n,i,c0,r0,cvar,rvar,allc=0,allr=0;
+	int c,r,*n,c0,r0,cvar,rvar,allc,allr;
 	header *hd=(header *)cc->newram;
 	getmatrix(var,&rvar,&cvar,&mvar);
-	/* analyze row indexes */
-	if (rows->type==s_matrix) {
-		if (dimsof(rows)->r==1) r=dimsof(rows)->c;
-		else if (dimsof(rows)->c==1) r=dimsof(rows)->r;
-		else cc_error(cc,"Illegal index!");
-		mr=matrixof(rows);
-	} else if (rows->type==s_real) {
-		r=1; mr=realof(rows);
-	} else if (rows->type==s_command && *commandof(rows)==c_allv) {
-		allr=1; r=rvar;
-	} else {
-		cc_error(cc,"Illegal index!");
-	}
-	/* analyze col indexes */
-	if (cols->type==s_matrix) {
-		if (dimsof(cols)->r==1) c=dimsof(cols)->c;
-		else if (dimsof(cols)->c==1) c=dimsof(cols)->r;
-		else cc_error(cc,"Illegal index!");
-		mc=matrixof(cols);
-	} else if (cols->type==s_real) {
-		c=1; mc=realof(cols);
-	} else if (cols->type==s_command && *commandof(cols)==c_allv) {
-		allc=1; c=cvar;
-	} else {
-		cc_error(cc,"Illegal index!");
+	/* analyze row and col indexes */
+	r=index_count(cc,rows,rvar,&allr);
+	c=index_count(cc,cols,cvar,&allc);
+	if (index_span(rows,r,rvar,allr,&r0) && index_span(cols,c,cvar,allc,&c0)) {
+		size=sizeof(header *)+sizeof(dims)+2*sizeof(int);
+		d=(header **)stack_alloc(cc,type,size,name);
+		*d=var;
+		dim=(dims *)(d+1);
+		dim->r=r; dim->c=c;
+		n=(int *)(dim+1);
+		n[0]=r0; n[1]=c0;
+		hd->flags|=FLAG_SUBMBLOCK|FLAG_SUBMCONTC;
+		if (allr) hd->flags|=FLAG_SUBMALLR;
+		if (allc) hd->flags|=FLAG_SUBMALLC;
+		return hd;
 	}
 	
 	size=sizeof(header *)+sizeof(dims)+((ULONG)r+c)*sizeof(int);
@@ -474,30 +724,12 @@ static header *new_submatrixref (Calc *cc, header *var, header *rows, header *co
 	n=(int *)(dim+1);								/* pointer to index field */
 	/* set pointer to the matrix header */
 	*d=var;
-	/* push row indexes (index field), check for index validity */
-	r0=0;
-	if (allr) {
-		hd->flags|=FLAG_SUBMALLR;
-		for (i=0; i<rvar; i++) *n++=i;
-		r0=rvar;
-	} else for (i=0; i<r; i++) {
-		x=(*mr++)-1;
-		if (!((x<0.0) || (x>=rvar)) ) {
-			*n++=(int)x; r0++;
-		}
-	}
-	/* push col indexes (index field), check for index validity */
-	c0=0;
-	if (allc) {
-		hd->flags|=FLAG_SUBMALLC;
-		for (i=0; i<cvar; i++) *n++=i;
-		c0=cvar;
-	} else for (i=0; i<c; i++) {
-		x=(*mc++)-1;
-		if (!((x<0.0) || (x>=cvar))) {
-			*n++=(int)x; c0++;
-		}
-	}
+	/* push row indexes then col indexes (index field), check for index validity */
+	if (allr) hd->flags|=FLAG_SUBMALLR;
+	r0=index_push(rows,r,rvar,allr,n); n+=r0;
+	if (allc) hd->flags|=FLAG_SUBMALLC;
+	if (index_span(cols,c,cvar,allc,&c0)) hd->flags|=FLAG_SUBMCONTC;
+	c0=index_push(cols,c,cvar,allc,n); n+=c0;
 	/* set the size of the submatrix: nb rows, nb cols */
 	dim->r=r0; dim->c=c0;
 	/* adjust size (some indexes may have been rejected), and newram accordingly */
@@ -513,54 +745,38 @@ static header *build_csmatrix (Calc *cc, header *var, header *rows, header *cols
 /***** built_csmatrix
 	built a complex submatrix from the matrix hd on the stack.
 *****/
-{	real *mr=NULL,*mc=NULL,*mvar,*mh,*m;
-	int n,c=0,r=0,c0,r0,i,j,cvar,rvar,allc=0,allr=0,*pc,*pr,*nc,*nr;
+{	real *mvar,*mh,*m;
+	int c,r,c0,r0,i,j,cvar,rvar,allc,allr,*pc,*pr;
 	header *hd;
 	char *ram;
 	getmatrix(var,&rvar,&cvar,&mvar);
-	/* analyze row indexes */
-	if (rows->type==s_matrix) {
-		if (dimsof(rows)->r==1) r=dimsof(rows)->c;
-		else if (dimsof(rows)->c==1) r=dimsof(rows)->r;
-		else cc_error(cc,"Illegal index!");
-		mr=matrixof(rows);
-	} else if (rows->type==s_real) {
-		r=1; mr=realof(rows);
-	} else if (rows->type==s_command && *commandof(rows)==c_allv) {
-		allr=1; r=rvar;
-	} else {
-		cc_error(cc,"Illegal index!");
-	}
-	/* analyze col indexes */
-	if (cols->type==s_matrix) {
-		if (dimsof(cols)->r==1) c=dimsof(cols)->c;
-		else if (dimsof(cols)->c==1) c=dimsof(cols)->r;
-		else cc_error(cc,"Illegal index!");
-		mc=matrixof(cols);
-	} else if (cols->type==s_real) {
-		c=1; mc=realof(cols);
-	} else if (cols->type==s_command && *commandof(cols)==c_allv) {
-		allc=1; c=cvar;
-	} else {
-		cc_error(cc,"Illegal index!");
+	/* analyze row and col indexes */
+	r=index_count(cc,rows,rvar,&allr);
+	c=index_count(cc,cols,cvar,&allc);
+	if (index_span(rows,r,rvar,allr,&r0) && index_span(cols,c,cvar,allc,&c0)) {
+		/* an element or a block, no index arrays */
+		m=cmat(mvar,cvar,r0,c0);
+		if (r==1 && c==1) return new_complex(cc,*m,*(m+1),"");
+		hd=new_cmatrix(cc,r,c,"");
+		mh=matrixof(hd);
+		if (c==cvar) {
+			memcpy(mh,m,(size_t)r*c*2*sizeof(real));
+		} else {
+			for (i=0; i<r; i++) {
+				memcpy(mh,m,(size_t)c*2*sizeof(real));
+				mh+=2*c; m+=2*cvar;
+			}
+		}
+		return hd;
 	}
 	
 	ram=cc->newram;
 	if (ram+((ULONG)(c)+(ULONG)(r))*sizeof(int)>cc->udfstart) {
 		cc_error(cc,"Out of memory!");
 	}
-	nr=pr=(int *)ram; nc=pc=pr+r; cc->newram=(char *)(pc+c);
-	c0=0; r0=0;
-	if (allc) { for (i=0; i<c; i++) pc[i]=i; c0=c; }
-	else for (i=0; i<c; i++)
-	{	n=(int)(*mc++)-1;
-		if (n>=0 && n<cvar) { *nc++=n; c0++; }
-	}
-	if (allr) { for (i=0; i<r; i++) pr[i]=i; r0=r; }
-	else for (i=0; i<r; i++) 
-	{	n=(int)(*mr++)-1;
-		if (n>=0 && n<rvar) { *nr++=n; r0++; }
-	}
+	pr=(int *)ram; pc=pr+r; cc->newram=(char *)(pc+c);
+	c0=index_push(cols,c,cvar,allc,pc);
+	r0=index_push(rows,r,rvar,allr,pr);
 	if (c0==1 && r0==1)
 	{	m=cmat(mvar,cvar,pr[0],pc[0]);
 		return new_complex(cc,*m,*(m+1),"");
@@ -580,51 +796,40 @@ static header *build_smatrix (Calc *cc, header *var, header *rows, header *cols)
 /***** built_smatrix
 	built a submatrix from the matrix hd on the stack.
 *****/
-{	real *mr=NULL,*mc=NULL,*mvar,*m;
-	int n,c=0,r=0,c0,r0,i,j,cvar,rvar,allc=0,allr=0,*pr,*pc,*nc,*nr;
+{	real *mvar,*m,*mh;
+	int c,r,c0,r0,i,j,cvar,rvar,allc,allr,*pr,*pc;
 	header *hd;
 	char *ram;
 	getmatrix(var,&rvar,&cvar,&mvar);
-	if (rows->type==s_matrix) {
-		if (dimsof(rows)->r==1) r=dimsof(rows)->c;
-		else if (dimsof(rows)->c==1) r=dimsof(rows)->r;
-		else cc_error(cc,"Illegal index!");
-		mr=matrixof(rows);
-	} else if (rows->type==s_real) {
-		r=1; mr=realof(rows);
-	} else if (rows->type==s_command && *commandof(rows)==c_allv) {
-		allr=1; r=rvar;
-	} else {
-		cc_error(cc,"Illegal index!");
-	}
-	if (cols->type==s_matrix) {
-		if (dimsof(cols)->r==1) c=dimsof(cols)->c;
-		else if (dimsof(cols)->c==1) c=dimsof(cols)->r;
-		else cc_error(cc,"Illegal index!");
-		mc=matrixof(cols);
-	} else if (cols->type==s_real) {
-		c=1; mc=realof(cols);
-	} else if (cols->type==s_command && *commandof(cols)==c_allv) {
-		allc=1; c=cvar;
-	} else {
-		cc_error(cc,"Illegal index!");
+	r=index_count(cc,rows,rvar,&allr);
+	c=index_count(cc,cols,cvar,&allc);
+	if (index_span(rows,r,rvar,allr,&r0) && index_span(cols,c,cvar,allc,&c0)) {
+		/* an element, a row range or a column, no index arrays */
+		mh=mat(mvar,cvar,r0,c0);
+		if (r==1 && c==1) return new_real(cc,*mh,"");
+		hd=new_matrix(cc,r,c,"");
+		m=matrixof(hd);
+		if (c==cvar) {
+			memcpy(m,mh,(size_t)r*c*sizeof(real));
+		} else if (c==1) {
+			for (i=0; i<r; i++) {
+				*m++=*mh; mh+=cvar;
+			}
+		} else {
+			for (i=0; i<r; i++) {
+				memcpy(m,mh,(size_t)c*sizeof(real));
+				m+=c; mh+=cvar;
+			}
+		}
+		return hd;
 	}
 	ram=cc->newram;
 	if (ram+((ULONG)(c)+(ULONG)(r))*sizeof(int)>cc->udfstart) {
 		cc_error(cc,"Out of memory!");
 	}
-	nr=pr=(int *)ram; nc=pc=pr+r; cc->newram=(char *)(pc+c);
-	c0=0; r0=0;
-	if (allc) { for (i=0; i<c; i++) pc[i]=i; c0=c; }
-	else for (i=0; i<c; i++) {
-		n=(int)(*mc++)-1;
-		if (n>=0 && n<cvar) { *nc++=n; c0++; }
-	}
-	if (allr) { for (i=0; i<r; i++) pr[i]=i; r0=r; }
-	else for (i=0; i<r; i++) {
-		n=(int)(*mr++)-1;
-		if (n>=0 && n<rvar) { *nr++=n; r0++; }
-	}
+	pr=(int *)ram; pc=pr+r; cc->newram=(char *)(pc+c);
+	c0=index_push(cols,c,cvar,allc,pc);
+	r0=index_push(rows,r,rvar,allr,pr);
 	if (c0==1 && r0==1)	{
 		return new_real(cc,*mat(mvar,cvar,pr[0],pc[0]),"");
 	}
@@ -666,6 +871,34 @@ void getmatrix (header *hd, int *r, int *c, real **m)
 	}
 }
 
+void range_fill (header *hd, real *m)
+/***** range_fill
+	write the elements of a range to m.
+*****/
+{	range_t *rg=rangeof(hd);
+	int i;
+	for (i=0; i<rg->n; i++) *m++=rg->start+(real)i*rg->step;
+}
+
+void range_expand (Calc *cc, header *hd)
+/***** range_expand
+	turn a range into a 1xn matrix in place, shifting what follows
+	it on the stack.
+*****/
+{	range_t rg=*rangeof(hd);
+	header *next=nextof(hd);
+	real *m;
+	int i,size=sizeof(header)+ALIGN(matrixsize(rg.n,1));
+	if (cc->newram+(size-hd->size)>cc->udfstart) cc_error(cc,"Memory overflow!");
+	if (cc->newram>(char *)next)
+		memmove((char *)hd+size,(char *)next,cc->newram-(char *)next);
+	cc->newram+=size-hd->size;
+	hd->size=size; hd->type=s_matrix;
+	dimsof(hd)->r=1; dimsof(hd)->c=rg.n;
+	m=matrixof(hd);
+	for (i=0; i<rg.n; i++) *m++=rg.start+(real)i*rg.step;
+}
+
 header *searchvar (Calc *cc, char *name)
 /***** searchvar
 	search a local variable, named "name".
@@ -851,6 +1084,24 @@ static int sametype (header *hd1, header *hd2)
 }
 #endif
 
+static void subm_index (Calc *cc, header *hd, int **rind, int **cind)
+/* row and col indexes of the submatrix reference hd. The indexes of a
+   block are written above newram: nothing may be allocated while they
+   are in use */
+{	dims *d=submdimsof(hd);
+	int i,*p,*b;
+	if (!(hd->flags & FLAG_SUBMBLOCK)) {
+		*rind=rowsof(hd); *cind=colsof(hd);
+		return;
+	}
+	b=rowsof(hd); p=(int *)cc->newram;
+	if ((char *)(p+d->r+d->c)>cc->udfstart) cc_error(cc,"Out of memory!");
+	for (i=0; i<d->r; i++) p[i]=b[0]+i;
+	*rind=p; p+=d->r;
+	for (i=0; i<d->c; i++) p[i]=b[1]+i;
+	*cind=p;
+}
+
 header *assign (Calc *cc, header *var, header *value)
 /***** assign
 	assign the value to the variable.
@@ -946,7 +1197,15 @@ header *assign (Calc *cc, header *var, header *value)
 			getmatrix(submrefof(var),&r,&c,&m);
 			if (d->r!=rv || d->c!=cv) {
 				if (rv==1 && cv==1) {
-					rind=rowsof(var); cind=colsof(var);
+					if (var->flags & FLAG_SUBMBLOCK) {
+						rind=rowsof(var);
+						for (i=0; i<d->r; i++) {
+							m1=mat(m,c,rind[0]+i,rind[1]);
+							for (j=0; j<d->c; j++) m1[j]=*mv;
+						}
+						return submrefof(var);
+					}
+					subm_index(cc,var,&rind,&cind);
 					for (i=0; i<d->r; i++) {
 						m1=mat(m,c,rind[i],0);
 						for (j=0; j<d->c; j++) {
@@ -956,7 +1215,7 @@ header *assign (Calc *cc, header *var, header *value)
 					return submrefof(var);
 				} else if (rv*cv==0) {		/* assign [] to matrix elements : remove them */
 					if (r==1 && d->r==1) {
-						cind=colsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=cind[0];m1=m+j;j++;
 						for (i=1; i<d->c; i++) {
 							while (j<cind[i]) *m1++=m[j++];
@@ -969,7 +1228,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (c==1 && d->c==1) {
-						rind=rowsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=rind[0];m1=m+j;j++;
 						for (i=1; i<d->r; i++) {
 							while (j<rind[i]) *m1++=m[j++];
@@ -982,7 +1241,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (var->flags & FLAG_SUBMALLC) {
-						rind=rowsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=rind[0]+1;m1=mat(m,c,rind[0],0);
 						for (i=1; i<d->r; i++) {
 							while (j<rind[i]) {
@@ -1005,7 +1264,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (var->flags & FLAG_SUBMALLR) {
-						cind=colsof(var);
+						subm_index(cc,var,&rind,&cind);
 						m1=m;
 						for (i=0; i<d->r; i++) {
 							m2=mat(m,c,i,0);k=0;
@@ -1025,7 +1284,30 @@ header *assign (Calc *cc, header *var, header *value)
 				}
 				cc_error(cc,"Illegal assignment!\nrow or column do not agree!");
 			}
+			if (var->flags & FLAG_SUBMBLOCK) {
+				/* copy rows of the block, value may be the matrix itself */
+				rind=rowsof(var);
+				if (d->r==1 && d->c==1) {
+					*mat(m,c,rind[0],rind[1])=*mv;
+					return submrefof(var);
+				}
+				for (i=0; i<d->r; i++) {
+					memmove(mat(m,c,rind[0]+i,rind[1]),mat(mv,cv,i,0),(size_t)d->c*sizeof(real));
+				}
+				return submrefof(var);
+			}
 			rind=rowsof(var); cind=colsof(var);
+			if (d->r==1 && d->c==1) {
+				*mat(m,c,*rind,*cind)=*mv;
+				return submrefof(var);
+			}
+			if (var->flags & FLAG_SUBMCONTC) {
+				/* copy row slices, value may be the matrix itself */
+				for (i=0; i<d->r; i++) {
+					memmove(mat(m,c,rind[i],*cind),mat(mv,cv,i,0),(size_t)d->c*sizeof(real));
+				}
+				return submrefof(var);
+			}
 			for (i=0; i<d->r; i++) {
 				m1=mat(m,c,rind[i],0);
 				m2=mat(mv,cv,i,0);
@@ -1056,7 +1338,15 @@ header *assign (Calc *cc, header *var, header *value)
 			getmatrix(submrefof(var),&r,&c,&m);
 			if (d->r!=rv || d->c!=cv) {
 				if (rv==1 && cv==1) {
-					rind=rowsof(var); cind=colsof(var);
+					if (var->flags & FLAG_SUBMBLOCK) {
+						rind=rowsof(var);
+						for (i=0; i<d->r; i++) {
+							m1=cmat(m,c,rind[0]+i,rind[1]);
+							for (j=0; j<d->c; j++) c_copy(mv,m1+(long)2*j);
+						}
+						return submrefof(var);
+					}
+					subm_index(cc,var,&rind,&cind);
 					for (i=0; i<d->r; i++) {
 						m1=cmat(m,c,rind[i],0);
 						for (j=0; j<d->c; j++) {
@@ -1066,7 +1356,7 @@ header *assign (Calc *cc, header *var, header *value)
 					return submrefof(var);
 				} else if (rv*cv==0) {		/* assign [] to matrix elements : remove them */
 					if (r==1 && d->r==1) {
-						cind=colsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=cind[0];m1=m+2*j;j++;
 						for (i=1; i<d->c; i++) {
 							while (j<cind[i]) {*m1++=m[2*j];*m1++=m[2*j+1];j++;}
@@ -1079,7 +1369,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (c==1 && d->c==1) {
-						rind=rowsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=rind[0];m1=m+2*j;j++;
 						for (i=1; i<d->r; i++) {
 							while (j<rind[i]) {*m1++=m[2*j];*m1++=m[2*j+1];j++;}
@@ -1092,7 +1382,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (var->flags & FLAG_SUBMALLC) {
-						rind=rowsof(var);
+						subm_index(cc,var,&rind,&cind);
 						j=rind[0]+1;m1=cmat(m,c,rind[0],0);
 						for (i=1; i<d->r; i++) {
 							while (j<rind[i]) {
@@ -1115,7 +1405,7 @@ header *assign (Calc *cc, header *var, header *value)
 						return submrefof(var);
 					}
 					if (var->flags & FLAG_SUBMALLR) {
-						cind=colsof(var);
+						subm_index(cc,var,&rind,&cind);
 						m1=m;
 						for (i=0; i<d->r; i++) {
 							m2=cmat(m,c,i,0);k=0;
@@ -1135,6 +1425,13 @@ header *assign (Calc *cc, header *var, header *value)
 				}
 				cc_error(cc,"Illegal assignment!\nrow or column do not agree!");
 			}
+			if (var->flags & FLAG_SUBMBLOCK) {
+				rind=rowsof(var);
+				for (i=0; i<d->r; i++) {
+					memmove(cmat(m,c,rind[0]+i,rind[1]),cmat(mv,cv,i,0),(size_t)d->c*2*sizeof(real));
+				}
+				return submrefof(var);
+			}
 			rind=rowsof(var); cind=colsof(var);
 			for (i=0; i<d->r; i++) {
 				m1=cmat(m,c,rind[i],0);
@@ -1252,10 +1549,27 @@ header *getvalue (Calc *cc, header *hd)
 		mhd=submrefof(hd); d=submdimsof(hd);
 		rind=rowsof(hd); cind=colsof(hd);
 		getmatrix(mhd,&r,&c,&m);
+		if (hd->flags & FLAG_SUBMBLOCK) {
+			/* first row and col of the block */
+			if (d->r==1 && d->c==1) return new_real(cc,*mat(m,c,rind[0],rind[1]),"");
+			result=new_matrix(cc,d->r,d->c,"");
+			mr=matrixof(result);
+			for (i=0; i<d->r; i++) {
+				memcpy(mat(mr,d->c,i,0),mat(m,c,rind[0]+i,rind[1]),(size_t)d->c*sizeof(real));
+			}
+			return result;
+		}
 		if (d->r==1 && d->c==1)
 			return new_real(cc,*mat(m,c,*rind,*cind),"");
 		result=new_matrix(cc,d->r,d->c,"");
 		mr=matrixof(result);
+		if (hd->flags & FLAG_SUBMCONTC) {
+			/* copy row slices */
+			for (i=0; i<d->r; i++) {
+				memcpy(mat(mr,d->c,i,0),mat(m,c,rind[i],*cind),(size_t)d->c*sizeof(real));
+			}
+			return result;
+		}
 		for (i=0; i<d->r; i++) {
 			cind1=cind;
 			m1=mat(mr,d->c,i,0);
@@ -1272,6 +1586,18 @@ header *getvalue (Calc *cc, header *hd)
 	{	mhd=submrefof(hd); d=submdimsof(hd);
 		rind=rowsof(hd); cind=colsof(hd);
 		getmatrix(mhd,&r,&c,&m);
+		if (hd->flags & FLAG_SUBMBLOCK) {
+			if (d->r==1 && d->c==1) {
+				m=cmat(m,c,rind[0],rind[1]);
+				return new_complex(cc,*m,*(m+1),"");
+			}
+			result=new_cmatrix(cc,d->r,d->c,"");
+			mr=matrixof(result);
+			for (i=0; i<d->r; i++) {
+				memcpy(cmat(mr,d->c,i,0),cmat(m,c,rind[0]+i,rind[1]),(size_t)d->c*2*sizeof(real));
+			}
+			return result;
+		}
 		if (d->r==1 && d->c==1) {
 			m=cmat(m,c,*rind,*cind);
 			return new_complex(cc,*m,*(m+1),"");
@@ -1291,6 +1617,13 @@ header *getvalue (Calc *cc, header *hd)
 		}
 		return result;
 	}
+	/* materialize ranges for the operators that don't walk them */
+	if (hd->type==s_range) {
+		if (rangeof(hd)->n==1) return new_real(cc,rangeof(hd)->start,"");
+		result=new_matrix(cc,1,rangeof(hd)->n,"");
+		range_fill(hd,matrixof(result));
+		return result;
+	}
 	/* resolve 1x1 matrices to scalars */
 	if (hd->type==s_matrix && dimsof(hd)->c==1 && dimsof(hd)->r==1) {
 		return new_real(cc,*matrixof(hd),"");
@@ -1302,6 +1635,16 @@ header *getvalue (Calc *cc, header *hd)
 	return hd;
 }
 
+header *getrange (Calc *cc, header *hd)
+/***** getrange
+	same as getvalue, but a range is returned as it is, for the
+	operators that generate its elements on the fly.
+*****/
+{
+	if (hd->type==s_range) return hd;
+	return getvalue(cc,hd);
+}
+
 header *next_param (Calc *cc, header *hd)
 /***** next_param
 	get the next value on stack, if there is one
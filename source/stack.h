@@ -9,6 +9,8 @@
 #ifndef STACK_H
 #define STACK_H
 
+#include <stdint.h>
+
 #ifdef HEADER32
 /* Header 32 bytes */
 typedef enum {
@@ -23,6 +25,8 @@ typedef enum {
 	s_csubmatrixref,
 	s_funcref,
 	s_command,
+	s_qmatrix,
+	s_range,
 } stacktyp;
 
 struct _header {
@@ -47,6 +51,8 @@ typedef unsigned short	stacktyp;
 #define s_csubmatrixref		8
 #define s_funcref			9
 #define s_command			10
+#define s_qmatrix			11
+#define s_range				12
 
 struct _header {
 	char			name[LABEL_LEN_MAX+1];
@@ -65,12 +71,27 @@ struct _header {
 #define FLAG_BINFUNC		0x80
 #define FLAG_SUBMALLR		0x100		/* submatrix gets all rows from original matrix */
 #define FLAG_SUBMALLC		0x200		/* submatrix gets all cols from original matrix */
+#define FLAG_SUBMCONTC		0x400		/* submatrix cols are contiguous in the original matrix */
+#define FLAG_SUBMBLOCK		0x800		/* submatrix is a block, only its first row and col are stored */
 
 /* matrix dimensions */
 typedef struct {
 	int c,r;
 } dims;
 
+/* fixed point matrix dimensions: q is the number of fractional bits,
+   15 (int16_t samples) or 31 (int32_t samples) */
+typedef struct {
+	int c,r,q;
+} qdims;
+
+/* lazy a:b:c vector: element k is start+k*step, k<n. Only lives
+   as a temporary value while an expression is evaluated */
+typedef struct {
+	real start,step;
+	int n;
+} range_t;
+
 typedef struct { header hd; double val; } realtyp;
 
 /* binary function */
@@ -93,6 +114,9 @@ typedef struct {
 #define cplxof(hd) ((real *)((hd)+1))
 #define matrixof(hd) ((real *)((char *)((hd)+1)+sizeof(dims)))
 #define dimsof(hd) ((dims *)((hd)+1))
+#define qdimsof(hd) ((qdims *)((hd)+1))
+#define qmatrixof(hd) ((void *)((char *)((hd)+1)+sizeof(qdims)))
+#define rangeof(hd) ((range_t *)((hd)+1))
 #define commandof(hd) ((int *)((hd)+1))
 #define referenceof(hd) (*((header **)((hd)+1)))
 #define rowsof(hd) ((int *)((dims *)((header **)((hd)+1)+1)+1))
@@ -119,9 +143,11 @@ typedef struct {
 
 #define matrixsize(c,r) (sizeof(dims)+(c)*(r)*sizeof(real))
 #define cmatrixsize(c,r) (sizeof(dims)+2l*(c)*(r)*sizeof(real))
+#define qmatrixsize(c,r,q) (sizeof(qdims)+(LONG)(c)*(r)*((q)==15 ? sizeof(int16_t) : sizeof(int32_t)))
 
 #define isreal(hd) (((hd)->type==s_real || (hd)->type==s_matrix))
 #define iscplx(hd) (((hd)->type==s_complex || (hd)->type==s_cmatrix))
+#define isqmatrix(hd) ((hd)->type==s_qmatrix)
 #define isrealorcplx(hd) (((hd)->type==s_complex || (hd)->type==s_cmatrix || (hd)->type==s_real || (hd)->type==s_matrix))
 
 #ifndef MIN
@@ -142,6 +168,17 @@ void stack_rewind(Calc *cc);
 void* stack_alloc (Calc *cc, stacktyp type, int size, char *name);
 void* stack_realloc(Calc *cc, header* hd, int size);
 
+/* scratch pool for the work buffers of builtins, over extra RAM banks.
+   matrix values always stay in the calc stack */
+#define POOL_BANKS_MAX		4
+
+int   pool_add (char *start, unsigned long size);
+void  pool_reset (void);
+void* pool_alloc (unsigned long size);
+void  pool_free (void *p);
+unsigned long pool_avail (void);
+int   pool_info (int i, char **base, unsigned long *size, unsigned long *used, unsigned long *hwm);
+
 /* push new element on the stack */
 header* new_real (Calc *cc, real x, char *name);
 header* new_complex (Calc *cc, real x, real y, char *name);
@@ -149,6 +186,8 @@ header* new_string(Calc *cc);
 header* new_cstring (Calc *cc, char *s, int size, char *name);
 header* new_matrix (Calc *cc, int rows, int cols, char *name);
 header* new_cmatrix (Calc *cc, int rows, int cols, char *name);
+header* new_qmatrix (Calc *cc, int rows, int cols, int q, char *name);
+header* new_range (Calc *cc, real start, real step, int n);
 header* new_reference (Calc *cc, header *hd, char *name);
 header* new_submatrix (Calc *cc, header *hd, header *cols, header *rows,
 	char *name);
@@ -163,7 +202,11 @@ header* new_csubm (Calc *cc, header *var, ULONG l, char *name);
 
 void getmatrix (header *hd, int *r, int *c, real **m);
 
+void range_fill (header *hd, real *m);
+void range_expand (Calc *cc, header *hd);
+
 header *getvalue (Calc *cc, header *hd);
+header *getrange (Calc *cc, header *hd);
 header *assign (Calc *cc, header *var, header *value);
 
 header *searchvar (Calc *cc, char *name);
@@ -14,12 +14,14 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include "fsl_debug_console.h"
 #include "pin_mux.h"
 #include "board.h"
 #include "fsl_power.h"
 #include "fsl_usart.h"
+#include "fsl_dma.h"
 #include "fsl_powerquad.h"
 
 #include "fsl_sd.h"
@@ -40,6 +42,10 @@
 
 #define I2C4_MASTER_CLK 12000000
 
+#ifndef CONSOLE_BAUDRATE
+#define CONSOLE_BAUDRATE	115200U
+#endif
+
 ////////////////// Includes para I2C y acelerómetro //////////////////
 
 /*******************************************************************************
@@ -57,6 +63,8 @@ static volatile bool updateFS =false;
  * STANDARD UART-CONSOLE INPUT/OUTPUT ROUTINES
  ******************************************************************************/
 #define RING_BUF_SIZE	32
+#define TX_BUF_SIZE		1024	/* power of 2, at most 1024 (DMA transfer count) */
+#define TX_DMA_CHANNEL	5		/* DMA0 request: FLEXCOMM0 TX */
 
 typedef volatile struct RingBuffer {
 	char data[RING_BUF_SIZE];
@@ -64,16 +72,27 @@ typedef volatile struct RingBuffer {
 	int i_r;
 } RingBuffer;
 
+typedef volatile struct TxRingBuffer {
+	char data[TX_BUF_SIZE];
+	int	i_w;
+	int i_r;
+	int dma_len;				/* size of the block being sent, 0 when idle */
+} TxRingBuffer;
+
 RingBuffer rxbuf = {
 	.i_w=0,
 	.i_r=0
 };
 
-RingBuffer txbuf = {
+TxRingBuffer txbuf = {
 	.i_w=0,
-	.i_r=0
+	.i_r=0,
+	.dma_len=0
 };
 
+static dma_handle_t uart_dma;
+static uint32_t uart_baud;
+
 volatile int user_break=0;
 
 // called from the ISR for each received char
@@ -95,14 +114,35 @@ void FLEXCOMM0_IRQHandler()
     } else {
     	USART_ReadByte(USART0);
     }
-	while ((status & kUSART_TxFifoNotFullFlag) && (txbuf.i_r!=txbuf.i_w)) {
-		USART0->FIFOWR=txbuf.data[txbuf.i_r];
-		txbuf.i_r=(txbuf.i_r+1) % RING_BUF_SIZE;
-		status=USART_GetStatusFlags(USART0);
-		if (txbuf.i_r==txbuf.i_w) {
-			USART_DisableInterrupts(USART0, kUSART_TxLevelInterruptEnable);
-		}
-	}
+}
+
+/* uart_tx_start: send the next contiguous block of the tx ring buffer
+ *   by DMA, if no transfer is running. Called with interrupts disabled.
+ *   The channel setup is redone each time since DMA_Init() (pcm) resets
+ *   the DMA controller.
+ */
+static void uart_tx_start(void)
+{
+	int len;
+	
+	if (txbuf.dma_len || txbuf.i_r==txbuf.i_w) return;
+	len = (txbuf.i_w>txbuf.i_r) ? txbuf.i_w-txbuf.i_r : TX_BUF_SIZE-txbuf.i_r;
+	txbuf.dma_len=len;
+	DMA_SetChannelConfig(DMA0, TX_DMA_CHANNEL, NULL, true);
+	DMA_SetChannelPriority(DMA0, TX_DMA_CHANNEL, kDMA_ChannelPriority7);
+	DMA_EnableChannelInterrupts(DMA0, TX_DMA_CHANNEL);
+	DMA_SubmitChannelTransferParameter(&uart_dma,
+		DMA_CHANNEL_XFER(false, true, true, false, 1, kDMA_AddressInterleave1xWidth, kDMA_AddressInterleave0xWidth, len),
+		(void*)&txbuf.data[txbuf.i_r], (void*)&USART0->FIFOWR, NULL);
+	DMA_StartTransfer(&uart_dma);
+}
+
+// called from the DMA ISR at the end of a block
+static void uart_tx_dma_cb(dma_handle_t *handle, void *param, bool done, uint32_t tcds)
+{
+	txbuf.i_r = (txbuf.i_r+txbuf.dma_len) & (TX_BUF_SIZE-1);
+	txbuf.dma_len=0;
+	uart_tx_start();
 }
 
 void uart_init(USART_Type *base, uint32_t baudrate)
@@ -131,6 +171,13 @@ void uart_init(USART_Type *base, uint32_t baudrate)
 ////////////////////HABILITADOS PARA QUE FUNCIONE wait_test_key() ///////
 
 	USART_Init(base, &config, CLOCK_GetFlexCommClkFreq(0U));
+	uart_baud=baudrate;
+
+	/* TX is drained by DMA */
+	DMA_Init(DMA0);
+	DMA_CreateHandle(&uart_dma, DMA0, TX_DMA_CHANNEL);
+	DMA_SetCallback(&uart_dma, uart_tx_dma_cb, NULL);
+	USART_EnableTxDMA(base, true);
 
 	/* Enable RX interrupt. */
 	USART_EnableInterrupts(base, kUSART_RxLevelInterruptEnable);
@@ -138,25 +185,58 @@ void uart_init(USART_Type *base, uint32_t baudrate)
     NVIC_EnableIRQ(FLEXCOMM0_IRQn);
 }
 
+/*
+ * uart_flush : wait until all the pending output is sent
+ */
+void uart_flush(USART_Type *base)
+{
+	while (txbuf.dma_len || txbuf.i_r!=txbuf.i_w) ;
+	while (!(base->STAT & USART_STAT_TXIDLE_MASK)) ;
+}
+
+/*
+ * uart_set_baud : change the baud rate once the pending output is sent,
+ *   return the previous one
+ */
+uint32_t uart_set_baud(USART_Type *base, uint32_t baudrate)
+{
+	uint32_t old=uart_baud;
+	uart_flush(base);
+	if (USART_SetBaudRate(base, baudrate, CLOCK_GetFlexCommClkFreq(0U))!=kStatus_Success) return 0;
+	uart_baud=baudrate;
+	return old;
+}
+
 static void update_sd_state();
 
 /*
- * uart_putc : send a char over the serial link (polling)
+ * uart_write : send len bytes over the serial link. The data is copied
+ *   to the tx ring buffer by blocks, waiting only when it is full.
  */
+void uart_write(USART_Type *base, const char *buf, int len) {
+	while (len>0) {
+		int w=txbuf.i_w, n, k;
+		while (((w+1) & (TX_BUF_SIZE-1)) == txbuf.i_r) ;	// buffer full, so wait.
+		n = (txbuf.i_r-w-1) & (TX_BUF_SIZE-1);				// free space
+		if (n>len) n=len;
+		k = TX_BUF_SIZE-w;									// up to the end of the buffer
+		if (k>n) k=n;
+		memcpy((char*)&txbuf.data[w], buf, k);
+		memcpy((char*)&txbuf.data[0], buf+k, n-k);
+		buf+=n; len-=n;
+		uint32_t primask = DisableGlobalIRQ();
+		txbuf.i_w = (w+n) & (TX_BUF_SIZE-1);
+		uart_tx_start();
+		EnableGlobalIRQ(primask);
+	}
+}
+
 void uart_putc(USART_Type *base, char c) {
-	while ((txbuf.i_w+1) % RING_BUF_SIZE == txbuf.i_r) ;	// buffer full, so wait.
-	uint32_t interruptMask = USART_GetEnabledInterrupts(base);
-	USART_DisableInterrupts(base, interruptMask);
-	txbuf.data[txbuf.i_w]=c;
-	txbuf.i_w = (txbuf.i_w+1) % RING_BUF_SIZE;
-	// enable TxE IRQ
-    USART_EnableInterrupts(base, interruptMask|kUSART_TxLevelInterruptEnable);
+	uart_write(base, &c, 1);
 }
 
 void uart_puts(USART_Type *base, const char *s) {
-	for (int i=0; s[i]!=0; i++) {
-		uart_putc(base, s[i]);
-	}
+	uart_write(base, s, strlen(s));
 }
 
 /*
@@ -221,15 +301,31 @@ If you have a line buffered input with echo then do not print,
 when the command line is on.
 *****/
 {
-	char crlf[3]="\r\n";
-	while (*s) {
-		if (*s=='\n') {
-			uart_puts(USART0,crlf);
-		} else {
-			uart_putc(USART0,*s);
-		}
-		s++;
+	char *p;
+	while ((p=strchr(s,'\n'))!=NULL) {
+		uart_write(USART0,s,p-s);
+		uart_write(USART0,"\r\n",2);
+		s=p+1;
 	}
+	uart_write(USART0,s,strlen(s));
+}
+
+void sys_write (const void *buf, int len)
+/*****
+Send raw bytes on the console, no translation.
+*****/
+{
+	uart_write(USART0,(const char*)buf,len);
+}
+
+unsigned long sys_baud (unsigned long baud)
+/*****
+Set the console baud rate (0: no change), return the previous one
+or 0 if the rate can't be set.
+*****/
+{
+	if (baud==0) return uart_baud;
+	return uart_set_baud(USART0,baud);
 }
 
 /***** 
@@ -343,17 +439,29 @@ void page_down_cb()
 volatile uint32_t sys_tick_cnt=0;
 volatile uint32_t sys_tick_cnt_limit = (1U << 23);
 
+static volatile int accel_on=0;
+static void accel_poll (void);
+
+/* extension of the 32 bit cycle counter, which wraps in about 28 s */
+static volatile uint32_t cyc_hi=0, cyc_last=0;
+
 /* sys_tick timer IRQ Handler
  *    limit sys_tick_cnt to 23 bits
+ *    extend the cycle counter to 64 bits
+ *    poll the accelerometer when sampling is running
  */
 void SysTick_Handler(void)
 {
+	uint32_t c=DWT->CYCCNT;
+	if (c<cyc_last) cyc_hi++;
+	cyc_last=c;
 	if (sys_tick_cnt >= sys_tick_cnt_limit){
 		sys_tick_cnt = 0;
 	}
 	else{
 		sys_tick_cnt += 1 ;
 	}
+	if (accel_on) accel_poll();
 }
 
 real sys_clock (void)
@@ -363,6 +471,37 @@ real sys_clock (void)
 	return (real)sys_tick_cnt;
 }
 
+void sys_cycles_init (void)
+/***** start the DWT cycle counter. Users only take differences, so a
+	running counter is left alone.
+******/
+{
+	if (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) return;
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+unsigned long long sys_cycles (void)
+/***** current CPU cycle count on 64 bits. The sys_tick handler samples
+	the 32 bit DWT counter every ms and counts its wrap arounds.
+******/
+{
+	uint32_t h,l,c;
+	do {
+		h=cyc_hi; l=cyc_last; c=DWT->CYCCNT;
+	} while (h!=cyc_hi || l!=cyc_last);
+	if (c<l) h++;		/* wrapped since the last tick */
+	return ((unsigned long long)h<<32)|c;
+}
+
+unsigned long sys_cycles_freq (void)
+/***** cycle counter frequency in Hz.
+******/
+{
+	return SystemCoreClock;
+}
+
 void sys_wait (real time, scan_t *scan)
 /***** Wait for time seconds or until a key press.
 Return the scan code or 0 (time exceeded).
@@ -392,6 +531,122 @@ Return the scan code or 0 (time exceeded).
 }
 
 
+/*******************************************************************************
+ * ACCELEROMETER SAMPLING
+ *   the data ready flag of the MMA8652 is polled each SysTick (1ms) with a
+ *   non-blocking I2C read of STATUS+OUT_XYZ. New samples are timestamped and
+ *   pushed in a ring buffer, accel_read() pulls them by blocks of n samples.
+ ******************************************************************************/
+#define ACCEL_BUF_SIZE		512		/* power of 2 */
+
+typedef struct {
+	int16_t		xyz[3];				/* raw values */
+	uint32_t	t;					/* timestamp (ms) */
+} AccelSample;
+
+static AccelSample accel_buf[ACCEL_BUF_SIZE];
+static volatile unsigned accel_w=0, accel_r=0;
+static volatile int accel_busy=0;
+static volatile unsigned long accel_lost=0;
+static uint8_t accel_raw[7];
+static int accel_n=0;
+
+static const struct {
+	real		rate;
+	uint32_t	odr;
+} accel_odr[] = {
+	{1.5625,MMA8652_RATE_1_56}, {6.25,MMA8652_RATE_6_25},
+	{12.5,MMA8652_RATE_12_5}, {50.0,MMA8652_RATE_50},
+	{100.0,MMA8652_RATE_100}, {200.0,MMA8652_RATE_200},
+	{400.0,MMA8652_RATE_400}, {800.0,MMA8652_RATE_800}
+};
+
+static void accel_done (status_t status)
+/***** called from the I2C interrupt when the read completes
+******/
+{
+	if (status==kStatus_Success && (accel_raw[0] & MMA8652_DATA_READY)) {
+		unsigned w=accel_w;
+		if (((w+1) & (ACCEL_BUF_SIZE-1))==accel_r) {
+			accel_lost++;		/* buffer full: drop the sample */
+		} else {
+			mma8652_raw(accel_raw,accel_buf[w].xyz);
+			accel_buf[w].t=sys_tick_cnt;
+			accel_w=(w+1) & (ACCEL_BUF_SIZE-1);
+		}
+	}
+	accel_busy=0;
+}
+
+static void accel_poll (void)
+/***** start a new read if the previous one is over
+******/
+{
+	if (!accel_busy) {
+		accel_busy=1;
+		if (mma8652_read_async(accel_raw,accel_done)!=kStatus_Success) accel_busy=0;
+	}
+}
+
+real accel_start (real rate, int n)
+/***** start sampling at the first data rate >= rate, by blocks of n
+	samples. rate=0 stops the sampling.
+	return the effective data rate, 0 when stopped, -1 on failure.
+******/
+{
+	int i;
+	
+	accel_on=0;
+	while (accel_busy) ;
+	accel_n=0;
+	if (rate<=0.0) return 0.0;
+	
+	for (i=0; i<(int)(sizeof(accel_odr)/sizeof(accel_odr[0]))-1; i++) {
+		if (accel_odr[i].rate>=rate) break;
+	}
+	if (mma8652_set_rate(accel_odr[i].odr)!=kStatus_Success) return -1.0;
+	accel_r=accel_w=0;
+	accel_lost=0;
+	accel_n=n;
+	accel_on=1;
+	return accel_odr[i].rate;
+}
+
+int accel_count (void)
+/***** block size when sampling is running, 0 else.
+******/
+{
+	return accel_on ? accel_n : 0;
+}
+
+int accel_read (real *xyz, real *t, unsigned long *lost)
+/***** wait for a block of accel_n samples. xyz is filled row by row
+	with the values in g, t with the timestamps in seconds.
+	return the number of samples or 0 if interrupted by a key press.
+******/
+{
+	int16_t raw[3];
+	int32_t mg[3];
+	int i, k;
+	
+	for (i=0; i<accel_n; i++) {
+		unsigned r=accel_r;
+		while (r==accel_w) {
+			if (sys_test_key()==escape) return 0;
+		}
+		raw[0]=accel_buf[r].xyz[0];
+		raw[1]=accel_buf[r].xyz[1];
+		raw[2]=accel_buf[r].xyz[2];
+		t[i]=(real)accel_buf[r].t/1000.0;
+		accel_r=(r+1) & (ACCEL_BUF_SIZE-1);
+		mma8652_to_mg(raw,mg);
+		for (k=0; k<3; k++) xyz[3*i+k]=(real)mg[k]/1000.0;
+	}
+	*lost=accel_lost;
+	accel_lost=0;
+	return accel_n;
+}
+
 /*******************************************************************************
  * FILE INPUT/OUTPUT ROUTINES (SDCARD)
  ******************************************************************************/
@@ -1764,9 +2019,13 @@ Initialize memory and call main_loop
  	/* Allocate the stack: initialize stack limit pointers */
 	calc->ramstart=(char*)0x20018000;
 	calc->ramend=(char*)0x20030000;
+	/* bank left free by the linker, for the scratch pool. SRAM4
+	   (0x20040000) is not free: it is the PowerQuad private RAM, that
+	   the PQ temporary area at 0xE0000000 aliases */
+	pool_add((char*)0x04000000,0x8000);		/* SRAMX, 32 KB */
 
     /* UART initialization */
-    uart_init(USART0,115200U);
+    uart_init(USART0,CONSOLE_BAUDRATE);
 
 	/* get width of the terminal */
 	calc->termwidth = TERMWIDTH;
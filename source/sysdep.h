@@ -46,6 +46,7 @@ typedef float			real;
 #define asin			asinf
 #define atan			atanf
 #define atan2			atan2f
+#define hypot			hypotf
 #define erf				erff
 #define erfc			erfcf
 
@@ -75,6 +76,7 @@ typedef double			real;
 #define asin			asin
 #define atan			atan
 #define atan2			atan2
+#define hypot			hypot
 #define erf				erf
 #define erfc			erfc
 
@@ -127,6 +129,16 @@ typedef enum {
 real sys_clock (void);
 void sys_wait (real delay, scan_t *scan);
 
+/* cycle counter, used by the profiler */
+void sys_cycles_init (void);
+unsigned long long sys_cycles (void);
+unsigned long sys_cycles_freq (void);
+
+/* accelerometer sampling */
+real accel_start (real rate, int n);
+int  accel_count (void);
+int  accel_read (real *xyz, real *t, unsigned long *lost);
+
 /* text IO */
 /*** output modes ***
    CC_OUTPUT:	standard result output mode
@@ -144,6 +156,8 @@ void sys_wait (real delay, scan_t *scan);
 void sys_out_mode(int mode);
 int sys_wait_key (scan_t *scan);
 int sys_test_key (void);
+void sys_write (const void *buf, int len);	/* raw console output */
+unsigned long sys_baud (unsigned long baud);
 
 /* output */
 void sys_clear (void);		/* clear the output peripheral */
@@ -7,11 +7,13 @@
 
 #include "board.h"
 #include "sysdep_pcm.h"
+#include "dsp.h"
 
 #include <math.h>
 
 extern volatile int user_break;
 char uart_getc(USART_Type *base);
+void uart_flush(USART_Type *base);		/* DMA_Init() resets the console DMA channel */
 
 void codec_set_master(wm8904_handle_t *handle, int master);
 
@@ -355,15 +357,43 @@ static void pcm_play_cb(I2S_Type *base, i2s_dma_handle_t *handle, status_t compl
 	pcm_tx_buf_done=1;
 }
 
-int pcm_play(real *data, int ch, int n)
+/* fill a transmit buffer from sample i of the left and right channels
+ * (real, Q15 or Q31 data), cycling over the n samples. Returns the
+ * next sample index.
+ *****/
+static int pcm_play_fill(int16_t *d, const void *ch0, const void *ch1, int q, int i, int n)
 {
-    const float *pcm_ch0=(float*)data;
-    const float *pcm_ch1=(ch>1) ? (float*)(data+n) : (float*)data;
+	for (int k=0;k<SAMPLE_NB;k++) {
+		switch (q) {
+		case 15:
+			*d++ = ((const int16_t*)ch0)[i];			// left channel sample
+			*d++ = ((const int16_t*)ch1)[i];			// right channel sample
+			break;
+		case 31:
+			*d++ = (int16_t)(((const int32_t*)ch0)[i]>>16);
+			*d++ = (int16_t)(((const int32_t*)ch1)[i]>>16);
+			break;
+		default:
+			*d++ = (int16_t)(((const real*)ch0)[i]*32768.0);
+			*d++ = (int16_t)(((const real*)ch1)[i]*32768.0);
+			break;
+		}
+		i = ((i+1)==n) ? 0 : i+1;
+	}
+	return i;
+}
+
+int pcm_play(void *data, int q, int ch, int n)
+{
+	int sz=(q==15) ? sizeof(int16_t) : (q==31) ? sizeof(int32_t) : sizeof(real);
+    const void *pcm_ch0=data;
+    const void *pcm_ch1=(ch>1) ? (char*)data+(long)n*sz : data;
 	int i=0;
 	int pcm_buf_id=0;
 
 	codec_set_master(&wm8904Handle,0);		// set codec in slave mode
 
+    uart_flush(USART0);
     DMA_Init(DMA0);
 	DMA_EnableChannel(DMA0, 19);
 	DMA_SetChannelPriority(DMA0, 19, kDMA_ChannelPriority3);
@@ -373,22 +403,10 @@ int pcm_play(real *data, int ch, int n)
 
 	pcm_tx_buf_done=0;
 
-	int16_t *d;
     // setup 2 buffers with SAMPLE_NB left and right channel samples.
 	//   use left and right channels as ring buffers
-    d=(int16_t*)pcm_tx_xfer[0].data;
-    for (int k=0;k<SAMPLE_NB;k++) {
-    	*d++ = (int16_t)(pcm_ch0[i]*32768.0);	// left channel sample
-    	*d++ = (int16_t)(pcm_ch1[i]*32768.0);	// right channel sample
-     	i = ((i+1)==n) ? 0 : i+1;
-    }
-
-    d=(int16_t*)pcm_tx_xfer[1].data;
-    for (int k=0;k<SAMPLE_NB;k++) {
-    	*d++ = (int16_t)(pcm_ch0[i]*32768.0);	// left channel sample
-    	*d++ = (int16_t)(pcm_ch1[i]*32768.0);	// right channel sample
-     	i = ((i+1)==n) ? 0 : i+1;
-    }
+    i=pcm_play_fill((int16_t*)pcm_tx_xfer[0].data,pcm_ch0,pcm_ch1,q,i,n);
+    i=pcm_play_fill((int16_t*)pcm_tx_xfer[1].data,pcm_ch0,pcm_ch1,q,i,n);
    /* need to queue two transmit buffers so when the first one
      * finishes transfer, the other immediatelly starts */
     I2S_TxTransferSendDMA(I2S7, &s_TxHandle, pcm_tx_xfer[0]);
@@ -417,12 +435,7 @@ int pcm_play(real *data, int ch, int n)
 			continue;
     	}
 
-    	d=(int16_t*)pcm_tx_xfer[pcm_buf_id].data;
-        for (int k=0;k<SAMPLE_NB;k++) {
-        	*d++ = (int16_t)(pcm_ch0[i]*32768.0);	// left channel sample
-        	*d++ = (int16_t)(pcm_ch1[i]*32768.0);	// right channel sample
-         	i = ((i+1)==n) ? 0 : i+1;
-        }
+        i=pcm_play_fill((int16_t*)pcm_tx_xfer[pcm_buf_id].data,pcm_ch0,pcm_ch1,q,i,n);
         I2S_TxTransferSendDMA(I2S7, &s_TxHandle, pcm_tx_xfer[pcm_buf_id]);
     	pcm_buf_id=!pcm_buf_id;
     }
@@ -442,12 +455,14 @@ static void pcm_rec_rx_cb(I2S_Type *base, i2s_dma_handle_t *handle, status_t com
 	pcm_rx_buf_done=1;
 }
 
-int pcm_rec(real *data, int n)
+int pcm_rec(void *data, int q, int n)
 {
 	int pcm_rec_buf_id=0;
 
-    float *pcm_rec_ch0=data;
-    float *pcm_rec_ch1=data+n;
+	int16_t *q15=(int16_t*)data;
+	int32_t *q31=(int32_t*)data;
+    real *pcm_rec_ch0=(real*)data;
+    real *pcm_rec_ch1=(real*)data+n;
 	int i=0;
 
     pcm_rx_buf_done=0;
@@ -455,6 +470,7 @@ int pcm_rec(real *data, int n)
     // set audio codec in master mode (it generates the i2s clock)
     codec_set_master(&wm8904Handle, 1);
 
+	uart_flush(USART0);
 	DMA_Init(DMA0);
 	DMA_EnableChannel(DMA0, 16);
 	DMA_SetChannelPriority(DMA0, 16, kDMA_ChannelPriority2);
@@ -472,10 +488,21 @@ int pcm_rec(real *data, int n)
     	pcm_rx_buf_done=0;
     	int16_t *d=(int16_t*)pcm_rx_xfer[pcm_rec_buf_id].data;
     	pcm_rec_buf_id=!pcm_rec_buf_id;
-        for (int k=0;k<SAMPLE_NB;++k) {
-    		pcm_rec_ch0[i+k]=(float)d[2*k]/32768.0;
-    		pcm_rec_ch1[i+k]=(float)d[2*k+1]/32768.0;
-    		if (i+k==n) break;
+        for (int k=0;k<SAMPLE_NB && i+k<n;++k) {
+        	switch (q) {
+        	case 15:	// native CODEC format, just deinterleave
+        		q15[i+k]=d[2*k];
+        		q15[n+i+k]=d[2*k+1];
+        		break;
+        	case 31:
+        		q31[i+k]=(int32_t)d[2*k]*65536;
+        		q31[n+i+k]=(int32_t)d[2*k+1]*65536;
+        		break;
+        	default:
+        		pcm_rec_ch0[i+k]=(real)d[2*k]/32768.0;
+        		pcm_rec_ch1[i+k]=(real)d[2*k+1]/32768.0;
+        		break;
+        	}
         }
         i+=SAMPLE_NB;
         if (i<n-SAMPLE_NB) {
@@ -486,6 +513,16 @@ int pcm_rec(real *data, int n)
 	return 1;
 }
 
+/* processing cycles of the pcm_loop callback, per block */
+static unsigned long pcm_cyc_sum, pcm_cyc_max, pcm_cyc_blocks;
+
+void pcm_loop_cycles(real *avg, real *max, real *deadline)
+{
+	*avg=pcm_cyc_blocks ? (real)pcm_cyc_sum/(real)pcm_cyc_blocks : 0.0;
+	*max=(real)pcm_cyc_max;
+	*deadline=(real)sys_cycles_freq()*SAMPLE_NB/(real)sample_freq;
+}
+
 #if 1
 /* pcm_loop
  *   use DMA0 to get a buffer of n samples (2 ways) from I2S6_Rx connected to
@@ -523,6 +560,8 @@ int pcm_loop(fn_cb fn)
 	int n=0;				// number of processed samples
 
     pcm_rx_buf_done=0;
+    pcm_cyc_sum=pcm_cyc_max=pcm_cyc_blocks=0;
+    sys_cycles_init();
 
     // setup processing function
     fn_cb proc = fn ? fn : echo_cb;
@@ -530,6 +569,7 @@ int pcm_loop(fn_cb fn)
     // set audio codec in master mode (it generates the i2s clock)
     codec_set_master(&wm8904Handle, 0);
 
+	uart_flush(USART0);
 	DMA_Init(DMA0);
 	DMA_EnableChannel(DMA0, 16);
 	DMA_SetChannelPriority(DMA0, 16, kDMA_ChannelPriority2);
@@ -580,7 +620,12 @@ int pcm_loop(fn_cb fn)
     	int16_t *dout=(int16_t*)pcm_tx_xfer[pcm_buf_id].data;
 
     	// process data
+    	unsigned long t0=sys_cycles();
     	proc(din,dout,SAMPLE_NB);
+    	t0=sys_cycles()-t0;
+    	pcm_cyc_sum+=t0;
+    	if (t0>pcm_cyc_max) pcm_cyc_max=t0;
+    	pcm_cyc_blocks++;
 
     	/* output processed data */
         I2S_TxTransferSendDMA(I2S7, &s_TxHandle, pcm_tx_xfer[pcm_buf_id]);
@@ -645,6 +690,8 @@ int pcm_loop(fn_cb fn)
 	int n=0;				// number of processed samples
 
     pcm_rx_buf_done=0;
+    pcm_cyc_sum=pcm_cyc_max=pcm_cyc_blocks=0;
+    sys_cycles_init();
 
     // setup process function
     fn_cb proc = fn ? fn : echo_cb;
@@ -652,6 +699,7 @@ int pcm_loop(fn_cb fn)
     // set audio codec in master mode (it generates the i2s clock)
     codec_set_master(&wm8904Handle, 0);
 
+	uart_flush(USART0);
 	DMA_Init(DMA0);
 	DMA_EnableChannel(DMA0, 16);
 	DMA_SetChannelPriority(DMA0, 16, kDMA_ChannelPriority2);
@@ -703,7 +751,12 @@ int pcm_loop(fn_cb fn)
     	int16_t *dout=(int16_t*)pcm_xfer[pcm_buf_id].data;
 
     	// process data
+    	unsigned long t0=sys_cycles();
     	proc(din,dout,SAMPLE_NB);
+    	t0=sys_cycles()-t0;
+    	pcm_cyc_sum+=t0;
+    	if (t0>pcm_cyc_max) pcm_cyc_max=t0;
+    	pcm_cyc_blocks++;
 
     	/* output processed data */
         I2S_TxTransferSendDMA(I2S7, &s_TxHandle, pcm_xfer[pcm_buf_id]);
@@ -719,96 +772,148 @@ int pcm_loop(fn_cb fn)
 }
 #endif
 
-#if 0
-#define BIQUAD_MAX_STAGES		12
-
-typedef struct {
-	float	b[3];	/* numerator coeffs */
-	float	a[3];	/* denominator coeffs */
-	float	w[3];	/* internal state */
-} biquad_t;
-
-typedef struct {
-	biquad_t	biquads[BIQUAD_MAX_STAGES];
-	float		gain;
-	int			num_stages;
-} iir_filter_t;
+/* pcm_sos
+ *   software SOS cascade on the live audio, Q15 on both channels
+ *****/
+static sos_t sos_lr[2];
 
-iir_filter_t filt;
+static void sos_filter_cb(int16_t *in, int16_t *out, int n)
+{
+	sos_run_q15(&sos_lr[0],in,out,n,2);
+	sos_run_q15(&sos_lr[1],in+1,out+1,n,2);
+}
 
-float iir_calc(iir_filter_t *f, float x)
+int pcm_sos(real *sos, int ns)
 {
-	float y=x;
-	biquad_t *bq=f->biquads;
-	for (int i=0; i< f->num_stages; i++) {
-		
-		/* A COMPLETER */
-		
-		bq++;
-	}
-	return y*f->gain;
+	if (sos_init(&sos_lr[0],sos,ns,15) || sos_init(&sos_lr[1],sos,ns,15))
+		return -1;
+	return pcm_loop(sos_filter_cb);
 }
 
-void iir_filter_cb(int16_t*in, int16_t *out, int n) {
-	for (int k=0; k<n; k++) {
-		out[2*k]=iir_calc(&filt, in[2*k]);
-//		out[2*k]=in[2*k]>>1;
-		out[2*k+1]=0;
+/* pcm_biquad
+ *   PowerQuad DF2 biquad cascade on both channels with 16 bit data. The
+ *   PowerQuad computes in float:
+ *     v[n]=x[n]-a1*v[n-1]-a2*v[n-2]
+ *     y[n]=b0*v[n]+b1*v[n-1]+b2*v[n-2]
+ *****/
+#define BIQUAD_MAX_STAGES		12
+#define BIQUAD_GRID				64		/* frequencies used for the gain staging */
+
+static pq_biquad_cascade_df2_instance pq_lr[2];
+static pq_biquad_state_t pq_state[2][BIQUAD_MAX_STAGES];
+static int16_t pq_buf[2][SAMPLE_NB];
+
+static int pq_biquad_load(real *b, real *a, int r)
+/***** pq_biquad_load
+	convert the [r x 3] B and A lines to PowerQuad stages, normalized by a0.
+	Gain staging: each stage but the last is scaled so that the peak
+	magnitude of the cascade up to it is 1, so that the 16 bit results
+	passed between stage pairs do not clip; the last stage restores the
+	overall gain.
+*****/
+{
+	real mag[BIQUAD_GRID], g=1.0;
+	
+	if (r<1 || r>BIQUAD_MAX_STAGES) return -1;
+	for (int k=0; k<BIQUAD_GRID; k++) mag[k]=1.0;
+	for (int i=0; i<r; i++, b+=3, a+=3) {
+		if (a[0]==0.0) return -1;
+		real b0=b[0]/a[0], b1=b[1]/a[0], b2=b[2]/a[0];
+		real a1=a[1]/a[0], a2=a[2]/a[0];
+		real peak=0.0, sc;
+		for (int k=0; k<BIQUAD_GRID; k++) {
+			real w=M_PI*k/(BIQUAD_GRID-1);
+			real c1=cos(w), s1=sin(w), c2=cos(2*w), s2=sin(2*w);
+			real nr=b0+b1*c1+b2*c2, ni=b1*s1+b2*s2;
+			real dr=1.0+a1*c1+a2*c2, di=a1*s1+a2*s2;
+			real d=dr*dr+di*di;
+			mag[k]*=(d>0.0) ? sqrt((nr*nr+ni*ni)/d) : 0.0;
+			if (mag[k]>peak) peak=mag[k];
+		}
+		if (i<r-1) {
+			sc=(peak>0.0) ? 1.0/peak : 1.0;
+			g*=sc;
+			for (int k=0; k<BIQUAD_GRID; k++) mag[k]*=sc;
+		} else {
+			sc=1.0/g;
+		}
+		for (int ch=0; ch<2; ch++) {
+			pq_biquad_state_t *st=&pq_state[ch][i];
+			st->param.v_n_1=0.0f; st->param.v_n=0.0f;
+			st->param.a_1=(float)a1; st->param.a_2=(float)a2;
+			st->param.b_0=(float)(b0*sc); st->param.b_1=(float)(b1*sc);
+			st->param.b_2=(float)(b2*sc);
+			st->compreg=0;
+		}
 	}
+	PQ_BiquadCascadeDf2Init(&pq_lr[0], r, pq_state[0]);
+	PQ_BiquadCascadeDf2Init(&pq_lr[1], r, pq_state[1]);
+	return 0;
 }
 
-void pcm_biquad(real *b, real *a, int r, int c, real *n)
+static void iir_filter_cb(int16_t *in, int16_t *out, int n)
 {
-	if (r-1>BIQUAD_MAX_STAGES) {
-		*n=(real)0;
-		return;
+	/* the PowerQuad reads contiguous samples: one split and one merge pass */
+	for (int k=0; k<n; k++) {
+		pq_buf[0][k]=in[2*k];
+		pq_buf[1][k]=in[2*k+1];
 	}
-	filt.num_stages=r-1;
-	filt.gain=*b; b+=3; a+=3;
-	for (int i=0; i<r-1; i++) {
-		
-		/* A COMPLETER */
-		
-		filt.biquads[i].w[0]=0.0;
-		filt.biquads[i].w[1]=0.0;
-		filt.biquads[i].w[2]=0.0;
+	PQ_BiquadCascadeDf2Fixed16(&pq_lr[0], pq_buf[0], pq_buf[0], n);
+	PQ_BiquadCascadeDf2Fixed16(&pq_lr[1], pq_buf[1], pq_buf[1], n);
+	for (int k=0; k<n; k++) {
+		out[2*k]=pq_buf[0][k];
+		out[2*k+1]=pq_buf[1][k];
 	}
-	*n=(real)pcm_loop(iir_filter_cb);
 }
-#else
-#define BIQUAD_MAX_STAGES		12
-pq_biquad_cascade_df2_instance S;
 
-pq_biquad_state_t state[BIQUAD_MAX_STAGES];
-
-void iir_filter_cb(int16_t*in, int16_t *out, int n) {
-	for (int k=0; k<n; k++) {
-		in[k]=in[2*k];
-    }
-
-	PQ_BiquadCascadeDf2Fixed16(&S, in, out, n);
-	
-    for (int k=n-1; k>=0; k--) {
-    	out[2*k]=out[k];
-    	out[2*k+1]=0;
-    }
+int pcm_biquad(real *b, real *a, int r)
+{
+	if (pq_biquad_load(b,a,r)) return -1;
+	return pcm_loop(iir_filter_cb);
 }
 
-void pcm_biquad(real *b, real *a, int r, int c, real *n)
+int pcm_biquad_model(real *b, real *a, int r, void *x, void *y, int q, int n)
+/***** pcm_biquad_model
+	software model of the PowerQuad path for the left channel: same stages,
+	single precision DF2 in the PowerQuad order, 16 bit rounding and
+	saturation between stage pairs. x and y are real values in [-1,1[
+	(q=0), or Q15/Q31 samples (q=15 or 31). This is an approximation, not
+	a bit exact model: it has not been checked against the PowerQuad
+	output, whose internal float accumulation order may differ.
+*****/
 {
-	if (r-1>BIQUAD_MAX_STAGES) {
-		*n=(real)0;
-		return;
-	}
-	
-    PQ_BiquadCascadeDf2Init(&S, r, (pq_biquad_state_t *)&state);
-	for (int i=0; i<r; i++) {
-		
-		/* A COMPLETER */
-		
-		state[i].compreg=0;
+	if (pq_biquad_load(b,a,r)) return -1;
+	for (int k=0; k<n; k++) {
+		float v;
+		switch (q) {
+		case 15: v=(float)((int16_t*)x)[k]; break;
+		case 31: v=(float)(((int64_t)((int32_t*)x)[k]+32768)>>16); break;
+		default: v=floorf((float)((real*)x)[k]*32768.0f+0.5f); break;
+		}
+		if (v>32767.0f) v=32767.0f; else if (v<-32768.0f) v=-32768.0f;
+		for (int i=0; i<r; i++) {
+			pq_biquad_param_t *p=&pq_state[0][i].param;
+			float w=v-p->a_1*p->v_n-p->a_2*p->v_n_1;
+			v=p->b_0*w+p->b_1*p->v_n+p->b_2*p->v_n_1;
+			p->v_n_1=p->v_n; p->v_n=w;
+			/* odd stage count: the first stage runs alone, then pairs */
+			if ((i-(r&1))%2!=0) {
+				v=floorf(v+0.5f);
+				if (v>32767.0f) v=32767.0f; else if (v<-32768.0f) v=-32768.0f;
+			}
+		}
+		/* the last stage always rounds and saturates to 16 bits */
+		switch (q) {
+		case 15:
+			((int16_t*)y)[k]=(int16_t)v;
+			break;
+		case 31:
+			((int32_t*)y)[k]=(int32_t)v*65536;
+			break;
+		default:
+			((real*)y)[k]=v/32768.0f;
+			break;
+		}
 	}
-	*n=(real)pcm_loop(iir_filter_cb);
+	return 0;
 }
-
-#endif
@@ -40,17 +40,29 @@ int pcm_volume(real left, real right);
  *          left and right channels
  * - ch==2: data is a 2xn array containing the left and right samples on each
  *          line
- * - |data[i]|<1
+ * - q==0: real samples, |data[i]|<1, q==15 or 31: Q15 or Q31 samples
  */
-int pcm_play(real *data, int ch, int n);
+int pcm_play(void *data, int q, int ch, int n);
 
-/* data recording: 2xn samples (left and right) */
-int pcm_rec(real *data, int n);
+/* data recording: 2xn samples (left and right), real (q==0), Q15 or Q31 */
+int pcm_rec(void *data, int q, int n);
 
 typedef void (*fn_cb)(int16_t *in, int16_t *out, int n);
 
 int pcm_loop(fn_cb fn);
 
-void pcm_biquad(real *b, real *a, int r, int c, real *n);
+/* callback cycles per block of the last pcm_loop (average and worst case),
+ * and the cycles available for one block at the sampling frequency */
+void pcm_loop_cycles(real *avg, real *max, real *deadline);
+
+/* live audio through a [ns x 6] SOS cascade (Q15), -1 on bad sections */
+int pcm_sos(real *sos, int ns);
+
+/* PowerQuad biquad cascade on the live audio, r stages given as [r x 3]
+ * B and A lines; -1 on bad coefficients, else the number of samples */
+int pcm_biquad(real *b, real *a, int r);
+
+/* software model of the same path on a vector x, real (q==0), Q15 or Q31 */
+int pcm_biquad_model(real *b, real *a, int r, void *x, void *y, int q, int n);
 
 #endif